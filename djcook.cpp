@@ -0,0 +1,99 @@
+// djcook: cooks everything under resources/ into what the engine loads at runtime, without opening a window.
+//
+// Usage: djcook [-force] [-pack]
+//     -force  Cook everything, even what hasn't changed
+//     -pack   Then write every source and cooked file the engine loads into resources/assets.djpack
+//
+// Only what changed since the last cook is cooked again (see files/cooker.h).
+// Build it like the engine, from this file instead of main.cpp.
+
+#include <iostream>
+#include <string>
+
+#include <stdio.h>
+#include <glew.h>
+#include <SDL.h>
+
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <gtc/type_ptr.hpp>
+#include "files/shader.h"
+#include "files/cooker.h"
+#include "files/assetPack.h"
+
+// Textures
+#define STB_IMAGE_IMPLEMENTATION
+#include "files/stb_image.h"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    bool force = false, pack = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument == "-force") force = true;
+        else if (argument == "-pack") pack = true;
+        else
+        {
+            cout << "Usage: djcook [-force] [-pack]" << endl;
+            return 1;
+        }
+    }
+
+    Cooker cooker;
+    cooker.SetForce(force);
+    cooker.Check();
+
+    // Environment maps are rendered, so they need a context. A hidden window is enough to get one.
+    SDL_Window *window = NULL;
+    SDL_GLContext context = NULL;
+    if (cooker.NeedsContext())
+    {
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+        window = SDL_CreateWindow("djcook", 0, 0, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if (window == NULL)
+        {
+            cout << "SDL could not create window! SDL error: " << SDL_GetError() << endl;
+            return 1;
+        }
+        context = SDL_GL_CreateContext(window);
+        glewExperimental = GL_TRUE;
+        glewInit();
+    }
+
+    bool cooked = cooker.Cook();
+
+    if (window)
+    {
+        SDL_GL_DeleteContext(context);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
+
+    // The pack gets the sources the engine still reads directly (textures, and the IBL maps) and the cooked files
+    if (cooked && pack)
+    {
+        vector <AssetPackSource> sources;
+        CollectAssetSources(COOK_RESOURCE_DIRECTORY "/models", sources);
+        CollectAssetSources(COOK_RESOURCE_DIRECTORY "/images", sources);
+        CollectAssetSources(COOK_RESOURCE_DIRECTORY "/hdr", sources);
+        vector <string> outputs = cooker.Outputs();
+        const char *mapped[] = { ".djmesh", NULL };// Cooked meshes are mapped as they are, so they're stored
+        for (unsigned int i = 0; i < outputs.size(); i++)
+        {
+            AssetPackSource source;
+            source.name = outputs[i];
+            source.path = outputs[i];
+            source.compress = !HasExtension(outputs[i], mapped);
+            sources.push_back(source);
+        }
+        cooked = WriteAssetPack(ASSET_PACK_PATH, sources);
+    }
+
+    return cooked ? 0 : 1;
+}
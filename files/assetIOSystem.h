@@ -0,0 +1,127 @@
+#ifndef ASSETIOSYSTEM_H_INCLUDED
+#define ASSETIOSYSTEM_H_INCLUDED
+
+/***********
+This header lets Assimp read models out of the asset pack.
+
+Assimp opens more than the file it's given (an .obj opens its .mtl, for example), so
+instead of handing it the model's bytes, the importer gets an IOSystem that opens every
+file through OpenAsset. Reads copy straight from the pack's mapping into Assimp's buffers.
+It can also list every file it opened, which is how the cooker finds a model's dependencies.
+************/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <IOSystem.hpp>
+#include <IOStream.hpp>
+#include "assetPack.h"
+
+using namespace std;
+
+/********************
+AssetIOStream: A read-only Assimp stream over an opened asset.
+*********************/
+class AssetIOStream : public Assimp::IOStream
+{
+public:
+    AssetIOStream ()
+    {
+        position = 0;
+    }
+
+    bool Open (string path)
+    {
+        position = 0;
+        return OpenAsset(path, asset);
+    }
+
+    size_t Read (void *buffer, size_t size, size_t count)
+    {
+        if (size == 0) return 0;
+        size_t available = (asset.Size() - position) / size;
+        count = min(count, available);
+        memcpy(buffer, asset.Data() + position, size * count);
+        position += size * count;
+        return count;
+    }
+
+    size_t Write (const void *buffer, size_t size, size_t count)
+    {
+        return 0;
+    }
+
+    aiReturn Seek (size_t offset, aiOrigin origin)
+    {
+        size_t base = origin == aiOrigin_SET ? 0 : (origin == aiOrigin_CUR ? position : asset.Size());
+        if (base + offset > asset.Size()) return aiReturn_FAILURE;
+        position = base + offset;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell () const
+    {
+        return position;
+    }
+
+    size_t FileSize () const
+    {
+        return asset.Size();
+    }
+
+    void Flush ()
+    {
+    }
+
+private:
+    AssetData asset;
+    size_t position;
+};
+
+/********************
+AssetIOSystem: Opens files for Assimp from the mounted packs, or from disk.
+*********************/
+class AssetIOSystem : public Assimp::IOSystem
+{
+public:
+    // If opened isn't NULL, the path of every file opened gets added to it
+    AssetIOSystem (vector<string> *opened = NULL)
+    {
+        this->opened = opened;
+    }
+
+    bool Exists (const char *file) const
+    {
+        return AssetExists(file);
+    }
+
+    char getOsSeparator () const
+    {
+        return '/';
+    }
+
+    Assimp::IOStream * Open (const char *file, const char *mode = "rb")
+    {
+        // Only reading is supported
+        if (strchr(mode, 'w') || strchr(mode, 'a')) return NULL;
+        AssetIOStream *stream = new AssetIOStream;
+        if (!stream->Open(file))
+        {
+            delete stream;
+            return NULL;
+        }
+        if (opened && find(opened->begin(), opened->end(), string(file)) == opened->end()) opened->push_back(file);
+        return stream;
+    }
+
+    void Close (Assimp::IOStream *stream)
+    {
+        delete stream;
+    }
+
+private:
+    vector<string> *opened;
+};
+
+#endif // ASSETIOSYSTEM_H_INCLUDED
@@ -0,0 +1,750 @@
+#ifndef ASSETPACK_H_INCLUDED
+#define ASSETPACK_H_INCLUDED
+
+/***********
+This header holds the asset pack: lots of asset files stored in one, so loading a scene
+costs one open and a memory mapping instead of an open and a stat per model, texture and
+cubemap face.
+
+A pack is mapped as a whole when it's mounted. Its table of contents is a hash table that's
+used right where it sits in the mapping, and every file starts on a 4K boundary, so a
+stored file is handed out as a pointer into the mapping without copying anything. Files
+that were worth it are compressed in independent 64K blocks with a small LZ77 codec,
+and are decompressed into memory when they're opened.
+
+Every loader goes through OpenAsset, which looks in the mounted packs first, and falls back
+to mapping the loose file, so the same code works with or without a pack.
+
+File layout:
+    AssetPackHeader
+    padding to ASSET_PACK_ALIGNMENT
+    each file's data, aligned to ASSET_PACK_ALIGNMENT
+    names of every file, one after another
+    AssetPackEntry [header.bucketCount], a hash table keyed by the file's name. Empty buckets have nameLength 0.
+
+Compressed files are:
+    uint32 block count
+    uint32 [block count], the stored size of each block, with ASSET_PACK_RAW_BLOCK set if it's stored as is
+    the blocks
+************/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "fileUtils.h"
+#include "hash.h"
+#include "dirent.h"
+#include "stb_image.h"
+
+#define ASSET_PACK_PATH "resources/assets.djpack"// Mounted at startup if it exists
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 4096
+#define ASSET_PACK_BLOCK_SIZE (64 * 1024)// Compressed files are cut into blocks this big
+#define ASSET_PACK_MIN_SAVING 0.9f// Files are only kept compressed if that makes them smaller than this fraction
+#define ASSET_PACK_RAW_BLOCK 0x80000000u
+
+#define ASSET_COMPRESSION_NONE 0
+#define ASSET_COMPRESSION_LZ 1
+
+using namespace std;
+
+struct AssetPackHeader
+{
+    char magic[4];// Always "DJPK"
+    uint32_t version;// ASSET_PACK_VERSION when the file was written
+    uint32_t entryCount;// How many files are in the pack
+    uint32_t bucketCount;// Size of the hash table, a power of two
+    uint64_t namesOffset;// Byte offset of the names from the start of the file
+    uint64_t tableOffset;// Byte offset of the hash table from the start of the file
+};
+
+struct AssetPackEntry
+{
+    uint64_t nameHash;// HashString of the normalized name
+    uint64_t offset;// Byte offset of the data from the start of the file
+    uint64_t storedSize;// Bytes in the pack
+    uint64_t size;// Bytes once decompressed
+    int64_t sourceMTime;// Modification time of the file it was made from
+    uint32_t nameOffset;// Into the names
+    uint32_t nameLength;
+    uint32_t compression;// ASSET_COMPRESSION_NONE or ASSET_COMPRESSION_LZ
+    uint32_t padding;
+};
+
+// A file to put in a pack
+struct AssetPackSource
+{
+    string name;// What the engine will ask for, like resources/models/Cube2/Cube.obj
+    string path;// Where to read it from now
+    bool compress;// Try compressing it. Worth it for text and uncompressed images, not for jpg or png.
+};
+
+/********************
+AssetData: The bytes of an opened asset.
+Either points into a pack's mapping, owns the decompressed bytes, or maps the loose file. Valid until it's closed or destroyed.
+*********************/
+class AssetData
+{
+public:
+    AssetData ()
+    {
+        data = NULL;
+        size = 0;
+    }
+
+    void Close ()
+    {
+        file.Close();
+        vector<char>().swap(buffer);
+        data = NULL;
+        size = 0;
+    }
+
+    bool IsOpen () const
+    {
+        return data != NULL;
+    }
+
+    const char * Data () const
+    {
+        return data;
+    }
+
+    size_t Size () const
+    {
+        return size;
+    }
+
+private:
+    const char *data;
+    size_t size;
+    vector<char> buffer;// Decompressed bytes, when the asset was compressed
+    MappedFile file;// The loose file, when it isn't in a pack
+
+    friend class AssetPack;
+    friend bool OpenAsset (string path, AssetData &asset);
+    friend bool OpenLooseAsset (string path, AssetData &asset);
+
+    AssetData (const AssetData &);
+    AssetData & operator= (const AssetData &);
+};
+
+string NormalizeAssetPath (string path);
+bool OpenAsset (string path, AssetData &asset);
+bool OpenLooseAsset (string path, AssetData &asset);
+bool AssetExists (string path);
+bool GetAssetInfo (string path, int64_t &mTime, uint64_t &size);
+bool WriteAssetPack (string packPath, const vector<AssetPackSource> &sources);
+void CollectAssetSources (string directory, vector<AssetPackSource> &sources);
+void CompressBlock (const unsigned char *input, size_t inputSize, vector<unsigned char> &output);
+bool DecompressBlock (const unsigned char *input, size_t inputSize, unsigned char *output, size_t outputSize);
+unsigned char * LoadImageAsset (string path, int *width, int *height, int *components, int requiredComponents);
+float * LoadHDRAsset (string path, int *width, int *height, int *components, int requiredComponents);
+bool ImageAssetInfo (string path, int *width, int *height, int *components);
+
+/********************
+AssetPack: One mounted pack file.
+*********************/
+class AssetPack
+{
+public:
+    AssetPack ()
+    {
+        header = NULL;
+        table = NULL;
+    }
+
+    // Map the pack at path. Returns false if it isn't there or is damaged.
+    bool Open (string path)
+    {
+        Close();
+        if (!file.Open(path)) return false;
+
+        if (file.Size() < sizeof(AssetPackHeader)) return fail();
+        header = (const AssetPackHeader *)file.Data();
+        if (memcmp(header->magic, "DJPK", 4) != 0 || header->version != ASSET_PACK_VERSION) return fail();
+        if (header->bucketCount == 0 || (header->bucketCount & (header->bucketCount - 1))) return fail();
+        if (header->tableOffset % 8 || header->tableOffset + (uint64_t)header->bucketCount * sizeof(AssetPackEntry) > file.Size()) return fail();
+        if (header->namesOffset > header->tableOffset) return fail();
+        table = (const AssetPackEntry *)(file.Data() + header->tableOffset);
+
+        // Check every entry is inside the file once, so lookups don't have to
+        for (uint32_t i = 0; i < header->bucketCount; i++)
+        {
+            const AssetPackEntry &entry = table[i];
+            if (entry.nameLength == 0) continue;
+            if (header->namesOffset + entry.nameOffset + entry.nameLength > header->tableOffset) return fail();
+            if (entry.offset % ASSET_PACK_ALIGNMENT || entry.offset + entry.storedSize > header->namesOffset) return fail();
+            if (entry.compression == ASSET_COMPRESSION_NONE && entry.storedSize != entry.size) return fail();
+            if (entry.compression > ASSET_COMPRESSION_LZ) return fail();
+        }
+        this->path = path;
+        return true;
+    }
+
+    void Close ()
+    {
+        file.Close();
+        header = NULL;
+        table = NULL;
+    }
+
+    // The entry for a normalized name, or NULL
+    const AssetPackEntry * Find (string name) const
+    {
+        if (!table) return NULL;
+        uint64_t hash = HashString(name);
+        uint32_t mask = header->bucketCount - 1;
+        for (uint32_t probe = 0, i = (uint32_t)hash & mask; probe < header->bucketCount; probe++, i = (i + 1) & mask)
+        {
+            const AssetPackEntry &entry = table[i];
+            if (entry.nameLength == 0) return NULL;
+            if (entry.nameHash == hash && entry.nameLength == name.size() && memcmp(names() + entry.nameOffset, name.c_str(), name.size()) == 0) return &entry;
+        }
+        return NULL;
+    }
+
+    // Open an entry of this pack. Stored entries point straight into the mapping.
+    bool Read (const AssetPackEntry *entry, AssetData &asset) const
+    {
+        asset.Close();
+        const char *stored = file.Data() + entry->offset;
+        if (entry->compression == ASSET_COMPRESSION_NONE)
+        {
+            asset.data = stored;
+            asset.size = entry->size;
+            return true;
+        }
+
+        // Read the block table, then decompress the blocks one after another
+        const unsigned char *read = (const unsigned char *)stored;
+        const unsigned char *end = read + entry->storedSize;
+        uint32_t blockCount;
+        if (entry->storedSize < sizeof(blockCount)) return corrupt(entry);
+        memcpy(&blockCount, read, sizeof(blockCount));
+        read += sizeof(blockCount);
+        if (blockCount != (entry->size + ASSET_PACK_BLOCK_SIZE - 1) / ASSET_PACK_BLOCK_SIZE || (uint64_t)(end - read) < (uint64_t)blockCount * sizeof(uint32_t)) return corrupt(entry);
+        const unsigned char *blockSizes = read;
+        read += blockCount * sizeof(uint32_t);
+
+        asset.buffer.resize(entry->size);
+        for (uint32_t i = 0; i < blockCount; i++)
+        {
+            uint32_t storedBlock;
+            memcpy(&storedBlock, blockSizes + i * sizeof(uint32_t), sizeof(storedBlock));
+            bool raw = (storedBlock & ASSET_PACK_RAW_BLOCK) != 0;
+            storedBlock &= ~ASSET_PACK_RAW_BLOCK;
+            size_t blockSize = min((size_t)ASSET_PACK_BLOCK_SIZE, (size_t)(entry->size - (uint64_t)i * ASSET_PACK_BLOCK_SIZE));
+            unsigned char *destination = (unsigned char *)&asset.buffer[(size_t)i * ASSET_PACK_BLOCK_SIZE];
+            if ((size_t)(end - read) < storedBlock) return corrupt(entry);
+
+            if (raw)
+            {
+                if (storedBlock != blockSize) return corrupt(entry);
+                memcpy(destination, read, blockSize);
+            }
+            else if (!DecompressBlock(read, storedBlock, destination, blockSize))
+            {
+                return corrupt(entry);
+            }
+            read += storedBlock;
+        }
+        asset.data = asset.buffer.empty() ? stored : &asset.buffer[0];
+        asset.size = entry->size;
+        return true;
+    }
+
+    // The names of the files directly inside directory, without the directory
+    vector<string> List (string directory) const
+    {
+        vector<string> files;
+        if (!table) return files;
+        string prefix = NormalizeAssetPath(directory) + '/';
+        for (uint32_t i = 0; i < header->bucketCount; i++)
+        {
+            if (table[i].nameLength <= prefix.size()) continue;
+            string name (names() + table[i].nameOffset, table[i].nameLength);
+            if (name.compare(0, prefix.size(), prefix) == 0 && name.find('/', prefix.size()) == string::npos) files.push_back(name.substr(prefix.size()));
+        }
+        return files;
+    }
+
+    uint32_t EntryCount () const
+    {
+        return header ? header->entryCount : 0;
+    }
+
+    string GetPath () const
+    {
+        return path;
+    }
+
+private:
+    MappedFile file;
+    const AssetPackHeader *header;
+    const AssetPackEntry *table;
+    string path;
+
+    const char * names () const
+    {
+        return file.Data() + header->namesOffset;
+    }
+
+    bool fail ()
+    {
+        Close();
+        return false;
+    }
+
+    bool corrupt (const AssetPackEntry *entry) const
+    {
+        cout << "ERROR::ASSETPACK:: " << string(names() + entry->nameOffset, entry->nameLength) << " is damaged in " << path << endl;
+        return false;
+    }
+
+    // A mapping can't be shared between two owners
+    AssetPack (const AssetPack &);
+    AssetPack & operator= (const AssetPack &);
+};
+
+/********************
+AssetPacks: Every mounted pack. Packs mounted later are searched first.
+Mount packs before anything starts loading, after that it's only read and safe from any thread.
+*********************/
+class AssetPacks
+{
+public:
+    ~AssetPacks ()
+    {
+        for (unsigned int i = 0; i < packs.size(); i++) delete packs[i];
+    }
+
+    // Mount the pack at path. Returns false if it isn't there or is damaged.
+    bool Mount (string path)
+    {
+        AssetPack *pack = new AssetPack;
+        if (!pack->Open(path))
+        {
+            delete pack;
+            return false;
+        }
+        packs.push_back(pack);
+        cout << "Mounted " << path << " (" << pack->EntryCount() << " files)" << endl;
+        return true;
+    }
+
+    // Find the entry for path in the most recently mounted pack that has it
+    bool Find (string path, const AssetPack *&pack, const AssetPackEntry *&entry)
+    {
+        if (packs.empty()) return false;
+        string name = NormalizeAssetPath(path);
+        for (int i = (int)packs.size() - 1; i >= 0; i--)
+        {
+            entry = packs[i]->Find(name);
+            if (entry)
+            {
+                pack = packs[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The names of the files directly inside directory in every pack
+    vector<string> List (string directory)
+    {
+        vector<string> files;
+        for (unsigned int i = 0; i < packs.size(); i++)
+        {
+            vector<string> found = packs[i]->List(directory);
+            files.insert(files.end(), found.begin(), found.end());
+        }
+        return files;
+    }
+
+    bool IsEmpty ()
+    {
+        return packs.empty();
+    }
+
+private:
+    vector<AssetPack *> packs;
+};
+
+// Every pack the engine has mounted
+AssetPacks & Packs ()
+{
+    static AssetPacks packs;
+    return packs;
+}
+
+// Turn a path into the form pack names are stored in: forward slashes, no ./ parts, no doubled slashes
+string NormalizeAssetPath (string path)
+{
+    string normalized;
+    normalized.reserve(path.size());
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        char c = path[i] == '\\' ? '/' : path[i];
+        bool partStart = normalized.empty() || normalized[normalized.size() - 1] == '/';
+        if (c == '/' && !normalized.empty() && partStart) continue;
+        if (c == '.' && partStart && (i + 1 == path.size() || path[i + 1] == '/' || path[i + 1] == '\\'))
+        {
+            i++;
+            continue;
+        }
+        normalized += c;
+    }
+    if (normalized.size() > 1 && normalized[normalized.size() - 1] == '/') normalized.erase(normalized.size() - 1);
+    return normalized;
+}
+
+// Open path from a mounted pack, or map the loose file if no pack has it
+bool OpenAsset (string path, AssetData &asset)
+{
+    const AssetPack *pack;
+    const AssetPackEntry *entry;
+    if (Packs().Find(path, pack, entry)) return pack->Read(entry, asset);
+    return OpenLooseAsset(path, asset);
+}
+
+// Like OpenAsset, but only the file on disk, even if a mounted pack has one by the same name
+bool OpenLooseAsset (string path, AssetData &asset)
+{
+    asset.Close();
+    if (!asset.file.Open(path)) return false;
+    asset.data = asset.file.Data();
+    asset.size = asset.file.Size();
+    return true;
+}
+
+// Whether path is in a mounted pack or on disk
+bool AssetExists (string path)
+{
+    int64_t mTime;
+    uint64_t size;
+    return GetAssetInfo(path, mTime, size);
+}
+
+// Modification time and size of path, from a pack if one has it. Packs keep the times of the files they were made from.
+bool GetAssetInfo (string path, int64_t &mTime, uint64_t &size)
+{
+    const AssetPack *pack;
+    const AssetPackEntry *entry;
+    if (Packs().Find(path, pack, entry))
+    {
+        mTime = entry->sourceMTime;
+        size = entry->size;
+        return true;
+    }
+    return GetFileInfo(path, mTime, size);
+}
+
+// Write sources out as one pack at packPath
+bool WriteAssetPack (string packPath, const vector<AssetPackSource> &sources)
+{
+    // The table is at most half full so probes stay short
+    uint32_t bucketCount = 16;
+    while (bucketCount < sources.size() * 2) bucketCount *= 2;
+    vector<AssetPackEntry> table (bucketCount);
+    memset(&table[0], 0, table.size() * sizeof(AssetPackEntry));
+    string names;
+
+    string tempPath = packPath + ".tmp";
+    ofstream fout (tempPath.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if (!fout.is_open())
+    {
+        cout << "ERROR::ASSETPACK:: Could not write " << tempPath << endl;
+        return false;
+    }
+
+    // The header is written again at the end, once the offsets are known
+    AssetPackHeader header;
+    memset(&header, 0, sizeof(header));
+    const vector<char> padding (ASSET_PACK_ALIGNMENT, 0);
+    fout.write(padding.data(), ASSET_PACK_ALIGNMENT);
+
+    uint64_t storedTotal = 0, sizeTotal = 0;
+    for (unsigned int i = 0; i < sources.size(); i++)
+    {
+        AssetPackEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        string name = NormalizeAssetPath(sources[i].name);
+        uint64_t fileSize;
+        MappedFile source;
+        if (!GetFileInfo(sources[i].path, entry.sourceMTime, fileSize) || (fileSize && !source.Open(sources[i].path)))
+        {
+            cout << "ERROR::ASSETPACK:: Could not read " << sources[i].path << endl;
+            continue;
+        }
+
+        // Find the name a free bucket, skipping files that are already in
+        uint32_t bucket = (uint32_t)HashString(name) & (bucketCount - 1);
+        bool duplicate = false;
+        while (table[bucket].nameLength != 0)
+        {
+            if (table[bucket].nameHash == HashString(name) && names.compare(table[bucket].nameOffset, table[bucket].nameLength, name) == 0) duplicate = true;
+            bucket = (bucket + 1) & (bucketCount - 1);
+        }
+        if (duplicate || name.empty()) continue;
+
+        // Compress block by block, and keep the result only if it saved enough
+        const unsigned char *data = (const unsigned char *)source.Data();
+        string compressed;
+        if (sources[i].compress && fileSize)
+        {
+            uint32_t blockCount = (fileSize + ASSET_PACK_BLOCK_SIZE - 1) / ASSET_PACK_BLOCK_SIZE;
+            vector<uint32_t> blockSizes (blockCount);
+            string blocks;
+            vector<unsigned char> block;
+            for (uint32_t j = 0; j < blockCount; j++)
+            {
+                size_t blockSize = min((uint64_t)ASSET_PACK_BLOCK_SIZE, fileSize - (uint64_t)j * ASSET_PACK_BLOCK_SIZE);
+                const unsigned char *blockData = data + (size_t)j * ASSET_PACK_BLOCK_SIZE;
+                CompressBlock(blockData, blockSize, block);
+                if (block.size() < blockSize)
+                {
+                    blockSizes[j] = block.size();
+                    blocks.append((const char *)&block[0], block.size());
+                }
+                else
+                {
+                    blockSizes[j] = blockSize | ASSET_PACK_RAW_BLOCK;
+                    blocks.append((const char *)blockData, blockSize);
+                }
+            }
+            compressed.append((const char *)&blockCount, sizeof(blockCount));
+            compressed.append((const char *)&blockSizes[0], blockSizes.size() * sizeof(uint32_t));
+            compressed.append(blocks);
+        }
+
+        entry.nameHash = HashString(name);
+        entry.nameOffset = names.size();
+        entry.nameLength = name.size();
+        entry.size = fileSize;
+        entry.offset = (uint64_t)fout.tellp();
+        if (!compressed.empty() && compressed.size() < fileSize * ASSET_PACK_MIN_SAVING)
+        {
+            entry.compression = ASSET_COMPRESSION_LZ;
+            entry.storedSize = compressed.size();
+            fout.write(compressed.data(), compressed.size());
+        }
+        else
+        {
+            entry.compression = ASSET_COMPRESSION_NONE;
+            entry.storedSize = fileSize;
+            if (fileSize) fout.write(source.Data(), fileSize);
+        }
+        fout.write(padding.data(), (ASSET_PACK_ALIGNMENT - entry.storedSize % ASSET_PACK_ALIGNMENT) % ASSET_PACK_ALIGNMENT);
+
+        names += name;
+        table[bucket] = entry;
+        header.entryCount++;
+        storedTotal += entry.storedSize;
+        sizeTotal += entry.size;
+    }
+
+    // Names, then the table on an 8 byte boundary after them
+    header.namesOffset = (uint64_t)fout.tellp();
+    fout.write(names.data(), names.size());
+    fout.write(padding.data(), (8 - names.size() % 8) % 8);
+    header.tableOffset = (uint64_t)fout.tellp();
+    fout.write((const char *)&table[0], table.size() * sizeof(AssetPackEntry));
+
+    memcpy(header.magic, "DJPK", 4);
+    header.version = ASSET_PACK_VERSION;
+    header.bucketCount = bucketCount;
+    fout.seekp(0);
+    fout.write((const char *)&header, sizeof(header));
+
+    bool written = fout.good();
+    fout.close();
+    remove(packPath.c_str());// rename won't replace an existing file on Windows
+    if (!written || rename(tempPath.c_str(), packPath.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        cout << "ERROR::ASSETPACK:: Could not write " << packPath << endl;
+        return false;
+    }
+    cout << "Wrote " << packPath << ": " << header.entryCount << " files, " << sizeTotal / 1024 << " KB stored in " << storedTotal / 1024 << " KB" << endl;
+    return true;
+}
+
+// Add every file under directory to sources, named by its path. Images that are already compressed
+// and cooked meshes (which are meant to be mapped as they are) are stored, the rest compressed.
+void CollectAssetSources (string directory, vector<AssetPackSource> &sources)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) return;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        string file = ent->d_name;
+        if (file == "." || file == "..") continue;
+        string path = directory + "/" + file;
+        if (ent->d_type == DT_DIR)
+        {
+            CollectAssetSources(path, sources);
+            continue;
+        }
+        if (file.size() > 4 && file.compare(file.size() - 4, 4, ".tmp") == 0) continue;
+
+        string extension = file.find('.') == string::npos ? "" : file.substr(file.find_last_of('.'));
+        for (unsigned int i = 0; i < extension.size(); i++) extension[i] = tolower(extension[i]);
+        AssetPackSource source;
+        source.name = path;
+        source.path = path;
+        source.compress = extension != ".jpg" && extension != ".jpeg" && extension != ".png" && extension != ".djmesh";
+        sources.push_back(source);
+    }
+    closedir(dir);
+}
+
+// LZ77 in the style of LZ4: each sequence is a token byte (literal count in the high 4 bits, match length - 4 in the low 4),
+// extra length bytes when a count is 15 or more, the literals, then a 2 byte offset back to the match.
+// The last sequence is only literals.
+void CompressBlock (const unsigned char *input, size_t inputSize, vector<unsigned char> &output)
+{
+    const int hashBits = 14;
+    vector<int> positions (1 << hashBits, -1);// Last place each hash of 4 bytes was seen
+    output.clear();
+    output.reserve(inputSize + inputSize / 255 + 16);
+
+    size_t anchor = 0;// Start of the literals not written yet
+    size_t i = 0;
+    while (i + 4 <= inputSize)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, input + i, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+        int candidate = positions[hash];
+        positions[hash] = (int)i;
+        if (candidate < 0 || i - candidate > 0xFFFF || memcmp(input + candidate, input + i, 4) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        size_t matchLength = 4;
+        while (i + matchLength < inputSize && input[candidate + matchLength] == input[i + matchLength]) matchLength++;
+
+        // Token and literals
+        size_t literals = i - anchor;
+        size_t extra = matchLength - 4;
+        output.push_back((unsigned char)((min(literals, (size_t)15) << 4) | min(extra, (size_t)15)));
+        if (literals >= 15)
+        {
+            size_t rest = literals - 15;
+            for (; rest >= 255; rest -= 255) output.push_back(255);
+            output.push_back((unsigned char)rest);
+        }
+        output.insert(output.end(), input + anchor, input + i);
+
+        // Offset and the rest of the match length
+        uint16_t offset = (uint16_t)(i - candidate);
+        output.push_back(offset & 0xFF);
+        output.push_back(offset >> 8);
+        if (extra >= 15)
+        {
+            size_t rest = extra - 15;
+            for (; rest >= 255; rest -= 255) output.push_back(255);
+            output.push_back((unsigned char)rest);
+        }
+
+        i += matchLength;
+        anchor = i;
+    }
+
+    // The remaining bytes as one last literal run
+    size_t literals = inputSize - anchor;
+    output.push_back((unsigned char)(min(literals, (size_t)15) << 4));
+    if (literals >= 15)
+    {
+        size_t rest = literals - 15;
+        for (; rest >= 255; rest -= 255) output.push_back(255);
+        output.push_back((unsigned char)rest);
+    }
+    output.insert(output.end(), input + anchor, input + inputSize);
+}
+
+// Undo CompressBlock. Returns false unless the block decodes to exactly outputSize bytes without reading or writing out of bounds.
+bool DecompressBlock (const unsigned char *input, size_t inputSize, unsigned char *output, size_t outputSize)
+{
+    const unsigned char *read = input, *end = input + inputSize;
+    size_t written = 0;
+    while (read < end)
+    {
+        unsigned char token = *read++;
+
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            unsigned char more;
+            do
+            {
+                if (read >= end) return false;
+                more = *read++;
+                literals += more;
+            } while (more == 255);
+        }
+        if ((size_t)(end - read) < literals || outputSize - written < literals) return false;
+        memcpy(output + written, read, literals);
+        read += literals;
+        written += literals;
+        if (read == end) break;// The last sequence has no match
+
+        if (end - read < 2) return false;
+        size_t offset = read[0] | (read[1] << 8);
+        read += 2;
+        size_t matchLength = (token & 0xF) + 4;
+        if ((token & 0xF) == 15)
+        {
+            unsigned char more;
+            do
+            {
+                if (read >= end) return false;
+                more = *read++;
+                matchLength += more;
+            } while (more == 255);
+        }
+        if (offset == 0 || offset > written || outputSize - written < matchLength) return false;
+
+        // Byte by byte, since the match can overlap what it's writing
+        const unsigned char *match = output + written - offset;
+        for (size_t j = 0; j < matchLength; j++) output[written + j] = match[j];
+        written += matchLength;
+    }
+    return written == outputSize;
+}
+
+// stbi_load for an asset that might be in a pack
+unsigned char * LoadImageAsset (string path, int *width, int *height, int *components, int requiredComponents)
+{
+    AssetData asset;
+    if (!OpenAsset(path, asset)) return NULL;
+    return stbi_load_from_memory((const stbi_uc *)asset.Data(), (int)asset.Size(), width, height, components, requiredComponents);
+}
+
+// stbi_loadf for an asset that might be in a pack
+float * LoadHDRAsset (string path, int *width, int *height, int *components, int requiredComponents)
+{
+    AssetData asset;
+    if (!OpenAsset(path, asset)) return NULL;
+    return stbi_loadf_from_memory((const stbi_uc *)asset.Data(), (int)asset.Size(), width, height, components, requiredComponents);
+}
+
+// stbi_info for an asset that might be in a pack
+bool ImageAssetInfo (string path, int *width, int *height, int *components)
+{
+    AssetData asset;
+    if (!OpenAsset(path, asset)) return false;
+    return stbi_info_from_memory((const stbi_uc *)asset.Data(), (int)asset.Size(), width, height, components) != 0;
+}
+
+#endif // ASSETPACK_H_INCLUDED
@@ -0,0 +1,507 @@
+#ifndef ASYNCTEXTURE_H_INCLUDED
+#define ASYNCTEXTURE_H_INCLUDED
+
+/***********
+This header streams textures in without stalling the render thread.
+
+Loading a texture used to mean stbi_load, glTexImage2D and glGenerateMipmap back to back on
+the GL thread, which for a scene full of 4K maps is a stall of several seconds. Now Load hands
+back a texture straight away that samples as a single placeholder texel, and the real pixels
+follow a few frames later:
+
+1) A worker reads the image's size from its header.
+2) The GL thread gives it a pixel unpack buffer (PBO) big enough for the decoded image.
+   With ARB_buffer_storage the PBOs stay persistently mapped and get reused. Without it the
+   PBO is mapped for the worker and unmapped once the worker is done.
+3) The worker decodes the image and writes the RGBA pixels straight into the mapped PBO.
+4) Every frame, Update copies rows from the PBOs into the textures, up to a byte budget, so a
+   big texture is spread over several frames instead of blocking one.
+5) Once every row is in, the mipmaps are generated and the placeholder stops being used.
+
+The placeholder is the texture's smallest mip level. GL_TEXTURE_BASE_LEVEL points at it until
+level 0 is complete, so the texture ID the materials hold never changes.
+
+Block compressed textures cooked by djcook skip the decode: the worker copies their whole mip
+chain into the PBO, and Update uploads it a level at a time with glCompressedTexImage2D.
+************/
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <glew.h>
+#include "stb_image.h"
+#include "threadPool.h"
+#include "textureRegistry.h"
+#include "textureCache.h"
+
+#define TEXTURE_UPLOAD_BUDGET (8 * 1024 * 1024)// Bytes of texels copied into textures per frame
+#define MAX_STAGING_BYTES (256 * 1024 * 1024)// Total size of the PBOs decodes can be in flight in
+#define STAGING_GRANULARITY (1024 * 1024)// PBO sizes are rounded up to this so they can be reused
+
+using namespace std;
+
+struct PlaceholderColour
+{
+    unsigned char rgba[4];
+};
+
+PlaceholderColour PlaceholderForType (string type);
+
+class AsyncTextureLoader
+{
+public:
+    AsyncTextureLoader ()
+    {
+        enabled = true;
+        stagingBytes = 0;
+        persistent = false;
+        checkedExtensions = false;
+        Textures().AddReleaseCallback([this] (GLuint id) { this->cancel(id); });
+    }
+
+    // Whether model textures should be streamed. If not, they're decoded and uploaded all at once.
+    bool IsEnabled ()
+    {
+        return enabled;
+    }
+
+    void SetEnabled (bool enabled)
+    {
+        this->enabled = enabled;
+    }
+
+    // Start streaming the image at path into a new texture, and return it. Must be called on the GL thread.
+    // The texture samples as placeholder until the image is in.
+    GLuint Load (string path, TextureParams params, PlaceholderColour placeholder)
+    {
+        if (!checkedExtensions)
+        {
+            persistent = GLEW_ARB_buffer_storage;
+            checkedExtensions = true;
+        }
+
+        Request *request = new Request;
+        request->path = path;
+        request->params = params;
+        request->placeholder = placeholder;
+        request->state = READING_HEADER;
+        request->cancelled = false;
+        request->staging = -1;
+        request->nextRow = 0;
+        request->nextLevel = 0;
+        request->format = TEXTURE_FORMAT_RGBA8;
+
+        // The placeholder is a complete 1x1 texture on its own until the real size is known
+        glGenTextures(1, &request->texture);
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, params.internalFormat, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.rgba);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, params.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, params.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, params.magFilter);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        requests.push_back(request);
+        WorkerPool().Submit([request]
+        {
+            int components;
+            if (!TextureAssetInfo(request->path, &request->width, &request->height, &components))
+            {
+                cout << "Failed to read texture " << request->path << endl;
+                request->state = FAILED;
+                return;
+            }
+            request->format = CompressedTextureFormat(request->path);
+            request->state = SIZED;
+        });
+        return request->texture;
+    }
+
+    // Move streaming along: hand out PBOs, and copy up to budget bytes of decoded pixels into textures. Call once a frame.
+    void Update (size_t budget = TEXTURE_UPLOAD_BUDGET)
+    {
+        GLint previousAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &previousAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);// RGBA rows are always 4 byte aligned
+
+        for (unsigned int i = 0; i < requests.size(); i++)
+        {
+            Request *request = requests[i];
+            int state = request->state;
+
+            // Workers own the request in these states, so leave it be even if it's been cancelled
+            if (state == READING_HEADER || state == DECODING) continue;
+
+            if (request->cancelled || state == FAILED)
+            {
+                // Whoever has the texture keeps the placeholder, but the next model to ask for it tries loading it again
+                if (!request->cancelled) Textures().Forget(request->texture);
+                finish(i--);
+                continue;
+            }
+
+            if (state == SIZED)
+            {
+                startDecode(request);
+            }
+            else if (state == DECODED || state == UPLOADING)
+            {
+                if (budget == 0) continue;
+                if (state == DECODED) allocateLevels(request);
+                if (request->format == TEXTURE_FORMAT_RGBA8) budget = uploadRows(request, budget);
+                else budget = uploadLevels(request, budget);
+                if (request->nextRow >= request->height || request->nextLevel >= request->levels)
+                {
+                    completeTexture(request);
+                    finish(i--);
+                }
+            }
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, previousAlignment);
+        recycleStaging();
+    }
+
+    // How many textures are still streaming
+    unsigned int PendingCount ()
+    {
+        return requests.size();
+    }
+
+    // Whether texture is still streaming in
+    bool IsStreaming (GLuint texture)
+    {
+        for (unsigned int i = 0; i < requests.size(); i++)
+        {
+            if (requests[i]->texture == texture) return true;
+        }
+        return false;
+    }
+
+private:
+    enum RequestState
+    {
+        READING_HEADER,// Worker is reading the size of the image
+        SIZED,// Waiting for a PBO
+        DECODING,// Worker is decoding (or copying the compressed levels) into the PBO
+        DECODED,// Pixels are in the PBO, waiting for the first upload
+        UPLOADING,// Some rows or levels have been copied into the texture
+        FAILED
+    };
+
+    struct Request
+    {
+        string path;
+        TextureParams params;
+        PlaceholderColour placeholder;
+        GLuint texture;
+        int width;
+        int height;
+        int levels;// Number of mip levels, the last of which holds the placeholder
+        TextureFormat format;// What's in the PBO: RGBA pixels, or a cooked block compressed mip chain
+        atomic<int> state;
+        bool cancelled;// The texture was released before it finished streaming
+        int staging;// Index of the PBO holding the pixels, or -1
+        int nextRow;// First row of level 0 that hasn't been uploaded yet
+        int nextLevel;// First level that hasn't been uploaded yet, for compressed textures
+    };
+
+    struct StagingBuffer
+    {
+        GLuint pbo;
+        size_t capacity;
+        unsigned char *mapped;// Where the worker writes. Stays valid between uses if the buffer is persistent.
+        bool inUse;
+        GLsync fence;// Signalled once the GPU is done reading the last upload from this buffer
+    };
+
+    bool enabled;
+    bool persistent;// Whether ARB_buffer_storage persistent mapping is available
+    bool checkedExtensions;
+    size_t stagingBytes;// Total capacity of every PBO
+    vector<Request *> requests;
+    vector<StagingBuffer> staging;
+
+    // Find or make a free PBO for the request and start the worker decoding into it
+    void startDecode (Request *request)
+    {
+        request->levels = MipLevelCount(request->width, request->height);
+        size_t size = TextureChainSize(request->format, request->width, request->height, request->format == TEXTURE_FORMAT_RGBA8 ? 1 : request->levels);
+        int index = acquireStaging(size);
+        if (index < 0) return;// Too much in flight, try again next frame
+
+        StagingBuffer &buffer = staging[index];
+        if (!persistent)
+        {
+            // Orphan the old storage so mapping never waits on the GPU
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer.capacity, NULL, GL_STREAM_DRAW);
+            buffer.mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (!buffer.mapped)
+            {
+                buffer.inUse = false;
+                request->state = FAILED;
+                return;
+            }
+        }
+
+        request->staging = index;
+        request->state = DECODING;
+        unsigned char *destination = buffer.mapped;
+        WorkerPool().Submit([request, destination]
+        {
+            if (request->format != TEXTURE_FORMAT_RGBA8)
+            {
+                bool copied = LoadCompressedTextureAsset(request->path, request->format, request->width, request->height, destination);
+                if (!copied) cout << "Failed to read texture " << request->path << endl;
+                request->state = copied ? DECODED : FAILED;
+                return;
+            }
+
+            int width, height, components;
+            unsigned char *pixels = LoadTextureAsset(request->path, &width, &height, &components, STBI_rgb_alpha);
+            if (!pixels || width != request->width || height != request->height)
+            {
+                cout << "Failed to decode texture " << request->path << endl;
+                if (pixels) stbi_image_free(pixels);
+                request->state = FAILED;
+                return;
+            }
+            memcpy(destination, pixels, (size_t)width * height * 4);
+            stbi_image_free(pixels);
+            request->state = DECODED;
+        });
+    }
+
+    // Give the texture its full mip chain, with the placeholder in the last level and the only level sampled for now.
+    // Compressed levels are each given storage as they're uploaded.
+    void allocateLevels (Request *request)
+    {
+        if (!persistent)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging[request->staging].pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            staging[request->staging].mapped = NULL;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        int last = request->levels - 1;
+        for (int level = 0; level < last && request->format == TEXTURE_FORMAT_RGBA8; level++)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, request->params.internalFormat, max(1, request->width >> level), max(1, request->height >> level), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexImage2D(GL_TEXTURE_2D, last, request->params.internalFormat, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, request->placeholder.rgba);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, last);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, last);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        Textures().SetSize(request->texture, request->width, request->height, 4, StoredTextureFormat(request->format, request->params.internalFormat));
+        request->state = UPLOADING;
+    }
+
+    // Copy as many whole rows as fit in the budget from the PBO into level 0. Returns the budget left.
+    size_t uploadRows (Request *request, size_t budget)
+    {
+        size_t rowBytes = (size_t)request->width * 4;
+        int rows = min((size_t)(request->height - request->nextRow), max((size_t)1, budget / rowBytes));
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging[request->staging].pbo);
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, request->nextRow, request->width, rows, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid *)(request->nextRow * rowBytes));
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        request->nextRow += rows;
+        size_t used = rows * rowBytes;
+        return used >= budget ? 0 : budget - used;
+    }
+
+    // Upload whole compressed levels from the PBO, largest first, until the budget's spent. Always uploads at least one.
+    // The last level replaces the placeholder, which is fine since it's the average of the whole texture.
+    size_t uploadLevels (Request *request, size_t budget)
+    {
+        GLint internalFormat = StoredTextureFormat(request->format, request->params.internalFormat);
+        size_t offset = TextureChainSize(request->format, request->width, request->height, request->nextLevel);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging[request->staging].pbo);
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        size_t used = 0;
+        while (request->nextLevel < request->levels && (used == 0 || used < budget))
+        {
+            int width = max(1, request->width >> request->nextLevel), height = max(1, request->height >> request->nextLevel);
+            size_t size = TextureLevelSize(request->format, width, height);
+            glCompressedTexImage2D(GL_TEXTURE_2D, request->nextLevel, internalFormat, width, height, 0, size, (GLvoid *)offset);
+            offset += size;
+            used += size;
+            request->nextLevel++;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return used >= budget ? 0 : budget - used;
+    }
+
+    // Level 0 is in, so build the rest of the chain from it (compressed textures come with theirs) and sample the real texture from now on
+    void completeTexture (Request *request)
+    {
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        if (request->params.mipmaps)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, request->levels - 1);
+            if (request->format == TEXTURE_FORMAT_RGBA8) glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        else
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Remove request i, giving its PBO back once the GPU is done with it
+    void finish (int i)
+    {
+        Request *request = requests[i];
+        if (request->staging >= 0)
+        {
+            StagingBuffer &buffer = staging[request->staging];
+            if (!persistent && buffer.mapped)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                buffer.mapped = NULL;
+            }
+            if (buffer.fence) glDeleteSync(buffer.fence);
+            buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        delete request;
+        requests.erase(requests.begin() + i);
+    }
+
+    // The registry is deleting a texture, so stop streaming into it
+    void cancel (GLuint texture)
+    {
+        for (unsigned int i = 0; i < requests.size(); i++)
+        {
+            if (requests[i]->texture == texture) requests[i]->cancelled = true;
+        }
+    }
+
+    // Find a free PBO that's big enough, or make one if there's room. Returns -1 if neither.
+    int acquireStaging (size_t size)
+    {
+        size_t capacity = (size + STAGING_GRANULARITY - 1) / STAGING_GRANULARITY * STAGING_GRANULARITY;
+        int best = -1;
+        for (unsigned int i = 0; i < staging.size(); i++)
+        {
+            if (staging[i].inUse || staging[i].fence || staging[i].capacity < capacity) continue;
+            if (best < 0 || staging[i].capacity < staging[best].capacity) best = i;
+        }
+        if (best >= 0)
+        {
+            staging[best].inUse = true;
+            return best;
+        }
+
+        // Always let one through, even if it's bigger than the limit on its own
+        bool anyInUse = false;
+        for (unsigned int i = 0; i < staging.size(); i++) anyInUse = anyInUse || staging[i].inUse;
+        if (stagingBytes + capacity > MAX_STAGING_BYTES && anyInUse) return -1;
+
+        // Out of room but nothing in use, so drop the idle PBOs that are too small
+        if (stagingBytes + capacity > MAX_STAGING_BYTES) freeIdleStaging();
+
+        StagingBuffer buffer;
+        buffer.capacity = capacity;
+        buffer.inUse = true;
+        buffer.fence = 0;
+        buffer.mapped = NULL;
+        glGenBuffers(1, &buffer.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, NULL, flags);
+            buffer.mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags);
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        stagingBytes += capacity;
+        staging.push_back(buffer);
+        return staging.size() - 1;
+    }
+
+    // Free up PBOs whose last upload the GPU has finished with
+    void recycleStaging ()
+    {
+        for (unsigned int i = 0; i < staging.size(); i++)
+        {
+            StagingBuffer &buffer = staging[i];
+            if (!buffer.fence) continue;
+            if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+            glDeleteSync(buffer.fence);
+            buffer.fence = 0;
+            buffer.inUse = false;
+        }
+    }
+
+    // Delete every idle PBO. Only called when nothing is in flight, so no request refers to them by index.
+    void freeIdleStaging ()
+    {
+        for (unsigned int i = 0; i < staging.size(); i++)
+        {
+            if (staging[i].inUse || staging[i].fence) continue;
+            if (persistent)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging[i].pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glDeleteBuffers(1, &staging[i].pbo);
+            stagingBytes -= staging[i].capacity;
+            staging.erase(staging.begin() + i--);
+        }
+    }
+};
+
+// A colour that reads as "nothing special" for each kind of map while the real one streams in
+PlaceholderColour PlaceholderForType (string type)
+{
+    PlaceholderColour colour = { { 128, 128, 128, 255 } };
+    if (type == "texture_normal")
+    {
+        colour.rgba[2] = 255;// Straight up in tangent space
+    }
+    else if (type == "texture_AO")
+    {
+        colour.rgba[0] = colour.rgba[1] = colour.rgba[2] = 255;// Unoccluded
+    }
+    else if (type == "texture_metallic")
+    {
+        colour.rgba[0] = colour.rgba[1] = colour.rgba[2] = 0;// Dielectric
+    }
+    else if (type == "texture_ORM")
+    {
+        for (int c = 0; c < PACKED_CHANNEL_COUNT; c++) colour.rgba[c] = PackedChannelDefault(c);
+    }
+    return colour;
+}
+
+// The loader shared by the whole engine. Only use it from the GL thread.
+AsyncTextureLoader & AsyncTextures ()
+{
+    static AsyncTextureLoader loader;
+    return loader;
+}
+
+#endif // ASYNCTEXTURE_H_INCLUDED
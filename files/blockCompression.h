@@ -0,0 +1,534 @@
+#ifndef BLOCKCOMPRESSION_H_INCLUDED
+#define BLOCKCOMPRESSION_H_INCLUDED
+
+/***********
+This header compresses textures into the block formats GPUs sample directly, for the cooker.
+
+Every format cuts the image into 4x4 blocks and stores each block as two endpoint colours and
+a small index per texel saying where between them it lies:
+
+    BC1  8 bytes a block: two RGB565 endpoints and 2 bit indices. Colour with no alpha, 8x smaller than RGBA8.
+    BC4  8 bytes a block: two 8 bit endpoints and 3 bit indices. One channel, 4x smaller than RGBA8.
+    BC5  16 bytes a block: a BC4 block for red and another for green. Tangent space normals.
+    BC7  16 bytes a block, 4x smaller than RGBA8. Only mode 6 is used here: RGBA endpoints of
+         7 bits plus a shared low bit, and 4 bit indices. Colour at close to the source quality.
+
+Endpoints are found along the principal axis of the block's colours, and each texel then takes
+the nearest of the colours between them. The nearest-colour search is SSE2: BC4 compares all
+16 texels at once as bytes, BC1 and BC7 four texels at a time as floats.
+
+Blocks don't depend on each other, so EncodeBlockRows only encodes a band of block rows.
+The cooker hands the bands of every level to the worker pool.
+************/
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <emmintrin.h>
+
+using namespace std;
+
+// What a cooked texture's texels are stored as. Part of the cooked file format, so only ever add to the end.
+enum TextureFormat
+{
+    TEXTURE_FORMAT_RGBA8,
+    TEXTURE_FORMAT_BC1,
+    TEXTURE_FORMAT_BC4,
+    TEXTURE_FORMAT_BC5,
+    TEXTURE_FORMAT_BC7,
+    TEXTURE_FORMAT_COUNT
+};
+
+int BlockBytes (TextureFormat format);
+size_t TextureLevelSize (TextureFormat format, int width, int height);
+size_t TextureChainSize (TextureFormat format, int width, int height, int levelCount);
+int MipLevelCount (int width, int height);
+void DownsampleImage (const unsigned char *rgba, int width, int height, bool srgb, unsigned char *output);
+void EncodeBlockRows (TextureFormat format, const unsigned char *rgba, int width, int height, int firstRow, int rowCount, unsigned char *blocks);
+void LoadBlock (const unsigned char *rgba, int width, int height, int x, int y, unsigned char block[64]);
+void EncodeBC1 (const unsigned char block[64], unsigned char *output);
+void EncodeBC4 (const unsigned char block[64], int channel, unsigned char *output);
+void EncodeBC7 (const unsigned char block[64], unsigned char *output);
+void PrincipalAxis (const float pixels[][16], int channels, float mean[4], float axis[4]);
+void EndpointsAlongAxis (const float pixels[][16], int channels, float inset, float low[4], float high[4]);
+bool RefitEndpoints (const float pixels[][16], int channels, const int indices[16], const float *fractions, float first[4], float second[4]);
+float NearestPaletteEntries (const float pixels[][16], int channels, const float palette[][4], int paletteSize, int indices[16]);
+void WriteBits (uint64_t words[2], int &position, uint32_t value, int count);
+
+// Bytes in one block, or 0 if the format isn't made of blocks
+int BlockBytes (TextureFormat format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1:
+    case TEXTURE_FORMAT_BC4:
+        return 8;
+    case TEXTURE_FORMAT_BC5:
+    case TEXTURE_FORMAT_BC7:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// Bytes in one mip level. Block formats round the size up to whole blocks.
+size_t TextureLevelSize (TextureFormat format, int width, int height)
+{
+    if (format == TEXTURE_FORMAT_RGBA8) return (size_t)width * height * 4;
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+// Bytes in the first levelCount mip levels, stored one after the other
+size_t TextureChainSize (TextureFormat format, int width, int height, int levelCount)
+{
+    size_t size = 0;
+    for (int level = 0; level < levelCount; level++) size += TextureLevelSize(format, max(1, width >> level), max(1, height >> level));
+    return size;
+}
+
+// Levels in a full mip chain, down to 1x1
+int MipLevelCount (int width, int height)
+{
+    int levels = 1;
+    for (int size = max(width, height); size > 1; size /= 2) levels++;
+    return levels;
+}
+
+// Box filter RGBA pixels down to the next mip level. sRGB colours are averaged as linear light, so dark and light texels mix properly.
+void DownsampleImage (const unsigned char *rgba, int width, int height, bool srgb, unsigned char *output)
+{
+    static const vector<float> toLinear = []
+    {
+        vector<float> table (256);
+        for (int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+
+    int outWidth = max(1, width / 2), outHeight = max(1, height / 2);
+    for (int y = 0; y < outHeight; y++)
+    {
+        int y0 = min(y * 2, height - 1), y1 = min(y * 2 + 1, height - 1);
+        for (int x = 0; x < outWidth; x++)
+        {
+            int x0 = min(x * 2, width - 1), x1 = min(x * 2 + 1, width - 1);
+            const unsigned char *texels[4] = { rgba + ((size_t)y0 * width + x0) * 4, rgba + ((size_t)y0 * width + x1) * 4,
+                                               rgba + ((size_t)y1 * width + x0) * 4, rgba + ((size_t)y1 * width + x1) * 4 };
+            unsigned char *out = output + ((size_t)y * outWidth + x) * 4;
+            for (int c = 0; c < 4; c++)
+            {
+                if (srgb && c < 3)
+                {
+                    float linear = (toLinear[texels[0][c]] + toLinear[texels[1][c]] + toLinear[texels[2][c]] + toLinear[texels[3][c]]) * 0.25f;
+                    float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+                    out[c] = (unsigned char)min(255.0f, encoded * 255.0f + 0.5f);
+                }
+                else
+                {
+                    out[c] = (texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c] + 2) / 4;
+                }
+            }
+        }
+    }
+}
+
+// Encode block rows [firstRow, firstRow + rowCount) of an RGBA image into blocks, which points at the start of the whole level
+void EncodeBlockRows (TextureFormat format, const unsigned char *rgba, int width, int height, int firstRow, int rowCount, unsigned char *blocks)
+{
+    int blocksWide = (width + 3) / 4;
+    int blockBytes = BlockBytes(format);
+    unsigned char block[64];
+    for (int row = firstRow; row < firstRow + rowCount; row++)
+    {
+        for (int column = 0; column < blocksWide; column++)
+        {
+            unsigned char *output = blocks + ((size_t)row * blocksWide + column) * blockBytes;
+            LoadBlock(rgba, width, height, column * 4, row * 4, block);
+            switch (format)
+            {
+            case TEXTURE_FORMAT_BC1:
+                EncodeBC1(block, output);
+                break;
+            case TEXTURE_FORMAT_BC4:
+                EncodeBC4(block, 0, output);
+                break;
+            case TEXTURE_FORMAT_BC5:
+                EncodeBC4(block, 0, output);
+                EncodeBC4(block, 1, output + 8);
+                break;
+            case TEXTURE_FORMAT_BC7:
+                EncodeBC7(block, output);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+// Copy the 4x4 block at x, y out of the image. Blocks hanging off the edge repeat the last row and column.
+void LoadBlock (const unsigned char *rgba, int width, int height, int x, int y, unsigned char block[64])
+{
+    for (int j = 0; j < 4; j++)
+    {
+        int sy = min(y + j, height - 1);
+        for (int i = 0; i < 4; i++)
+        {
+            int sx = min(x + i, width - 1);
+            memcpy(block + (j * 4 + i) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+// RGB565 endpoints along the principal axis, inset a little so the ends aren't spent on outliers, then refit to the indices they give
+void EncodeBC1 (const unsigned char block[64], unsigned char *output)
+{
+    static const float fractions[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };// How far each index is from the first endpoint to the second
+
+    float pixels[3][16];
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++) pixels[c][i] = block[i * 4 + c];
+    }
+
+    float ends[2][4];
+    EndpointsAlongAxis(pixels, 3, 1.0f / 16.0f, ends[1], ends[0]);
+
+    uint16_t endpoints[2] = { 0, 0 };
+    uint32_t bits = 0;
+    float bestError = 1e30f;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        // Quantize both ends to 565. The first must be the larger for four colour mode.
+        uint16_t quantized[2];
+        for (int e = 0; e < 2; e++)
+        {
+            int r = (int)(min(255.0f, max(0.0f, ends[e][0])) * 31.0f / 255.0f + 0.5f);
+            int g = (int)(min(255.0f, max(0.0f, ends[e][1])) * 63.0f / 255.0f + 0.5f);
+            int b = (int)(min(255.0f, max(0.0f, ends[e][2])) * 31.0f / 255.0f + 0.5f);
+            quantized[e] = (uint16_t)((r << 11) | (g << 5) | b);
+        }
+        if (quantized[0] < quantized[1]) swap(quantized[0], quantized[1]);
+
+        // Equal endpoints would mean three colour mode, so make the second one step smaller and keep four
+        if (quantized[0] == quantized[1])
+        {
+            if (quantized[1] == 0) quantized[0] = 1;
+            else quantized[1]--;
+        }
+
+        float palette[4][4];
+        for (int e = 0; e < 2; e++)
+        {
+            int r = (quantized[e] >> 11) & 31, g = (quantized[e] >> 5) & 63, b = quantized[e] & 31;
+            palette[e][0] = (float)((r << 3) | (r >> 2));
+            palette[e][1] = (float)((g << 2) | (g >> 4));
+            palette[e][2] = (float)((b << 3) | (b >> 2));
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        int indices[16];
+        float error = NearestPaletteEntries(pixels, 3, palette, 4, indices);
+        if (error < bestError)
+        {
+            bestError = error;
+            memcpy(endpoints, quantized, sizeof(quantized));
+            bits = 0;
+            for (int i = 0; i < 16; i++) bits |= (uint32_t)indices[i] << (i * 2);
+        }
+        if (!RefitEndpoints(pixels, 3, indices, fractions, ends[0], ends[1])) break;
+    }
+
+    output[0] = endpoints[0] & 0xFF;
+    output[1] = endpoints[0] >> 8;
+    output[2] = endpoints[1] & 0xFF;
+    output[3] = endpoints[1] >> 8;
+    for (int i = 0; i < 4; i++) output[4 + i] = (bits >> (i * 8)) & 0xFF;
+}
+
+// One channel of the block, with the block's own minimum and maximum as endpoints and 6 steps between them
+void EncodeBC4 (const unsigned char block[64], int channel, unsigned char *output)
+{
+    unsigned char values[16];
+    unsigned char low = 255, high = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        values[i] = block[i * 4 + channel];
+        low = min(low, values[i]);
+        high = max(high, values[i]);
+    }
+
+    output[0] = high;
+    output[1] = low;
+    memset(output + 2, 0, 6);
+    if (high == low) return;
+
+    // With the first endpoint larger, index 0 is high, 1 is low and 2 to 7 are evenly between, from high to low
+    unsigned char palette[8] = { high, low };
+    for (int i = 2; i < 8; i++) palette[i] = (unsigned char)(((8 - i) * high + (i - 1) * low + 3) / 7);
+
+    // Distance of all 16 values to each palette entry at once, keeping the index of the closest
+    __m128i pixels = _mm_loadu_si128((const __m128i *)values);
+    __m128i best = _mm_set1_epi8((char)0xFF);
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (int i = 0; i < 8; i++)
+    {
+        __m128i entry = _mm_set1_epi8((char)palette[i]);
+        __m128i distance = _mm_or_si128(_mm_subs_epu8(pixels, entry), _mm_subs_epu8(entry, pixels));
+        __m128i closest = _mm_min_epu8(distance, best);
+        __m128i closer = _mm_xor_si128(_mm_cmpeq_epi8(closest, best), ones);// distance < best
+        best = closest;
+        bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi8((char)i)), _mm_andnot_si128(closer, bestIndex));
+    }
+    unsigned char indices[16];
+    _mm_storeu_si128((__m128i *)indices, bestIndex);
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (uint64_t)indices[i] << (i * 3);
+    for (int i = 0; i < 6; i++) output[2 + i] = (bits >> (i * 8)) & 0xFF;
+}
+
+// Mode 6: one pair of RGBA endpoints along the principal axis, each with its own low bit, and 16 colours between them.
+// The endpoints are then refit to the indices they gave, and the better of the two is kept.
+void EncodeBC7 (const unsigned char block[64], unsigned char *output)
+{
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    float fractions[16];
+    for (int i = 0; i < 16; i++) fractions[i] = weights[i] / 64.0f;
+
+    float pixels[4][16];
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 4; c++) pixels[c][i] = block[i * 4 + c];
+    }
+
+    float ends[2][4];
+    EndpointsAlongAxis(pixels, 4, 0.0f, ends[0], ends[1]);
+
+    int endpoints[2][4];
+    int pBits[2];
+    int indices[16];
+    float bestError = 1e30f;
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        // Each endpoint is 7 bits a channel plus a low bit shared by its channels. Take whichever low bit lands closer.
+        int quantized[2][4];
+        int quantizedP[2];
+        for (int e = 0; e < 2; e++)
+        {
+            float closest = 1e30f;
+            for (int p = 0; p < 2; p++)
+            {
+                int candidate[4];
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++)
+                {
+                    float target = min(255.0f, max(0.0f, ends[e][c]));
+                    candidate[c] = min(127, max(0, (int)floorf((target - p) / 2.0f + 0.5f)));
+                    float d = target - (float)((candidate[c] << 1) | p);
+                    error += d * d;
+                }
+                if (error < closest)
+                {
+                    closest = error;
+                    quantizedP[e] = p;
+                    memcpy(quantized[e], candidate, sizeof(candidate));
+                }
+            }
+        }
+
+        float palette[16][4];
+        for (int i = 0; i < 16; i++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                int e0 = (quantized[0][c] << 1) | quantizedP[0], e1 = (quantized[1][c] << 1) | quantizedP[1];
+                palette[i][c] = (float)(((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6);
+            }
+        }
+        int candidateIndices[16];
+        float error = NearestPaletteEntries(pixels, 4, palette, 16, candidateIndices);
+        if (error < bestError)
+        {
+            bestError = error;
+            memcpy(endpoints, quantized, sizeof(quantized));
+            memcpy(pBits, quantizedP, sizeof(quantizedP));
+            memcpy(indices, candidateIndices, sizeof(candidateIndices));
+        }
+        if (!RefitEndpoints(pixels, 4, candidateIndices, fractions, ends[0], ends[1])) break;
+    }
+
+    // The first texel's index is stored without its top bit, so it has to be in the lower half. Swap the ends if it isn't.
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++) swap(endpoints[0][c], endpoints[1][c]);
+        swap(pBits[0], pBits[1]);
+        for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+    }
+
+    // Mode 6 is six 0 bits then a 1, then R0 R1 G0 G1 B0 B1 A0 A1, P0 P1, and the indices, all least significant bit first
+    uint64_t words[2] = { 0, 0 };
+    int position = 0;
+    WriteBits(words, position, 1 << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+        WriteBits(words, position, endpoints[0][c], 7);
+        WriteBits(words, position, endpoints[1][c], 7);
+    }
+    WriteBits(words, position, pBits[0], 1);
+    WriteBits(words, position, pBits[1], 1);
+    WriteBits(words, position, indices[0], 3);
+    for (int i = 1; i < 16; i++) WriteBits(words, position, indices[i], 4);
+
+    for (int i = 0; i < 16; i++) output[i] = (words[i / 8] >> ((i % 8) * 8)) & 0xFF;
+}
+
+// The mean of the pixels and the direction they vary along most, by power iteration on their covariance
+void PrincipalAxis (const float pixels[][16], int channels, float mean[4], float axis[4])
+{
+    for (int c = 0; c < 4; c++)
+    {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+    }
+    for (int c = 0; c < channels; c++)
+    {
+        for (int i = 0; i < 16; i++) mean[c] += pixels[c][i];
+        mean[c] /= 16.0f;
+    }
+
+    float covariance[4][4] = { { 0 } };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int a = 0; a < channels; a++)
+        {
+            for (int b = a; b < channels; b++) covariance[a][b] += (pixels[a][i] - mean[a]) * (pixels[b][i] - mean[b]);
+        }
+    }
+    for (int a = 0; a < channels; a++)
+    {
+        for (int b = 0; b < a; b++) covariance[a][b] = covariance[b][a];
+    }
+
+    // Start from the channel that varies most, which is never orthogonal to the answer unless the block is flat
+    int widest = 0;
+    for (int c = 1; c < channels; c++)
+    {
+        if (covariance[c][c] > covariance[widest][widest]) widest = c;
+    }
+    axis[widest] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = { 0, 0, 0, 0 };
+        float length = 0.0f;
+        for (int a = 0; a < channels; a++)
+        {
+            for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        if (length < 1e-12f) break;// Flat block, any axis will do
+        length = 1.0f / sqrtf(length);
+        for (int c = 0; c < channels; c++) axis[c] = next[c] * length;
+    }
+}
+
+// The two ends of the pixels' spread along their principal axis, each pulled in by inset of the length between them
+void EndpointsAlongAxis (const float pixels[][16], int channels, float inset, float low[4], float high[4])
+{
+    float mean[4], axis[4];
+    PrincipalAxis(pixels, channels, mean, axis);
+    float lowest = 1e30f, highest = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++) t += (pixels[c][i] - mean[c]) * axis[c];
+        lowest = min(lowest, t);
+        highest = max(highest, t);
+    }
+    float pull = (highest - lowest) * inset;
+    for (int c = 0; c < 4; c++)
+    {
+        low[c] = mean[c] + axis[c] * (lowest + pull);
+        high[c] = mean[c] + axis[c] * (highest - pull);
+    }
+}
+
+// Least squares endpoints for indices, where index i is fractions[i] of the way from first to second.
+// Returns false if every pixel has the same index, when there's nothing to fit.
+bool RefitEndpoints (const float pixels[][16], int channels, const int indices[16], const float *fractions, float first[4], float second[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = { 0, 0, 0, 0 }, bx[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        float b = fractions[indices[i]], a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++)
+        {
+            ax[c] += a * pixels[c][i];
+            bx[c] += b * pixels[c][i];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f) return false;
+    for (int c = 0; c < channels; c++)
+    {
+        first[c] = (bb * ax[c] - ab * bx[c]) / determinant;
+        second[c] = (aa * bx[c] - ab * ax[c]) / determinant;
+    }
+    return true;
+}
+
+// Set each pixel's index to its closest palette entry, four pixels at a time. Returns the total squared error.
+float NearestPaletteEntries (const float pixels[][16], int channels, const float palette[][4], int paletteSize, int indices[16])
+{
+    __m128 total = _mm_setzero_ps();
+    for (int group = 0; group < 16; group += 4)
+    {
+        __m128 values[4];
+        for (int c = 0; c < channels; c++) values[c] = _mm_loadu_ps(pixels[c] + group);
+
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int i = 0; i < paletteSize; i++)
+        {
+            __m128 distance = _mm_setzero_ps();
+            for (int c = 0; c < channels; c++)
+            {
+                __m128 d = _mm_sub_ps(values[c], _mm_set1_ps(palette[i][c]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+        }
+        _mm_storeu_si128((__m128i *)(indices + group), bestIndex);
+        total = _mm_add_ps(total, best);
+    }
+
+    float sums[4];
+    _mm_storeu_ps(sums, total);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+// Append the low count bits of value to a 128 bit block, least significant bit first
+void WriteBits (uint64_t words[2], int &position, uint32_t value, int count)
+{
+    for (int i = 0; i < count; i++, position++)
+    {
+        if (value & (1u << i)) words[position / 64] |= 1ULL << (position % 64);
+    }
+}
+
+#endif // BLOCKCOMPRESSION_H_INCLUDED
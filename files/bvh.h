@@ -0,0 +1,540 @@
+#ifndef BVH_H_INCLUDED
+#define BVH_H_INCLUDED
+
+/***********
+This header holds the bounding volume hierarchy over the scene's objects, which answers where
+things are without looking at every one of them.
+
+Each node has a box around everything under it. Leaves hold a few objects, and every node's
+objects are one run of the tree's item order, so a node that's wholly inside a query hands back
+its whole run without testing anything under it. Frustum culling, ray casts and box and sphere
+queries all walk down from the root, skipping every node they miss, so their cost goes with the
+depth of the tree (and how much they find) rather than the size of the scene.
+
+The tree is built with the surface area heuristic: at each node the objects' centres are
+binned along each axis, and the split that minimises
+
+    objects on the left * area of their box + objects on the right * area of theirs
+
+is taken, since the chance of a query reaching a child goes with its surface area. A node
+becomes a leaf when no split is cheaper than testing its objects one by one.
+
+When an object moves, Refit changes its bounds and grows or shrinks the boxes above it, which
+keeps the tree correct but not as good as a fresh build. Rebuild when a lot has moved far.
+
+Run with -benchmarkculling to see how culling grows with the number of objects.
+************/
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include "frustum.h"
+#include "culling.h"
+
+#define BVH_BINS 16// Places a split is tried along each axis
+#define BVH_LEAF_SIZE 4// Objects in a leaf before a split is even considered
+#define BVH_MAX_LEAF_SIZE 16// Objects in a leaf before it's split whatever the cost
+#define BVH_TRAVERSAL_COST 1.0f// Cost of visiting a node, against 1 for testing an object
+#define BVH_MAX_DEPTH 60// Nodes this deep are leaves however many objects they hold, so the query stacks can't overflow
+#define BVH_STACK_SIZE 64
+
+using namespace std;
+
+struct BVHNode
+{
+    glm::vec3 minimum;
+    glm::vec3 maximum;
+    uint32_t left;// Children are left and left + 1. 0 for a leaf, since the root is nobody's child.
+    uint32_t firstItem;// Every object under the node is items[firstItem] to items[firstItem + itemCount - 1]
+    uint32_t itemCount;
+};
+
+void BenchmarkBVH ();
+
+class BVH
+{
+public:
+    // Build the tree over objects with these world space bounds. An object's index in bounds is what queries return.
+    void Build (const vector<Bounds> &bounds)
+    {
+        this->bounds = bounds;
+        Rebuild();
+    }
+
+    // Build the tree again from the objects' current bounds, after a lot of Refits have worn it down
+    void Rebuild ()
+    {
+        nodes.clear();
+        parents.clear();
+        items.resize(bounds.size());
+        leaves.resize(bounds.size());
+        centres.resize(bounds.size());
+        for (uint32_t i = 0; i < bounds.size(); i++)
+        {
+            items[i] = i;
+            centres[i] = (bounds[i].minimum + bounds[i].maximum) * 0.5f;
+        }
+        if (bounds.empty()) return;
+
+        nodes.push_back(BVHNode());
+        parents.push_back(0);
+        nodes[0].firstItem = 0;
+        nodes[0].itemCount = bounds.size();
+        split(0, 0);
+    }
+
+    // Give object item new bounds, such as after its location, rotation or scale changed, and fix the boxes above it
+    void Refit (uint32_t item, const Bounds &itemBounds)
+    {
+        bounds[item] = itemBounds;
+        for (uint32_t node = leaves[item]; ; node = parents[node])
+        {
+            glm::vec3 minimum = nodes[node].minimum, maximum = nodes[node].maximum;
+            fitNode(node);
+            if (nodes[node].minimum == minimum && nodes[node].maximum == maximum) break;// Nothing higher up changes either
+            if (node == 0) break;
+        }
+    }
+
+    // Fill visible with every object that might be inside frustum
+    void Cull (const Frustum &frustum, vector<uint32_t> &visible) const
+    {
+        visible.clear();
+        if (nodes.empty()) return;
+
+        // Each node on the stack comes with the planes it isn't already known to be inside of
+        pair<uint32_t, int> stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = make_pair(0u, 0x3F);
+        while (stackSize)
+        {
+            uint32_t index = stack[--stackSize].first;
+            int planes = stack[stackSize].second;
+            const BVHNode &node = nodes[index];
+
+            glm::vec3 centre = (node.minimum + node.maximum) * 0.5f;
+            glm::vec3 extent = (node.maximum - node.minimum) * 0.5f;
+            bool outside = false;
+            for (int i = 0; i < 6 && !outside; i++)
+            {
+                if (!(planes & (1 << i))) continue;
+                glm::vec3 normal = glm::vec3(frustum.planes[i]);
+                float distance = glm::dot(normal, centre) + frustum.planes[i].w;
+                float reach = glm::dot(glm::abs(normal), extent);
+                if (distance < -reach) outside = true;
+                else if (distance >= reach) planes &= ~(1 << i);// Wholly inside this plane, and so is everything under it
+            }
+            if (outside) continue;
+
+            if (planes == 0)
+            {
+                visible.insert(visible.end(), items.begin() + node.firstItem, items.begin() + node.firstItem + node.itemCount);
+            }
+            else if (node.left == 0)
+            {
+                for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+                {
+                    if (frustum.BoundsVisible(bounds[items[i]])) visible.push_back(items[i]);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = make_pair(node.left, planes);
+                stack[stackSize++] = make_pair(node.left + 1, planes);
+            }
+        }
+    }
+
+    // Find the nearest object whose box the ray from origin along direction hits within maxDistance.
+    // Returns false if it hits nothing. Starting inside a box counts as hitting it at distance 0.
+    bool Raycast (glm::vec3 origin, glm::vec3 direction, float maxDistance, uint32_t &item, float &distance) const
+    {
+        if (nodes.empty()) return false;
+
+        glm::vec3 inverse;
+        for (int axis = 0; axis < 3; axis++) inverse[axis] = direction[axis] != 0.0f ? 1.0f / direction[axis] : FLT_MAX;
+
+        float nearest = maxDistance;
+        bool hit = false;
+        uint32_t stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize)
+        {
+            const BVHNode &node = nodes[stack[--stackSize]];
+            float entry;
+            if (!rayHitsBox(origin, inverse, node.minimum, node.maximum, nearest, entry)) continue;
+
+            if (node.left == 0)
+            {
+                for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+                {
+                    const Bounds &itemBounds = bounds[items[i]];
+                    if (!rayHitsBox(origin, inverse, itemBounds.minimum, itemBounds.maximum, nearest, entry)) continue;
+                    nearest = entry;
+                    item = items[i];
+                    hit = true;
+                }
+                continue;
+            }
+
+            // Visit the nearer child first, so the further one is more likely to be skipped
+            const BVHNode &left = nodes[node.left], &right = nodes[node.left + 1];
+            float leftEntry, rightEntry;
+            bool hitsLeft = rayHitsBox(origin, inverse, left.minimum, left.maximum, nearest, leftEntry);
+            bool hitsRight = rayHitsBox(origin, inverse, right.minimum, right.maximum, nearest, rightEntry);
+            if (hitsLeft && hitsRight && leftEntry > rightEntry)
+            {
+                stack[stackSize++] = node.left;
+                stack[stackSize++] = node.left + 1;
+            }
+            else
+            {
+                if (hitsRight) stack[stackSize++] = node.left + 1;
+                if (hitsLeft) stack[stackSize++] = node.left;
+            }
+        }
+        if (hit) distance = nearest;
+        return hit;
+    }
+
+    // Fill found with every object whose box overlaps the box from minimum to maximum
+    void QueryBox (glm::vec3 minimum, glm::vec3 maximum, vector<uint32_t> &found) const
+    {
+        found.clear();
+        if (nodes.empty()) return;
+
+        uint32_t stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize)
+        {
+            const BVHNode &node = nodes[stack[--stackSize]];
+            if (!boxesOverlap(node.minimum, node.maximum, minimum, maximum)) continue;
+
+            if (boxContains(minimum, maximum, node.minimum, node.maximum))
+            {
+                found.insert(found.end(), items.begin() + node.firstItem, items.begin() + node.firstItem + node.itemCount);
+            }
+            else if (node.left == 0)
+            {
+                for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+                {
+                    if (boxesOverlap(bounds[items[i]].minimum, bounds[items[i]].maximum, minimum, maximum)) found.push_back(items[i]);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.left;
+                stack[stackSize++] = node.left + 1;
+            }
+        }
+    }
+
+    // Fill found with every object that might be within radius of centre: both its box and its sphere reach it
+    void QuerySphere (glm::vec3 centre, float radius, vector<uint32_t> &found) const
+    {
+        found.clear();
+        if (nodes.empty()) return;
+
+        uint32_t stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize)
+        {
+            const BVHNode &node = nodes[stack[--stackSize]];
+            if (!sphereTouchesBox(centre, radius, node.minimum, node.maximum)) continue;
+
+            if (node.left == 0)
+            {
+                for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+                {
+                    const Bounds &itemBounds = bounds[items[i]];
+                    if (sphereTouchesBox(centre, radius, itemBounds.minimum, itemBounds.maximum) &&
+                        glm::length(itemBounds.centre - centre) <= radius + itemBounds.radius)
+                    {
+                        found.push_back(items[i]);
+                    }
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.left;
+                stack[stackSize++] = node.left + 1;
+            }
+        }
+    }
+
+    // The bounds object item was built or last refitted with
+    const Bounds & GetBounds (uint32_t item) const
+    {
+        return bounds[item];
+    }
+
+    uint32_t Size () const
+    {
+        return bounds.size();
+    }
+
+    // Print the shape of the tree
+    void PrintStats () const
+    {
+        uint32_t leafCount = 0, deepest = 0;
+        for (uint32_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].left != 0) continue;
+            leafCount++;
+            uint32_t depth = 0;
+            for (uint32_t node = i; node != 0; node = parents[node]) depth++;
+            deepest = max(deepest, depth);
+        }
+        cout << "BVH: " << bounds.size() << " objects, " << nodes.size() << " nodes, " << leafCount << " leaves, " << deepest << " deep" << endl;
+    }
+
+private:
+    vector<Bounds> bounds;// By object
+    vector<glm::vec3> centres;// Of each object's box, which is what gets binned
+    vector<uint32_t> items;// Objects in tree order
+    vector<uint32_t> leaves;// The leaf each object is in
+    vector<BVHNode> nodes;// Children always come after their parents
+    vector<uint32_t> parents;// By node
+
+    struct Bin
+    {
+        glm::vec3 minimum;
+        glm::vec3 maximum;
+        uint32_t count;
+    };
+
+    // Make node's box fit its objects, or its children if it has any
+    void fitNode (uint32_t index)
+    {
+        BVHNode &node = nodes[index];
+        if (node.left != 0)
+        {
+            node.minimum = glm::min(nodes[node.left].minimum, nodes[node.left + 1].minimum);
+            node.maximum = glm::max(nodes[node.left].maximum, nodes[node.left + 1].maximum);
+            return;
+        }
+        node.minimum = glm::vec3(FLT_MAX);
+        node.maximum = glm::vec3(-FLT_MAX);
+        for (uint32_t i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+        {
+            node.minimum = glm::min(node.minimum, bounds[items[i]].minimum);
+            node.maximum = glm::max(node.maximum, bounds[items[i]].maximum);
+        }
+    }
+
+    // Fit node, depth levels below the root, around its objects and split it in two if that's cheaper by the surface
+    // area heuristic, then the same for its children
+    void split (uint32_t index, int depth)
+    {
+        BVHNode &node = nodes[index];
+        node.left = 0;
+        fitNode(index);
+        uint32_t first = node.firstItem, count = node.itemCount;
+        for (uint32_t i = first; i < first + count; i++) leaves[items[i]] = index;
+        if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH) return;
+
+        glm::vec3 centreMinimum(FLT_MAX), centreMaximum(-FLT_MAX);
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            centreMinimum = glm::min(centreMinimum, centres[items[i]]);
+            centreMaximum = glm::max(centreMaximum, centres[items[i]]);
+        }
+
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centreMaximum[axis] - centreMinimum[axis];
+            if (extent <= 0.0f) continue;
+
+            Bin bins[BVH_BINS];
+            for (int i = 0; i < BVH_BINS; i++)
+            {
+                bins[i].minimum = glm::vec3(FLT_MAX);
+                bins[i].maximum = glm::vec3(-FLT_MAX);
+                bins[i].count = 0;
+            }
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                Bin &bin = bins[binOf(centres[items[i]][axis], centreMinimum[axis], extent)];
+                bin.minimum = glm::min(bin.minimum, bounds[items[i]].minimum);
+                bin.maximum = glm::max(bin.maximum, bounds[items[i]].maximum);
+                bin.count++;
+            }
+
+            // Sweep from the right to get the cost of everything right of each split, then from the left
+            float rightCosts[BVH_BINS];
+            glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+            uint32_t rightCount = 0;
+            for (int i = BVH_BINS - 1; i > 0; i--)
+            {
+                minimum = glm::min(minimum, bins[i].minimum);
+                maximum = glm::max(maximum, bins[i].maximum);
+                rightCount += bins[i].count;
+                rightCosts[i] = rightCount ? rightCount * area(minimum, maximum) : 0.0f;
+            }
+            minimum = glm::vec3(FLT_MAX);
+            maximum = glm::vec3(-FLT_MAX);
+            uint32_t leftCount = 0;
+            for (int i = 1; i < BVH_BINS; i++)
+            {
+                minimum = glm::min(minimum, bins[i - 1].minimum);
+                maximum = glm::max(maximum, bins[i - 1].maximum);
+                leftCount += bins[i - 1].count;
+                if (leftCount == 0 || leftCount == count) continue;
+                float cost = leftCount * area(minimum, maximum) + rightCosts[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        // Stay a leaf if testing the objects is cheaper than visiting two children, unless it's too big a leaf
+        float leafCost = count * area(node.minimum, node.maximum);
+        uint32_t leftCount;
+        if (bestAxis >= 0 && (bestCost + BVH_TRAVERSAL_COST * area(node.minimum, node.maximum) < leafCost || count > BVH_MAX_LEAF_SIZE))
+        {
+            float minimum = centreMinimum[bestAxis], extent = centreMaximum[bestAxis] - centreMinimum[bestAxis];
+            vector<uint32_t>::iterator middle = partition(items.begin() + first, items.begin() + first + count, [&](uint32_t item)
+            {
+                return binOf(centres[item][bestAxis], minimum, extent) < bestSplit;
+            });
+            leftCount = middle - (items.begin() + first);
+        }
+        else if (count > BVH_MAX_LEAF_SIZE)
+        {
+            leftCount = count / 2;// Every centre is in the same place, so any split is as good as another
+        }
+        else
+        {
+            return;
+        }
+
+        uint32_t left = nodes.size();
+        nodes.resize(nodes.size() + 2);
+        parents.push_back(index);
+        parents.push_back(index);
+        nodes[index].left = left;
+        nodes[left].firstItem = first;
+        nodes[left].itemCount = leftCount;
+        nodes[left + 1].firstItem = first + leftCount;
+        nodes[left + 1].itemCount = count - leftCount;
+        split(left, depth + 1);
+        split(left + 1, depth + 1);
+    }
+
+    int binOf (float centre, float minimum, float extent) const
+    {
+        return min((int)((centre - minimum) / extent * BVH_BINS), BVH_BINS - 1);
+    }
+
+    // Half the surface area of a box, which is all the heuristic needs
+    static float area (glm::vec3 minimum, glm::vec3 maximum)
+    {
+        glm::vec3 size = glm::max(maximum - minimum, glm::vec3(0.0f));
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    // Slab test. entry is where the ray goes into the box, or 0 if it starts inside.
+    static bool rayHitsBox (glm::vec3 origin, glm::vec3 inverse, glm::vec3 minimum, glm::vec3 maximum, float maxDistance, float &entry)
+    {
+        float start = 0.0f, end = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (minimum[axis] - origin[axis]) * inverse[axis];
+            float t1 = (maximum[axis] - origin[axis]) * inverse[axis];
+            if (t0 > t1) swap(t0, t1);
+            start = max(start, t0);
+            end = min(end, t1);
+            if (start > end) return false;
+        }
+        entry = start;
+        return true;
+    }
+
+    static bool boxesOverlap (glm::vec3 minimumA, glm::vec3 maximumA, glm::vec3 minimumB, glm::vec3 maximumB)
+    {
+        return minimumA.x <= maximumB.x && maximumA.x >= minimumB.x &&
+               minimumA.y <= maximumB.y && maximumA.y >= minimumB.y &&
+               minimumA.z <= maximumB.z && maximumA.z >= minimumB.z;
+    }
+
+    // Whether the outer box wholly holds the inner one
+    static bool boxContains (glm::vec3 outerMinimum, glm::vec3 outerMaximum, glm::vec3 innerMinimum, glm::vec3 innerMaximum)
+    {
+        return outerMinimum.x <= innerMinimum.x && outerMinimum.y <= innerMinimum.y && outerMinimum.z <= innerMinimum.z &&
+               outerMaximum.x >= innerMaximum.x && outerMaximum.y >= innerMaximum.y && outerMaximum.z >= innerMaximum.z;
+    }
+
+    static bool sphereTouchesBox (glm::vec3 centre, float radius, glm::vec3 minimum, glm::vec3 maximum)
+    {
+        glm::vec3 closest = glm::clamp(centre, minimum, maximum);
+        glm::vec3 offset = centre - closest;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+};
+
+// Prints how long culling takes with the tree and with a CullingSet, for scenes from a hundred to a million objects.
+// The objects are spread out more as there are more of them, so about as many are in view each time.
+void BenchmarkBVH ()
+{
+    typedef chrono::steady_clock Clock;
+    const int runs = 20;
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum (glm::perspective(45.0f, 16.0f / 9.0f, 0.1f, 200.0f) * view);
+
+    srand(1);
+    for (uint32_t objectCount = 100; objectCount <= 1000000; objectCount *= 10)
+    {
+        float size = 20.0f * powf((float)objectCount, 1.0f / 3.0f);
+        vector<Bounds> bounds (objectCount);
+        CullingSet set;
+        for (uint32_t i = 0; i < objectCount; i++)
+        {
+            glm::vec3 centre, extent;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                centre[axis] = (rand() / (float)RAND_MAX - 0.5f) * size;
+                extent[axis] = 0.25f + rand() / (float)RAND_MAX * 2.5f;
+            }
+            bounds[i].minimum = centre - extent;
+            bounds[i].maximum = centre + extent;
+            bounds[i].centre = centre;
+            bounds[i].radius = glm::length(extent);
+            set.Add(bounds[i]);
+        }
+
+        Clock::time_point start = Clock::now();
+        BVH tree;
+        tree.Build(bounds);
+        double buildTime = chrono::duration<double, milli>(Clock::now() - start).count();
+
+        vector<uint32_t> visible;
+        start = Clock::now();
+        for (int run = 0; run < runs; run++) tree.Cull(frustum, visible);
+        double treeTime = chrono::duration<double, milli>(Clock::now() - start).count() / runs;
+
+        vector<unsigned int> setVisible;
+        start = Clock::now();
+        for (int run = 0; run < runs; run++) set.Cull(frustum, setVisible);
+        double setTime = chrono::duration<double, milli>(Clock::now() - start).count() / runs;
+
+        cout << objectCount << " objects, " << visible.size() << " visible: BVH " << treeTime << " ms (built in " << buildTime
+             << " ms), CullingSet " << setTime << " ms" << endl;
+    }
+}
+
+#endif // BVH_H_INCLUDED
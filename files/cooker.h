@@ -0,0 +1,701 @@
+#ifndef COOKER_H_INCLUDED
+#define COOKER_H_INCLUDED
+
+/***********
+This header holds the offline asset cooker that the djcook tool runs.
+
+It finds every model, texture and environment map under resources/ and turns each into what
+the engine loads at runtime: cooked meshes, block compressed textures, and the IBL cubemaps.
+Models and textures cook in parallel on the worker pool, and each texture's mip levels are
+encoded in bands of block rows across the pool too. Environments render their maps with OpenGL,
+so they cook one at a time on the thread that owns the context.
+
+A texture's format comes from its use, which is in its name (see TextureTypeFromName): colour
+maps are BC7 (or BC1, see COOK_COLOUR_FORMAT), normal maps BC5 and scalar maps BC4. Images
+that aren't named as any kind of map are left as RGBA. Occlusion, roughness, metallic and
+specular maps aren't cooked alone: each directory's are cooked packed into one texture (see
+texturePacking.h), as BC4, BC5 or BC7 by how many channels it uses.
+
+What was cooked from what is kept in a manifest. Every cooked asset records the files it was
+made from (a model's .obj and .mtl, an environment's .hdr and the shaders that render it)
+with a hash of their contents, a hash of the settings it was cooked with, and the files it made.
+An asset is only cooked again when one of those hashes changes or an output has gone missing,
+so touching a file without changing it doesn't cost anything. File contents are only hashed
+again when their modification time or size changes.
+
+Outputs that no asset claims any more are deleted, so stale caches don't get shipped.
+
+Manifest layout, one record per line, fields separated by tabs:
+    DJCOOK  COOK_VERSION
+    record  kind  source  settings hash
+    dependency  path  modification time  size  content hash
+    output  path
+************/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "fileUtils.h"
+#include "hash.h"
+#include "dirent.h"
+#include "threadPool.h"
+#include "shader.h"
+#include "model.h"
+#include "textureCache.h"
+#include "blockCompression.h"
+#include "ibl.h"
+
+#define COOK_VERSION 1// Bump to cook everything again
+#define COOK_MANIFEST MESH_CACHE_DIRECTORY "cook.manifest"
+#define COOK_RESOURCE_DIRECTORY "resources"
+#define COOK_COLOUR_FORMAT TEXTURE_FORMAT_BC7// TEXTURE_FORMAT_BC1 is half the size again, but blockier
+#define COOK_BAND_ROWS 16// Block rows of a texture encoded per job
+
+using namespace std;
+
+enum CookKind
+{
+    COOK_MODEL,
+    COOK_TEXTURE,
+    COOK_ENVIRONMENT
+};
+
+struct CookDependency
+{
+    string path;
+    int64_t mTime;
+    uint64_t size;
+    uint64_t hash;// Of the contents
+};
+
+// Everything the manifest knows about one cooked asset
+struct CookRecord
+{
+    CookKind kind;
+    string source;
+    uint64_t settings;// Hash of the versions and flags it was cooked with
+    vector<CookDependency> dependencies;
+    vector<string> outputs;
+};
+
+bool HashFile (string path, CookDependency &dependency);
+bool StampDependency (string path, CookDependency &dependency, const CookRecord *previous);
+bool HasExtension (string file, const char **extensions);
+void FindCookSources (string directory, vector<string> &models, vector<string> &textures, vector<string> &environments);
+TextureFormat CookedFormatForType (string type, string file);
+
+/********************
+CookManifest: What every asset was cooked from, read from and written back to COOK_MANIFEST.
+*********************/
+class CookManifest
+{
+public:
+    // Read the manifest at path. A missing or out of date manifest just means nothing's been cooked.
+    void Load (string path)
+    {
+        records.clear();
+        ifstream fin (path.c_str());
+        string line;
+        if (!getline(fin, line) || line != "DJCOOK\t" + to_string(COOK_VERSION)) return;
+
+        CookRecord *record = NULL;
+        while (getline(fin, line))
+        {
+            vector<string> fields = split(line);
+            if (fields[0] == "record" && fields.size() == 4)
+            {
+                record = &records[fields[2]];
+                record->kind = (CookKind)atoi(fields[1].c_str());
+                record->source = fields[2];
+                record->settings = strtoull(fields[3].c_str(), NULL, 16);
+                record->dependencies.clear();
+                record->outputs.clear();
+            }
+            else if (fields[0] == "dependency" && fields.size() == 5 && record)
+            {
+                CookDependency dependency;
+                dependency.path = fields[1];
+                dependency.mTime = strtoll(fields[2].c_str(), NULL, 10);
+                dependency.size = strtoull(fields[3].c_str(), NULL, 10);
+                dependency.hash = strtoull(fields[4].c_str(), NULL, 16);
+                record->dependencies.push_back(dependency);
+            }
+            else if (fields[0] == "output" && fields.size() == 2 && record)
+            {
+                record->outputs.push_back(fields[1]);
+            }
+        }
+    }
+
+    bool Save (string path)
+    {
+        MakeDirectory(MESH_CACHE_DIRECTORY);
+        ofstream fout (path.c_str(), ios_base::out | ios_base::trunc);
+        if (!fout.is_open())
+        {
+            cout << "ERROR::COOKER:: Could not write " << path << endl;
+            return false;
+        }
+        fout << "DJCOOK\t" << COOK_VERSION << "\n";
+        for (map<string, CookRecord>::iterator it = records.begin(); it != records.end(); ++it)
+        {
+            const CookRecord &record = it->second;
+            fout << "record\t" << (int)record.kind << "\t" << record.source << "\t" << HashToHex(record.settings) << "\n";
+            for (unsigned int i = 0; i < record.dependencies.size(); i++)
+            {
+                const CookDependency &dependency = record.dependencies[i];
+                fout << "dependency\t" << dependency.path << "\t" << dependency.mTime << "\t" << dependency.size << "\t" << HashToHex(dependency.hash) << "\n";
+            }
+            for (unsigned int i = 0; i < record.outputs.size(); i++) fout << "output\t" << record.outputs[i] << "\n";
+        }
+        return fout.good();
+    }
+
+    // The record for source, or NULL if it's never been cooked
+    const CookRecord * Find (string source) const
+    {
+        map<string, CookRecord>::const_iterator it = records.find(source);
+        return it == records.end() ? NULL : &it->second;
+    }
+
+    map<string, CookRecord> records;
+
+private:
+    vector<string> split (string line)
+    {
+        vector<string> fields;
+        stringstream stream (line);
+        string field;
+        while (getline(stream, field, '\t')) fields.push_back(field);
+        if (fields.empty()) fields.push_back("");
+        return fields;
+    }
+};
+
+/********************
+Cooker: Finds what needs cooking under resources/, cooks it, and keeps the manifest up to date.
+Call Check, then Cook. If Check finds environments to cook, an OpenGL context must be current for Cook.
+*********************/
+class Cooker
+{
+public:
+    Cooker ()
+    {
+        force = false;
+        upToDate = 0;
+    }
+
+    // Cook everything, whether or not it's changed
+    void SetForce (bool force)
+    {
+        this->force = force;
+    }
+
+    // Find every asset, and work out which ones have changed since they were last cooked
+    void Check ()
+    {
+        manifest.Load(COOK_MANIFEST);
+        vector<string> models, textures, environments;
+        FindCookSources(COOK_RESOURCE_DIRECTORY, models, textures, environments);
+
+        jobs.clear();
+        for (unsigned int i = 0; i < models.size(); i++) addJob(COOK_MODEL, models[i]);
+        for (unsigned int i = 0; i < textures.size(); i++) addJob(COOK_TEXTURE, textures[i]);
+        for (unsigned int i = 0; i < environments.size(); i++) addJob(COOK_ENVIRONMENT, environments[i]);
+
+        // Hashing dependencies reads them, so spread it over the workers
+        for (unsigned int i = 0; i < jobs.size(); i++)
+        {
+            CookJob *job = &jobs[i];
+            const CookRecord *previous = manifest.Find(job->record.source);
+            bool force = this->force;
+            WorkerPool().Submit([job, previous, force]
+            {
+                job->stale = !isUpToDate(job->record, previous) || force;
+                if (!job->stale && job->record.kind != COOK_ENVIRONMENT) restamp(job->record, previous);
+            });
+        }
+        WorkerPool().Wait();
+
+        upToDate = 0;
+        for (unsigned int i = 0; i < jobs.size(); i++) upToDate += jobs[i].stale ? 0 : 1;
+        cout << jobs.size() << " assets, " << jobs.size() - upToDate << " to cook" << endl;
+    }
+
+    // Whether Cook will need an OpenGL context
+    bool NeedsContext ()
+    {
+        for (unsigned int i = 0; i < jobs.size(); i++)
+        {
+            if (jobs[i].stale && jobs[i].record.kind == COOK_ENVIRONMENT) return true;
+        }
+        return false;
+    }
+
+    // Cook everything Check found to be stale, drop what's gone, and save the manifest. Returns false if anything failed.
+    bool Cook ()
+    {
+        typedef chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        // Models and textures on the workers
+        for (unsigned int i = 0; i < jobs.size(); i++)
+        {
+            CookJob *job = &jobs[i];
+            if (!job->stale || job->record.kind == COOK_ENVIRONMENT) continue;
+            if (job->record.kind == COOK_MODEL) WorkerPool().Submit([job] { job->cooked = cookModel(job->record); });
+            else WorkerPool().Submit([job] { cookTexture(job); });
+        }
+
+        // Environments here, since they need the context, while the workers get on with the rest
+        for (unsigned int i = 0; i < jobs.size(); i++)
+        {
+            if (jobs[i].stale && jobs[i].record.kind == COOK_ENVIRONMENT) jobs[i].cooked = cookEnvironment(jobs[i].record);
+        }
+        WorkerPool().Wait();
+
+        // Keep the records of what's up to date or just cooked. Failed assets keep their old record, if any, so they're tried again.
+        map<string, CookRecord> records;
+        int cooked = 0, failed = 0;
+        for (unsigned int i = 0; i < jobs.size(); i++)
+        {
+            const CookJob &job = jobs[i];
+            const CookRecord *previous = manifest.Find(job.record.source);
+            if (!job.stale || job.cooked) records[job.record.source] = job.record;
+            if (job.stale && !job.cooked && previous) records[job.record.source] = *previous;
+            if (job.stale) (job.cooked ? cooked : failed)++;
+        }
+        manifest.records = records;
+        pruneOutputs();
+        bool saved = manifest.Save(COOK_MANIFEST);
+
+        double time = chrono::duration<double, milli>(Clock::now() - start).count();
+        cout << "Cooked " << cooked << ", " << upToDate << " up to date, " << failed << " failed in " << time << " ms on " << WorkerPool().Size() << " worker threads" << endl;
+        return failed == 0 && saved;
+    }
+
+    // Every cooked output, for putting in an asset pack
+    vector<string> Outputs ()
+    {
+        vector<string> outputs;
+        for (map<string, CookRecord>::iterator it = manifest.records.begin(); it != manifest.records.end(); ++it)
+        {
+            outputs.insert(outputs.end(), it->second.outputs.begin(), it->second.outputs.end());
+        }
+        return outputs;
+    }
+
+private:
+    struct CookJob
+    {
+        CookRecord record;// Filled in with the current dependencies and outputs
+        bool stale;
+        bool cooked;
+    };
+
+    // A texture being block compressed. Whichever band finishes last writes it out and deletes it.
+    struct TextureBands
+    {
+        CookJob *job;
+        TextureFormat format;
+        int width;
+        int height;
+        int levelCount;
+        vector<vector<unsigned char> > levels;// RGBA pixels of every mip level
+        vector<unsigned char> blocks;// The compressed chain
+        atomic<int> remaining;// Bands still encoding
+    };
+
+    CookManifest manifest;
+    vector<CookJob> jobs;
+    bool force;
+    int upToDate;
+
+    void addJob (CookKind kind, string source)
+    {
+        CookJob job;
+        job.record.kind = kind;
+        job.record.source = source;
+        job.record.settings = settingsHash(kind);
+        job.stale = true;
+        job.cooked = false;
+        jobs.push_back(job);
+    }
+
+    // What a kind of asset is cooked with, so changing any of it cooks them all again
+    static uint64_t settingsHash (CookKind kind)
+    {
+        uint32_t settings[4] = { COOK_VERSION, (uint32_t)kind, 0, 0 };
+        if (kind == COOK_MODEL)
+        {
+            settings[2] = MESH_CACHE_VERSION;
+            settings[3] = MODEL_IMPORT_FLAGS;
+        }
+        if (kind == COOK_TEXTURE)
+        {
+            settings[2] = TEXTURE_CACHE_VERSION;
+            settings[3] = COOK_COLOUR_FORMAT;
+        }
+        return HashBytes(settings, sizeof(settings));
+    }
+
+    // The files a kind of asset is known to be made from before it's cooked. Models find the rest while cooking.
+    static vector<string> knownDependencies (const CookRecord &record)
+    {
+        vector<string> paths (1, record.source);
+        string packed[PACKED_CHANNEL_COUNT];
+        if (SplitPackedTexture(record.source, packed))
+        {
+            // A packed texture is made from its maps, as it has no file of its own
+            paths.clear();
+            for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+            {
+                if (!packed[i].empty()) paths.push_back(packed[i]);
+            }
+        }
+        if (record.kind == COOK_ENVIRONMENT)
+        {
+            const char *shaders[] = { "cubemap.vs", "equirectangular_to_cubemap.frag", "irradiance_convolution.frag", "prefilter.frag" };
+            for (int i = 0; i < 4; i++) paths.push_back(string(COOK_RESOURCE_DIRECTORY) + "/shaders/" + shaders[i]);
+        }
+        return paths;
+    }
+
+    // Fills in record's dependencies as they are now, and compares them with what it was cooked from last time
+    static bool isUpToDate (CookRecord &record, const CookRecord *previous)
+    {
+        vector<string> paths = knownDependencies(record);
+        if (previous)
+        {
+            for (unsigned int i = 0; i < previous->dependencies.size(); i++)
+            {
+                if (find(paths.begin(), paths.end(), previous->dependencies[i].path) == paths.end()) paths.push_back(previous->dependencies[i].path);
+            }
+        }
+
+        record.dependencies.clear();
+        bool changed = !previous || previous->settings != record.settings;
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            CookDependency dependency;
+            if (!StampDependency(paths[i], dependency, previous))
+            {
+                changed = true;// A dependency that's gone changes the result too
+                continue;
+            }
+            record.dependencies.push_back(dependency);
+
+            const CookDependency *old = NULL;
+            for (unsigned int j = 0; previous && j < previous->dependencies.size(); j++)
+            {
+                if (previous->dependencies[j].path == dependency.path) old = &previous->dependencies[j];
+            }
+            if (!old || old->hash != dependency.hash) changed = true;
+        }
+        if (changed) return false;
+
+        // Also cook again if an output was deleted
+        for (unsigned int i = 0; i < previous->outputs.size(); i++)
+        {
+            int64_t mTime;
+            uint64_t size;
+            if (!GetFileInfo(previous->outputs[i], mTime, size)) return false;
+        }
+        record.outputs = previous->outputs;
+        return true;
+    }
+
+    // The runtime checks cooked meshes and textures against their source's modification time and size.
+    // If the source was saved without changing, point the cooked file at the new time instead of cooking it again.
+    static void restamp (const CookRecord &record, const CookRecord *previous)
+    {
+        vector<string> sources = knownDependencies(record);
+        for (unsigned int k = 0; k < sources.size(); k++) sources[k] = NormalizeAssetPath(sources[k]);
+
+        bool touched = false;
+        for (unsigned int i = 0; i < record.dependencies.size(); i++)
+        {
+            for (unsigned int j = 0; j < previous->dependencies.size(); j++)
+            {
+                const CookDependency &now = record.dependencies[i], &then = previous->dependencies[j];
+                if (now.path != then.path || find(sources.begin(), sources.end(), now.path) == sources.end()) continue;
+                touched = touched || now.mTime != then.mTime || now.size != then.size;
+            }
+        }
+        if (!touched) return;
+        if (record.kind == COOK_MODEL) RestampMeshCache(record.source, MODEL_IMPORT_FLAGS);
+        if (record.kind == COOK_TEXTURE) RestampTextureCache(record.source);
+    }
+
+    static bool cookModel (CookRecord &record)
+    {
+        vector<string> opened (1, record.source);
+        if (!Model::Cook(record.source, opened)) return false;
+        record.outputs.assign(1, MeshCachePath(record.source, MODEL_IMPORT_FLAGS));
+
+        // The dependencies are whatever Assimp read this time, like the .mtl next to an .obj.
+        // Check already stamped the ones it knew about.
+        vector<CookDependency> stamped = record.dependencies;
+        record.dependencies.clear();
+        for (unsigned int i = 0; i < opened.size(); i++)
+        {
+            CookDependency dependency;
+            dependency.path = NormalizeAssetPath(opened[i]);
+            bool known = false;
+            for (unsigned int j = 0; j < stamped.size() && !known; j++)
+            {
+                if (stamped[j].path == dependency.path)
+                {
+                    dependency = stamped[j];
+                    known = true;
+                }
+            }
+            if (known || HashFile(opened[i], dependency)) record.dependencies.push_back(dependency);
+        }
+        return !record.dependencies.empty();
+    }
+
+    // Decode a texture and make its mip chain, then hand its block rows to the workers. Sets job->cooked once it's written.
+    static void cookTexture (CookJob *job)
+    {
+        CookRecord &record = job->record;
+        string file = record.source.substr(record.source.find_last_of('/') + 1);
+        string type = IsPackedTexture(file) ? "texture_ORM" : TextureTypeFromName(file);
+        TextureFormat format = CookedFormatForType(type, file);
+
+        int width, height, components;
+        unsigned char *pixels = IsPackedTexture(file) ? LoadPackedTexture(record.source, &width, &height, &components, STBI_rgb_alpha)
+                                                      : LoadImageAsset(record.source, &width, &height, &components, STBI_rgb_alpha);
+        if (!pixels)
+        {
+            cout << "ERROR::COOKER:: Could not decode " << record.source << endl;
+            job->cooked = false;
+            return;
+        }
+
+        // Images that aren't maps of any kind stay RGBA, and get their mipmaps made on load
+        if (format == TEXTURE_FORMAT_RGBA8)
+        {
+            bool written = WriteTextureCache(record.source, format, width, height, 1, pixels);
+            stbi_image_free(pixels);
+            if (written) record.outputs.assign(1, TextureCachePath(record.source));
+            job->cooked = written && !record.dependencies.empty();
+            return;
+        }
+
+        TextureBands *bands = new TextureBands;
+        bands->job = job;
+        bands->format = format;
+        bands->width = width;
+        bands->height = height;
+        bands->levelCount = MipLevelCount(width, height);
+        bands->levels.resize(bands->levelCount);
+        bands->levels[0].assign(pixels, pixels + (size_t)width * height * 4);
+        stbi_image_free(pixels);
+        bool srgb = type == "texture_albedo" || type == "texture_SSColour";
+        for (int level = 1; level < bands->levelCount; level++)
+        {
+            int levelWidth = max(1, width >> level), levelHeight = max(1, height >> level);
+            bands->levels[level].resize((size_t)levelWidth * levelHeight * 4);
+            DownsampleImage(&bands->levels[level - 1][0], max(1, width >> (level - 1)), max(1, height >> (level - 1)), srgb, &bands->levels[level][0]);
+        }
+        bands->blocks.resize(TextureChainSize(format, width, height, bands->levelCount));
+
+        // Count the bands before submitting any, so none can finish early and think it's the last
+        int bandCount = 0;
+        for (int level = 0; level < bands->levelCount; level++)
+        {
+            int rows = (max(1, height >> level) + 3) / 4;
+            bandCount += (rows + COOK_BAND_ROWS - 1) / COOK_BAND_ROWS;
+        }
+        bands->remaining = bandCount;
+
+        size_t offset = 0;
+        for (int level = 0; level < bands->levelCount; level++)
+        {
+            int levelWidth = max(1, width >> level), levelHeight = max(1, height >> level);
+            int rows = (levelHeight + 3) / 4;
+            for (int first = 0; first < rows; first += COOK_BAND_ROWS)
+            {
+                int count = min(COOK_BAND_ROWS, rows - first);
+                WorkerPool().Submit([bands, level, levelWidth, levelHeight, first, count, offset]
+                {
+                    EncodeBlockRows(bands->format, &bands->levels[level][0], levelWidth, levelHeight, first, count, &bands->blocks[offset]);
+                    if (--bands->remaining == 0) finishTexture(bands);
+                });
+            }
+            offset += TextureLevelSize(format, levelWidth, levelHeight);
+        }
+    }
+
+    // Every band of a texture is encoded, so write it out
+    static void finishTexture (TextureBands *bands)
+    {
+        CookRecord &record = bands->job->record;
+        bool written = WriteTextureCache(record.source, bands->format, bands->width, bands->height, bands->levelCount, &bands->blocks[0]);
+        if (written) record.outputs.assign(1, TextureCachePath(record.source));
+        bands->job->cooked = written && !record.dependencies.empty();
+        delete bands;
+    }
+
+    // Render an environment's maps. The IBL code only makes the maps that aren't there, so the old ones are deleted first.
+    static bool cookEnvironment (CookRecord &record)
+    {
+        string directory = record.source.substr(0, record.source.find_last_of('/'));
+        string name = directory.substr(directory.find_last_of('/') + 1);
+        vector<string> old = generatedMaps(directory, name);
+        for (unsigned int i = 0; i < old.size(); i++) remove(old[i].c_str());
+
+        unsigned int envCubemap, irradianceMap, prefilterMap, brdfLUTTexture;
+        GetEnvAndIrrCubemap(envCubemap, irradianceMap, prefilterMap, brdfLUTTexture, name);
+        unsigned int textures[4] = { envCubemap, irradianceMap, prefilterMap, brdfLUTTexture };
+        glDeleteTextures(4, textures);
+
+        record.outputs = generatedMaps(directory, name);
+        cout << "Cooked environment " << name << ": " << record.outputs.size() << " maps" << endl;
+        return !record.outputs.empty();
+    }
+
+    // The name_*.hdr files the IBL code writes next to an environment
+    static vector<string> generatedMaps (string directory, string name)
+    {
+        vector<string> maps;
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL) return maps;
+        struct dirent *ent;
+        string prefix = name + "_";
+        while ((ent = readdir(dir)) != NULL)
+        {
+            string file = ent->d_name;
+            if (file.compare(0, prefix.size(), prefix) == 0 && file.size() > 4 && file.compare(file.size() - 4, 4, ".hdr") == 0) maps.push_back(directory + "/" + file);
+        }
+        closedir(dir);
+        return maps;
+    }
+
+    // Delete cooked meshes and textures no record claims, such as those of deleted sources
+    void pruneOutputs ()
+    {
+        vector<string> kept = Outputs();
+        DIR *dir = opendir(MESH_CACHE_DIRECTORY);
+        if (dir == NULL) return;
+        struct dirent *ent;
+        const char *cooked[] = { ".djmesh", ".djtex", NULL };
+        int removed = 0;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            string path = NormalizeAssetPath(string(MESH_CACHE_DIRECTORY) + ent->d_name);
+            if (!HasExtension(path, cooked) || find(kept.begin(), kept.end(), path) != kept.end()) continue;
+            if (remove(path.c_str()) == 0) removed++;
+        }
+        closedir(dir);
+        if (removed) cout << "Removed " << removed << " stale cooked files" << endl;
+    }
+};
+
+// Stamp path with its modification time, size and a hash of its contents
+bool HashFile (string path, CookDependency &dependency)
+{
+    dependency.path = NormalizeAssetPath(path);
+    if (!GetFileInfo(path, dependency.mTime, dependency.size)) return false;
+    if (dependency.size == 0)
+    {
+        dependency.hash = HashBytes(NULL, 0);
+        return true;
+    }
+    MappedFile file;
+    if (!file.Open(path)) return false;
+    dependency.hash = HashBytes(file.Data(), file.Size());
+    return true;
+}
+
+// Like HashFile, but reuses the hash from previous if the file's modification time and size haven't changed
+bool StampDependency (string path, CookDependency &dependency, const CookRecord *previous)
+{
+    path = NormalizeAssetPath(path);
+    for (unsigned int i = 0; previous && i < previous->dependencies.size(); i++)
+    {
+        const CookDependency &old = previous->dependencies[i];
+        if (old.path != path) continue;
+        if (!GetFileInfo(path, dependency.mTime, dependency.size)) return false;
+        if (dependency.mTime != old.mTime || dependency.size != old.size) break;
+        dependency = old;
+        return true;
+    }
+    return HashFile(path, dependency);
+}
+
+// Whether file ends in one of the NULL terminated extensions, ignoring case
+bool HasExtension (string file, const char **extensions)
+{
+    size_t dot = file.find_last_of('.');
+    if (dot == string::npos) return false;
+    string extension = file.substr(dot);
+    for (unsigned int i = 0; i < extension.size(); i++) extension[i] = tolower(extension[i]);
+    for (int i = 0; extensions[i]; i++)
+    {
+        if (extension == extensions[i]) return true;
+    }
+    return false;
+}
+
+// The block format a kind of map is cooked to. Anything that isn't a known kind of map stays RGBA.
+// Packed textures get the smallest format with the channels they use.
+TextureFormat CookedFormatForType (string type, string file)
+{
+    static const TextureFormat packedFormats[PACKED_CHANNEL_COUNT + 1] =
+    {
+        TEXTURE_FORMAT_BC4, TEXTURE_FORMAT_BC4, TEXTURE_FORMAT_BC5, TEXTURE_FORMAT_BC7, TEXTURE_FORMAT_BC7
+    };
+    if (type == "texture_albedo" || type == "texture_SSColour") return COOK_COLOUR_FORMAT;
+    if (type == "texture_ORM") return packedFormats[PackedChannelCount(file)];
+    if (type == "texture_normal") return TEXTURE_FORMAT_BC5;
+    if (type.empty()) return TEXTURE_FORMAT_RGBA8;
+    return TEXTURE_FORMAT_BC4;
+}
+
+// Walk directory for things to cook. Environments are resources/hdr/name/name.hdr, other .hdr files are what they make.
+void FindCookSources (string directory, vector<string> &models, vector<string> &textures, vector<string> &environments)
+{
+    static const char *modelExtensions[] = { ".obj", ".fbx", ".dae", ".3ds", ".blend", ".gltf", ".glb", ".ply", ".stl", NULL };
+    static const char *textureExtensions[] = { ".png", ".jpg", ".jpeg", ".tga", ".bmp", NULL };
+    if (NormalizeAssetPath(directory) == NormalizeAssetPath(MESH_CACHE_DIRECTORY) || directory.find("/shaders") != string::npos) return;
+
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        string file = ent->d_name;
+        if (file == "." || file == "..") continue;
+        string path = directory + "/" + file;
+        if (ent->d_type == DT_DIR)
+        {
+            FindCookSources(path, models, textures, environments);
+            continue;
+        }
+
+        // The IBL code only looks for environments in DIRECTORY
+        string folder = directory.substr(directory.find_last_of('/') + 1);
+        bool environment = NormalizeAssetPath(path) == NormalizeAssetPath(string(DIRECTORY) + folder + "/" + folder + ".hdr");
+        if (HasExtension(file, modelExtensions)) models.push_back(path);
+        else if (HasExtension(file, textureExtensions) && !IsPackedTextureType(TextureTypeFromName(file))) textures.push_back(path);
+        else if (environment) environments.push_back(path);
+    }
+    closedir(dir);
+
+    // The maps that are packed are cooked as the one texture the engine loads
+    string packed = Directories().Get(directory)->Find("texture_ORM");
+    if (!packed.empty()) textures.push_back(directory + "/" + packed);
+}
+
+#endif // COOKER_H_INCLUDED
@@ -0,0 +1,238 @@
+#ifndef CULLING_H_INCLUDED
+#define CULLING_H_INCLUDED
+
+/***********
+This header holds the culling of whole objects against the view frustum, before any of their
+meshes are looked at.
+
+A CullingSet keeps the world space bounds of everything in the scene as a structure of arrays:
+one array each for the x, y and z of the boxes' centres, the boxes' half sizes and the spheres'
+centres, and one for the radii. Cull tests eight objects at a time against each frustum plane,
+with one AVX register per value, or two SSE registers where there's no AVX. It writes the index
+of everything that might be in view into a list, in order, without branching on the result.
+
+That's still a test per object. The scene itself is culled with the BVH in bvh.h, which skips
+whole regions at once and so wins once there are more than a few thousand objects.
+
+Run with -benchmarkculling to time it against testing the objects one at a time.
+************/
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <stdlib.h>
+#include <math.h>
+#include <glm.hpp>
+#include <gtc/matrix_transform.hpp>
+#include "frustum.h"
+
+#if defined(__AVX__)
+#define CULL_AVX
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULL_SSE
+#include <xmmintrin.h>
+#endif
+
+#define CULL_BLOCK 8// Objects tested an iteration. The arrays are padded to a multiple of this.
+
+using namespace std;
+
+void BenchmarkCulling (unsigned int objectCount);
+
+class CullingSet
+{
+public:
+    CullingSet ()
+    {
+        count = 0;
+    }
+
+    // Add something with these world space bounds, returning its index
+    unsigned int Add (const Bounds &bounds)
+    {
+        if (count % CULL_BLOCK == 0)
+        {
+            for (int i = 0; i < FIELD_COUNT; i++) fields[i].resize(count + CULL_BLOCK, 0.0f);
+        }
+        Set(count, bounds);
+        return count++;
+    }
+
+    // Move something already added, like after it's been moved
+    void Set (unsigned int index, const Bounds &bounds)
+    {
+        glm::vec3 centre = (bounds.minimum + bounds.maximum) * 0.5f;
+        glm::vec3 extent = (bounds.maximum - bounds.minimum) * 0.5f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            fields[CENTRE_X + axis][index] = centre[axis];
+            fields[EXTENT_X + axis][index] = extent[axis];
+            fields[SPHERE_X + axis][index] = bounds.centre[axis];
+        }
+        fields[RADIUS][index] = bounds.radius;
+    }
+
+    unsigned int Size () const
+    {
+        return count;
+    }
+
+    void Clear ()
+    {
+        count = 0;
+        for (int i = 0; i < FIELD_COUNT; i++) fields[i].clear();
+    }
+
+    // Fill visible with the index of everything that might be inside frustum, lowest first
+    void Cull (const Frustum &frustum, vector<unsigned int> &visible) const
+    {
+        // Each block writes all eight of its indices, and moves the end of the list past the ones that passed
+        visible.resize(fields[0].size());
+        unsigned int visibleCount = 0;
+        for (unsigned int first = 0; first < count; first += CULL_BLOCK)
+        {
+            unsigned int mask = cullBlock(frustum, first);
+            if (count - first < CULL_BLOCK) mask &= (1u << (count - first)) - 1;// Padding
+            for (unsigned int lane = 0; lane < CULL_BLOCK; lane++)
+            {
+                visible[visibleCount] = first + lane;
+                visibleCount += (mask >> lane) & 1;
+            }
+        }
+        visible.resize(visibleCount);
+    }
+
+private:
+    enum Field
+    {
+        CENTRE_X, CENTRE_Y, CENTRE_Z,// Of the box
+        EXTENT_X, EXTENT_Y, EXTENT_Z,// Half the box's size
+        SPHERE_X, SPHERE_Y, SPHERE_Z,
+        RADIUS,
+        FIELD_COUNT
+    };
+
+    vector<float> fields[FIELD_COUNT];
+    unsigned int count;
+
+    // A bit for each of the block of objects starting at first, set if it might be inside frustum. Something is
+    // out when its box or its sphere is entirely behind any one plane.
+    unsigned int cullBlock (const Frustum &frustum, unsigned int first) const
+    {
+#if defined(CULL_AVX)
+        __m256 value[FIELD_COUNT];
+        for (int i = 0; i < FIELD_COUNT; i++) value[i] = _mm256_loadu_ps(&fields[i][first]);
+
+        __m256 zero = _mm256_setzero_ps(), outside = zero;
+        for (int i = 0; i < 6; i++)
+        {
+            const glm::vec4 &plane = frustum.planes[i];
+            __m256 x = _mm256_set1_ps(plane.x), y = _mm256_set1_ps(plane.y), z = _mm256_set1_ps(plane.z);
+            __m256 w = _mm256_set1_ps(plane.w);
+            __m256 box = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, value[CENTRE_X]), _mm256_mul_ps(y, value[CENTRE_Y])), _mm256_add_ps(_mm256_mul_ps(z, value[CENTRE_Z]), w));
+            __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), value[EXTENT_X]), _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.y)), value[EXTENT_Y])),
+                                         _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.z)), value[EXTENT_Z]));
+            __m256 sphere = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, value[SPHERE_X]), _mm256_mul_ps(y, value[SPHERE_Y])), _mm256_add_ps(_mm256_mul_ps(z, value[SPHERE_Z]), w));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(box, reach), zero, _CMP_LT_OQ));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(sphere, value[RADIUS]), zero, _CMP_LT_OQ));
+        }
+        return ~_mm256_movemask_ps(outside) & 0xFF;
+#elif defined(CULL_SSE)
+        unsigned int mask = 0;
+        for (unsigned int half = 0; half < CULL_BLOCK; half += 4)
+        {
+            __m128 value[FIELD_COUNT];
+            for (int i = 0; i < FIELD_COUNT; i++) value[i] = _mm_loadu_ps(&fields[i][first + half]);
+
+            __m128 zero = _mm_setzero_ps(), outside = zero;
+            for (int i = 0; i < 6; i++)
+            {
+                const glm::vec4 &plane = frustum.planes[i];
+                __m128 x = _mm_set1_ps(plane.x), y = _mm_set1_ps(plane.y), z = _mm_set1_ps(plane.z);
+                __m128 w = _mm_set1_ps(plane.w);
+                __m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, value[CENTRE_X]), _mm_mul_ps(y, value[CENTRE_Y])), _mm_add_ps(_mm_mul_ps(z, value[CENTRE_Z]), w));
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), value[EXTENT_X]), _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), value[EXTENT_Y])),
+                                          _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), value[EXTENT_Z]));
+                __m128 sphere = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, value[SPHERE_X]), _mm_mul_ps(y, value[SPHERE_Y])), _mm_add_ps(_mm_mul_ps(z, value[SPHERE_Z]), w));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(box, reach), zero));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(sphere, value[RADIUS]), zero));
+            }
+            mask |= (~_mm_movemask_ps(outside) & 0xF) << half;
+        }
+        return mask;
+#else
+        unsigned int mask = 0;
+        for (unsigned int lane = 0; lane < CULL_BLOCK; lane++)
+        {
+            unsigned int i = first + lane;
+            glm::vec3 centre(fields[CENTRE_X][i], fields[CENTRE_Y][i], fields[CENTRE_Z][i]);
+            glm::vec3 extent(fields[EXTENT_X][i], fields[EXTENT_Y][i], fields[EXTENT_Z][i]);
+            glm::vec3 sphere(fields[SPHERE_X][i], fields[SPHERE_Y][i], fields[SPHERE_Z][i]);
+            if (frustum.BoxVisible(centre, extent) && frustum.SphereVisible(sphere, fields[RADIUS][i])) mask |= 1u << lane;
+        }
+        return mask;
+#endif
+    }
+};
+
+// Prints how long culling objectCount made up objects takes, one at a time and with a CullingSet
+void BenchmarkCulling (unsigned int objectCount)
+{
+    typedef chrono::steady_clock Clock;
+    const int runs = 100;
+
+    // Boxes and spheres of every size scattered around a camera at the origin looking down -z
+    srand(1);
+    vector<Bounds> bounds (objectCount);
+    CullingSet set;
+    for (unsigned int i = 0; i < objectCount; i++)
+    {
+        glm::vec3 centre, extent;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            centre[axis] = (rand() / (float)RAND_MAX - 0.5f) * 1000.0f;
+            extent[axis] = 0.25f + rand() / (float)RAND_MAX * 2.5f;
+        }
+        bounds[i].minimum = centre - extent;
+        bounds[i].maximum = centre + extent;
+        bounds[i].centre = centre;
+        bounds[i].radius = glm::length(extent);
+        set.Add(bounds[i]);
+    }
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum (glm::perspective(45.0f, 16.0f / 9.0f, 0.1f, 1000.0f) * view);
+
+    vector<unsigned int> oneAtATime, together;
+    Clock::time_point start = Clock::now();
+    for (int run = 0; run < runs; run++)
+    {
+        oneAtATime.clear();
+        for (unsigned int i = 0; i < objectCount; i++)
+        {
+            if (frustum.BoundsVisible(bounds[i])) oneAtATime.push_back(i);
+        }
+    }
+    double scalarTime = chrono::duration<double, milli>(Clock::now() - start).count() / runs;
+
+    start = Clock::now();
+    for (int run = 0; run < runs; run++) set.Cull(frustum, together);
+    double setTime = chrono::duration<double, milli>(Clock::now() - start).count() / runs;
+
+#if defined(CULL_AVX)
+    const char *path = "AVX";
+#elif defined(CULL_SSE)
+    const char *path = "SSE";
+#else
+    const char *path = "scalar";
+#endif
+    cout << "Culling " << objectCount << " objects, " << together.size() << " visible:" << endl;
+    cout << "    One at a time: " << scalarTime << " ms" << endl;
+    cout << "    CullingSet (" << path << "): " << setTime << " ms, " << scalarTime / setTime << "x faster" << endl;
+    if (together != oneAtATime)
+    {
+        cout << "    " << (int)oneAtATime.size() - (int)together.size() << " objects culled differently, on the edge of a plane" << endl;
+    }
+}
+
+#endif // CULLING_H_INCLUDED
@@ -0,0 +1,135 @@
+#ifndef DEFERRED_H_INCLUDED
+#define DEFERRED_H_INCLUDED
+
+/***********
+This header holds the G-buffer for deferred shading, the other way of drawing the scene.
+
+In forward shading (the default) every fragment of every mesh is fully lit, even the ones
+drawn over later. In deferred shading (run with -deferred) the meshes only write what their
+surface is like into the G-buffer, with gbuffer.frag, and then one full screen pass,
+deferred.frag, lights each pixel once. The cost of lighting then goes with the number of
+pixels, not with how many surfaces are stacked up behind them.
+
+The G-buffer is kept small, 16 bytes a pixel:
+
+    gAlbedo    RGBA8   albedo as the texture stores it (gamma 2.2), ambient occlusion
+    gNormal    RG16    world space normal, folded onto an octahedron so it fits in two channels
+    gMaterial  RGBA8   metallic, roughness, specular
+    gDepth     24 bit  depth, which the lighting pass rebuilds the position from
+
+The lighting pass writes the depth back out, so the skybox and anything else drawn after it
+depth test against the scene as usual.
+************/
+
+#include <iostream>
+#include <glew.h>
+#include "shader.h"
+
+#define GBUFFER_UNIT 13// The G-buffer textures are bound to this texture unit and the three after it
+
+using namespace std;
+
+class GBuffer
+{
+public:
+    GBuffer ()
+    {
+        framebuffer = 0;
+        emptyVertexArray = 0;
+        width = height = 0;
+        for (int i = 0; i < 4; i++) textures[i] = 0;
+    }
+
+    // Point a lighting shader's G-buffer samplers at their texture units. Call once per lighting shader.
+    void SetUniforms (Shader &shader)
+    {
+        shader.Use();
+        shader.SetInt(UNIFORM("gAlbedo"), GBUFFER_UNIT);
+        shader.SetInt(UNIFORM("gNormal"), GBUFFER_UNIT + 1);
+        shader.SetInt(UNIFORM("gMaterial"), GBUFFER_UNIT + 2);
+        shader.SetInt(UNIFORM("gDepth"), GBUFFER_UNIT + 3);
+    }
+
+    // Start the geometry pass: draw into the G-buffer, made or resized to width by height if it has to be
+    void BeginGeometry (int width, int height)
+    {
+        if (width != this->width || height != this->height) create(width, height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_BLEND);// Alpha holds occlusion here, not coverage
+    }
+
+    // Finish the geometry pass and go back to drawing to the screen
+    void EndGeometry ()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glEnable(GL_BLEND);
+    }
+
+    // Light every pixel of the G-buffer with shader (deferred.frag), into the framebuffer that's bound
+    void Light (Shader &shader)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + GBUFFER_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        // The lighting pass writes the G-buffer's depth, which has to land whatever's in the depth buffer already
+        shader.Use();
+        glDepthFunc(GL_ALWAYS);
+        glBindVertexArray(emptyVertexArray);// Core profile won't draw without one, even though deferred.vs reads no attributes
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+    }
+
+private:
+    GLuint framebuffer;
+    GLuint textures[4];// Albedo, normal, material, depth
+    GLuint emptyVertexArray;
+    int width, height;
+
+    void create (int width, int height)
+    {
+        static const GLint internalFormats[4] = { GL_RGBA8, GL_RG16, GL_RGBA8, GL_DEPTH_COMPONENT24 };
+        static const GLenum formats[4] = { GL_RGBA, GL_RG, GL_RGBA, GL_DEPTH_COMPONENT };
+        static const GLenum types[4] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_BYTE, GL_UNSIGNED_INT };
+
+        this->width = width;
+        this->height = height;
+        if (!framebuffer)
+        {
+            glGenFramebuffers(1, &framebuffer);
+            glGenTextures(4, textures);
+            glGenVertexArrays(1, &emptyVertexArray);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        for (int i = 0; i < 4; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, i < 3 ? GL_COLOR_ATTACHMENT0 + i : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[i], 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            cout << "ERROR::DEFERRED:: G-buffer of " << width << "x" << height << " is incomplete" << endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif // DEFERRED_H_INCLUDED
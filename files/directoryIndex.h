@@ -0,0 +1,141 @@
+#ifndef DIRECTORYINDEX_H_INCLUDED
+#define DIRECTORYINDEX_H_INCLUDED
+
+/***********
+This header finds the textures that sit next to a model.
+
+Textures are found by name: a file in a model's directory called T_AL_Something.png is its
+albedo map, T_NO_Something.png its normal map, and so on (see textureSemantics below).
+Meshes bind the first file of each type, looked up by type rather than by going through the
+file names again. The occlusion, roughness, metallic and specular maps aren't bound on their own. They're packed
+into one texture_ORM texture instead (see texturePacking.h).
+
+Each directory is listed once, the first time any mesh asks about it, and the result is kept
+in memory. Nothing is written into the asset directories. Listings are handed out as shared
+pointers, so one that's being read stays alive if the directory is invalidated meanwhile.
+************/
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include "dirent.h"
+#include "mesh.h"
+#include "assetPack.h"
+#include "texturePacking.h"
+
+using namespace std;
+
+// Every texture found in one directory
+struct DirectoryTextures
+{
+    map<string, string> bySemantic;// Texture type (texture_albedo, texture_normal...) to the first file of that type
+
+    // The file for a texture type, or an empty string if the directory doesn't have one
+    string Find (string type) const
+    {
+        map<string, string>::const_iterator it = bySemantic.find(type);
+        return it == bySemantic.end() ? string() : it->second;
+    }
+};
+
+string TextureTypeFromName (string file);
+
+class DirectoryIndex
+{
+public:
+    // The textures in directory, listing it if this is the first time it's been asked for. Safe to call from worker threads.
+    shared_ptr<const DirectoryTextures> Get (string directory)
+    {
+        lock_guard<mutex> lock (indexMutex);
+        map<string, shared_ptr<const DirectoryTextures> >::iterator it = directories.find(directory);
+        if (it != directories.end()) return it->second;
+
+        shared_ptr<DirectoryTextures> entry = make_shared<DirectoryTextures>();
+        scan(directory, *entry);
+        directories[directory] = entry;
+        return entry;
+    }
+
+    // Forget what's in directory, so the next Get lists it again. Call it if files are added while running.
+    void Invalidate (string directory)
+    {
+        lock_guard<mutex> lock (indexMutex);
+        directories.erase(directory);
+    }
+
+private:
+    map<string, shared_ptr<const DirectoryTextures> > directories;
+    mutex indexMutex;
+
+    void scan (string directory, DirectoryTextures &entry)
+    {
+        // A directory that's in an asset pack is listed from the pack, without touching the disk
+        vector<string> files = Packs().List(directory);
+        if (files.empty())
+        {
+            DIR *dir = opendir(directory.c_str());
+            if (dir == NULL)
+            {
+                cout << "ERROR::DIRECTORYINDEX:: Could not open " << directory << endl;
+                return;
+            }
+            struct dirent *ent;
+            while ((ent = readdir(dir)) != NULL) files.push_back(ent->d_name);
+            closedir(dir);
+        }
+
+        for (unsigned int i = 0; i < files.size(); i++)
+        {
+            // Files with a texture prefix we don't know aren't loaded
+            string type = TextureTypeFromName(files[i]);
+            if (type.empty()) continue;
+            if (entry.bySemantic.find(type) == entry.bySemantic.end()) entry.bySemantic[type] = files[i];
+        }
+
+        // The first map of each packed kind goes in its channel
+        string packed[PACKED_CHANNEL_COUNT];
+        bool anyPacked = false;
+        for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+        {
+            packed[i] = entry.Find(PackedChannelType(i));
+            anyPacked = anyPacked || !packed[i].empty();
+        }
+        if (anyPacked) entry.bySemantic["texture_ORM"] = PackedTextureName(packed);
+    }
+};
+
+// The texture type a file's name marks it as, like texture_albedo for T_AL_Brick.png. Empty if it isn't a texture.
+string TextureTypeFromName (string file)
+{
+    static const char *textureSemantics[][2] =
+    {
+        { "T_AL_", "texture_albedo" },
+        { "T_SP_", "texture_specular" },
+        { "T_NO_", "texture_normal" },
+        { "T_ME_", "texture_metallic" },
+        { "T_RO_", "texture_roughness" },
+        { "T_OP_", "texture_opacity" },
+        { "T_AO_", "texture_AO" },
+        { "T_SC_", "texture_SSColour" },
+        { "T_SS_", "texture_SSS" }
+    };
+
+    if (file.compare(0, 2, "T_") != 0) return string();
+    for (unsigned int i = 0; i < sizeof(textureSemantics) / sizeof(textureSemantics[0]); i++)
+    {
+        if (file.compare(0, 5, textureSemantics[i][0]) == 0) return textureSemantics[i][1];
+    }
+    return string();
+}
+
+// The index shared by the whole engine
+DirectoryIndex & Directories ()
+{
+    static DirectoryIndex index;
+    return index;
+}
+
+#endif // DIRECTORYINDEX_H_INCLUDED
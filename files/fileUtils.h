@@ -0,0 +1,161 @@
+#ifndef FILEUTILS_H_INCLUDED
+#define FILEUTILS_H_INCLUDED
+
+/***********
+This header holds small platform wrappers for the file system: memory mapping a
+file read-only, reading a file's modification time and making directories.
+************/
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+bool GetFileInfo (string path, int64_t &mTime, uint64_t &size);
+bool MakeDirectory (string path);
+
+/********************
+MappedFile: A read-only view of a whole file in memory.
+The operating system pages the file in on demand, so nothing is copied until it's touched.
+*********************/
+class MappedFile
+{
+public:
+    MappedFile ()
+    {
+        data = NULL;
+        size = 0;
+#ifdef _WIN32
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = NULL;
+#endif
+    }
+
+    ~MappedFile ()
+    {
+        Close();
+    }
+
+    // Map the file at path. Returns false if the file can't be opened or is empty.
+    bool Open (string path)
+    {
+        Close();
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mappingHandle == NULL)
+        {
+            Close();
+            return false;
+        }
+        data = (const char *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+
+        void *view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);// The mapping keeps its own reference to the file
+        data = (view == MAP_FAILED) ? NULL : (const char *)view;
+#endif
+        if (data == NULL)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close ()
+    {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mappingHandle) CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+        mappingHandle = NULL;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void *)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const char * Data () const
+    {
+        return data;
+    }
+
+    size_t Size () const
+    {
+        return size;
+    }
+
+private:
+    const char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE fileHandle;
+    HANDLE mappingHandle;
+#endif
+
+    // A mapping can't be shared between two owners
+    MappedFile (const MappedFile &);
+    MappedFile & operator= (const MappedFile &);
+};
+
+// Get the modification time and size of a file. Returns false if the file doesn't exist.
+bool GetFileInfo (string path, int64_t &mTime, uint64_t &size)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+    mTime = (int64_t)info.st_mtime;
+    size = (uint64_t)info.st_size;
+    return true;
+}
+
+// Make a directory if it doesn't already exist
+bool MakeDirectory (string path)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) return true;
+#ifdef _WIN32
+    return _mkdir(path.c_str()) == 0;
+#else
+    return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+#endif // FILEUTILS_H_INCLUDED
@@ -0,0 +1,159 @@
+#ifndef FRUSTUM_H_INCLUDED
+#define FRUSTUM_H_INCLUDED
+
+/***********
+This header holds what the renderer knows about the view it's drawing this frame.
+
+FrameView is built once a frame from the camera and projection, and passed down to
+whatever needs to decide what to draw: the view frustum's planes for culling, where the
+camera is, and how many pixels a unit at distance 1 covers for picking levels of detail.
+
+Bounds are what the frustum gets tested against: a box and a sphere around the same thing.
+Neither is always tighter (a sphere fits a rock better, a box fits a floor), so anything
+outside either one is out of view.
+************/
+
+#include <glew.h>
+#include <glm.hpp>
+#include "camera.h"
+
+using namespace std;
+
+/********************
+Bounds: An axis aligned box and a bounding sphere around the same thing.
+*********************/
+struct Bounds
+{
+    glm::vec3 minimum = glm::vec3(0.0f);
+    glm::vec3 maximum = glm::vec3(0.0f);
+    glm::vec3 centre = glm::vec3(0.0f);// Of the sphere, which needn't be the middle of the box
+    float radius = 0.0f;
+};
+
+Bounds TransformBounds (const Bounds &bounds, const glm::mat4 &transform);
+Bounds MergeBounds (const Bounds &a, const Bounds &b);
+
+/********************
+Frustum: The six planes of a view frustum, pointing inwards, pulled out of a view-projection matrix.
+*********************/
+struct Frustum
+{
+    glm::vec4 planes[6];// Left, right, bottom, top, near, far. xyz is a unit normal, w the distance.
+
+    Frustum ()
+    {
+    }
+
+    explicit Frustum (glm::mat4 viewProjection)
+    {
+        // Gribb and Hartmann: each plane is the last row of the matrix plus or minus one of the others
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+        {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            planes[i * 2] = rows[3] + rows[i];
+            planes[i * 2 + 1] = rows[3] - rows[i];
+        }
+        for (int i = 0; i < 6; i++)
+        {
+            float length = glm::length(glm::vec3(planes[i]));
+            if (length > 0.0f) planes[i] = planes[i] / length;
+        }
+    }
+
+    // Whether any part of the sphere might be inside
+    bool SphereVisible (glm::vec3 centre, float radius) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            if (glm::dot(glm::vec3(planes[i]), centre) + planes[i].w < -radius) return false;
+        }
+        return true;
+    }
+
+    // Whether any part of the box with this centre and half size might be inside
+    bool BoxVisible (glm::vec3 centre, glm::vec3 extent) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            glm::vec3 normal = glm::vec3(planes[i]);
+            if (glm::dot(normal, centre) + planes[i].w < -glm::dot(glm::abs(normal), extent)) return false;
+        }
+        return true;
+    }
+
+    // Whether bounds might be inside: they're out if either the box or the sphere is
+    bool BoundsVisible (const Bounds &bounds) const
+    {
+        return SphereVisible(bounds.centre, bounds.radius) && BoxVisible((bounds.minimum + bounds.maximum) * 0.5f, (bounds.maximum - bounds.minimum) * 0.5f);
+    }
+};
+
+struct FrameView
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 position;// Of the camera
+    float pixelsPerUnit;// Screen size in pixels of something 1 unit across, 1 unit from the camera
+    Frustum frustum;
+};
+
+// Everything about this frame's view, for a perspective projection and a viewport viewportHeight pixels high
+FrameView MakeFrameView (Camera &camera, glm::mat4 view, glm::mat4 projection, float viewportHeight)
+{
+    FrameView frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.position = camera.GetPosition();
+    frame.pixelsPerUnit = viewportHeight * projection[1][1] * 0.5f;// projection[1][1] is 1 / tan(half the vertical field of view)
+    frame.frustum = Frustum(projection * view);
+    return frame;
+}
+
+// Move bounds by transform. The box grows to hold the transformed box, and the sphere by the biggest scale.
+Bounds TransformBounds (const Bounds &bounds, const glm::mat4 &transform)
+{
+    glm::vec3 centre = (bounds.minimum + bounds.maximum) * 0.5f;
+    glm::vec3 extent = (bounds.maximum - bounds.minimum) * 0.5f;
+    glm::vec3 newCentre = glm::vec3(transform * glm::vec4(centre, 1.0f));
+    glm::vec3 newExtent = glm::abs(glm::vec3(transform[0])) * extent.x + glm::abs(glm::vec3(transform[1])) * extent.y + glm::abs(glm::vec3(transform[2])) * extent.z;
+
+    float scale = max(glm::length(glm::vec3(transform[0])), max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+    Bounds moved;
+    moved.minimum = newCentre - newExtent;
+    moved.maximum = newCentre + newExtent;
+    moved.centre = glm::vec3(transform * glm::vec4(bounds.centre, 1.0f));
+    moved.radius = bounds.radius * scale;
+    return moved;
+}
+
+// The smallest box around both boxes, and the smallest sphere around both spheres
+Bounds MergeBounds (const Bounds &a, const Bounds &b)
+{
+    Bounds merged;
+    merged.minimum = glm::min(a.minimum, b.minimum);
+    merged.maximum = glm::max(a.maximum, b.maximum);
+
+    float distance = glm::length(b.centre - a.centre);
+    if (distance + b.radius <= a.radius)
+    {
+        merged.centre = a.centre;
+        merged.radius = a.radius;
+    }
+    else if (distance + a.radius <= b.radius)
+    {
+        merged.centre = b.centre;
+        merged.radius = b.radius;
+    }
+    else
+    {
+        merged.radius = (distance + a.radius + b.radius) * 0.5f;
+        merged.centre = a.centre + (b.centre - a.centre) * ((merged.radius - a.radius) / distance);
+    }
+    return merged;
+}
+
+#endif // FRUSTUM_H_INCLUDED
@@ -0,0 +1,356 @@
+#ifndef GEOMETRYPOOL_H_INCLUDED
+#define GEOMETRYPOOL_H_INCLUDED
+
+/***********
+This header holds the geometry pool, which all static meshes keep their vertices and indices in.
+
+Instead of a VAO, VBO and EBO each, meshes get a slice of one big vertex buffer per vertex
+format and of one big index buffer shared by every format. There's one VAO per vertex
+format, so drawing any number of meshes of the same format needs one VAO bind, and each
+mesh draws with glDrawElementsBaseVertex to find its own vertices.
+
+Slices are handed out by a first-fit free list, and given back when a mesh is deleted, so
+loading and unloading models doesn't create and destroy GL objects. When a buffer is full
+it's replaced by one twice the size and the old contents are copied over on the GPU, so
+slices already handed out stay where they are.
+
+Model matrices come from a stream of per-instance attributes rather than a uniform, so any
+number of copies of a mesh can be drawn with one glDrawElementsInstancedBaseVertex. Each
+frame's matrices are written to the instance buffer in one go (see UploadInstances), and
+every VAO reads them from wherever BindInstances last pointed it. A single draw outside the
+render queue skips the buffer and gives its matrix as a constant attribute (see SetInstance).
+************/
+
+#include <map>
+#include <iostream>
+#include <glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+#include "vertexFormat.h"
+
+using namespace std;
+
+#define GEOMETRY_VERTEX_CAPACITY (16 * 1024 * 1024)// Starting size of each vertex buffer, in bytes
+#define GEOMETRY_INDEX_CAPACITY (8 * 1024 * 1024)// Starting size of the index buffer, in bytes
+#define GEOMETRY_INSTANCE_CAPACITY (64 * 1024)// Starting size of the instance buffer, in bytes (a thousand matrices)
+#define GEOMETRY_FORMAT_COUNT 3// How many VertexFormat's there are
+
+// Where a mesh's data lives in the pool
+struct GeometryAllocation
+{
+    VertexFormat format = VERTEX_FORMAT_FULL;
+    size_t vertexOffset = 0;// In bytes
+    size_t vertexSize = 0;
+    size_t indexOffset = 0;
+    size_t indexSize = 0;
+    GLint baseVertex = 0;// vertexOffset in vertices, for glDrawElementsBaseVertex
+    bool valid = false;
+};
+
+/********************
+BufferAllocator: A first-fit free list over a range of bytes. Doesn't touch OpenGL, it only does the bookkeeping.
+*********************/
+class BufferAllocator
+{
+public:
+    BufferAllocator ()
+    {
+        capacity = 0;
+    }
+
+    // Start managing capacity bytes, all free
+    void Reset (size_t capacity)
+    {
+        this->capacity = capacity;
+        freeBlocks.clear();
+        if (capacity) freeBlocks[0] = capacity;
+    }
+
+    // Make the range longer. The new bytes at the end are free.
+    void Grow (size_t newCapacity)
+    {
+        if (newCapacity <= capacity) return;
+        Free(capacity, newCapacity - capacity);
+        capacity = newCapacity;
+    }
+
+    // Find size bytes starting at a multiple of alignment. Returns false if there's no room.
+    bool Allocate (size_t size, size_t alignment, size_t &offset)
+    {
+        for (map<size_t, size_t>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+        {
+            size_t start = (it->first + alignment - 1) / alignment * alignment;
+            size_t blockEnd = it->first + it->second;
+            if (start + size > blockEnd) continue;
+
+            // Split the block into what's before the allocation, and what's after
+            size_t blockStart = it->first;
+            freeBlocks.erase(it);
+            if (start > blockStart) freeBlocks[blockStart] = start - blockStart;
+            if (blockEnd > start + size) freeBlocks[start + size] = blockEnd - (start + size);
+            offset = start;
+            return true;
+        }
+        return false;
+    }
+
+    // Give back a range, merging it with free neighbours
+    void Free (size_t offset, size_t size)
+    {
+        if (size == 0) return;
+        map<size_t, size_t>::iterator next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.begin())
+        {
+            map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                size += previous->second;
+                freeBlocks.erase(previous);
+            }
+        }
+        if (next != freeBlocks.end() && offset + size == next->first)
+        {
+            size += next->second;
+            freeBlocks.erase(next);
+        }
+        freeBlocks[offset] = size;
+    }
+
+    size_t Capacity ()
+    {
+        return capacity;
+    }
+
+    // Bytes not handed out
+    size_t FreeBytes ()
+    {
+        size_t total = 0;
+        for (map<size_t, size_t>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); ++it) total += it->second;
+        return total;
+    }
+
+private:
+    size_t capacity;
+    map<size_t, size_t> freeBlocks;// Offset to size
+};
+
+class GeometryPool
+{
+public:
+    GeometryPool ()
+    {
+        indexBuffer = 0;
+        instanceBuffer = 0;
+        instanceCapacity = 0;
+        for (int i = 0; i < GEOMETRY_FORMAT_COUNT; i++)
+        {
+            vertexArrays[i] = 0;
+            vertexBuffers[i] = 0;
+        }
+    }
+
+    // Copy a mesh's vertices and indices into the pool. Must be called on the GL thread.
+    GeometryAllocation Allocate (VertexFormat format, const GLvoid *vertices, GLuint vertexCount, const GLvoid *indices, GLenum indexType, GLuint indexCount)
+    {
+        GeometryAllocation allocation;
+        allocation.format = format;
+        allocation.vertexSize = (size_t)vertexCount * VertexStride(format);
+        allocation.indexSize = (size_t)indexCount * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+
+        createFormat(format);
+        // Vertices start on a whole vertex so the base vertex comes out exact. Indices are kept 4 byte aligned.
+        if (!allocate(vertexAllocators[format], vertexBuffers[format], GL_ARRAY_BUFFER, allocation.vertexSize, VertexStride(format), allocation.vertexOffset))
+        {
+            cout << "ERROR::GEOMETRYPOOL:: Out of memory for a mesh of " << vertexCount << " vertices" << endl;
+            return GeometryAllocation();
+        }
+        if (!allocate(indexAllocator, indexBuffer, GL_ELEMENT_ARRAY_BUFFER, allocation.indexSize, sizeof(GLuint), allocation.indexOffset))
+        {
+            // Only the vertices were handed out, so only they go back
+            cout << "ERROR::GEOMETRYPOOL:: Out of memory for a mesh of " << indexCount << " indices" << endl;
+            vertexAllocators[format].Free(allocation.vertexOffset, allocation.vertexSize);
+            return GeometryAllocation();
+        }
+
+        allocation.baseVertex = allocation.vertexOffset / VertexStride(format);
+        allocation.valid = true;
+
+        glBindVertexArray(0);// So the index buffer binding below doesn't end up in whatever VAO is bound
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[format]);
+        glBufferSubData(GL_ARRAY_BUFFER, allocation.vertexOffset, allocation.vertexSize, vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, allocation.indexOffset, allocation.indexSize, indices);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        return allocation;
+    }
+
+    // Give a mesh's slices back to the pool
+    void Free (GeometryAllocation &allocation)
+    {
+        if (allocation.vertexSize) vertexAllocators[allocation.format].Free(allocation.vertexOffset, allocation.vertexSize);
+        if (allocation.indexSize) indexAllocator.Free(allocation.indexOffset, allocation.indexSize);
+        allocation = GeometryAllocation();
+    }
+
+    // Bind the VAO every mesh of format draws with
+    void Bind (VertexFormat format)
+    {
+        createFormat(format);
+        glBindVertexArray(vertexArrays[format]);
+    }
+
+    // Replace the instance buffer's model matrices with count new ones. The old contents are orphaned, so draws
+    // still reading them don't hold this up.
+    void UploadInstances (const glm::mat4 *transforms, size_t count)
+    {
+        size_t size = count * sizeof(glm::mat4);
+        if (size == 0) return;
+
+        createInstanceBuffer();
+        while (instanceCapacity < size) instanceCapacity *= 2;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, transforms);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Make instance 0 of the next draw the uploaded matrix first. The VAO being drawn with has to be bound.
+    void BindInstances (GLuint first)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        SetInstanceAttributes((GLintptr)first * sizeof(glm::mat4));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draw the bound VAO's next draw with transform as its only model matrix. It's set as a constant attribute value,
+    // so nothing is uploaded. BindInstances switches the VAO back to reading the instance buffer.
+    void SetInstance (const glm::mat4 &transform)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            glDisableVertexAttribArray(INSTANCE_ATTRIBUTE + column);
+            glVertexAttrib4fv(INSTANCE_ATTRIBUTE + column, glm::value_ptr(transform) + column * 4);
+        }
+    }
+
+    // Print how full the buffers are
+    void PrintStats ()
+    {
+        cout << "Geometry pool:" << endl;
+        for (int i = 0; i < GEOMETRY_FORMAT_COUNT; i++)
+        {
+            if (!vertexArrays[i]) continue;
+            BufferAllocator &allocator = vertexAllocators[i];
+            cout << "    Vertex format " << i << ": " << (allocator.Capacity() - allocator.FreeBytes()) / 1024 << " of " << allocator.Capacity() / 1024 << " KB used" << endl;
+        }
+        cout << "    Indices: " << (indexAllocator.Capacity() - indexAllocator.FreeBytes()) / 1024 << " of " << indexAllocator.Capacity() / 1024 << " KB used" << endl;
+    }
+
+private:
+    GLuint vertexArrays[GEOMETRY_FORMAT_COUNT];
+    GLuint vertexBuffers[GEOMETRY_FORMAT_COUNT];
+    BufferAllocator vertexAllocators[GEOMETRY_FORMAT_COUNT];
+    GLuint indexBuffer;
+    BufferAllocator indexAllocator;
+    GLuint instanceBuffer;
+    size_t instanceCapacity;// In bytes
+
+    // Make the buffers and VAO for format the first time it's used
+    void createFormat (VertexFormat format)
+    {
+        if (vertexArrays[format]) return;
+
+        if (!indexBuffer)
+        {
+            indexBuffer = makeBuffer(GL_ELEMENT_ARRAY_BUFFER, GEOMETRY_INDEX_CAPACITY);
+            indexAllocator.Reset(GEOMETRY_INDEX_CAPACITY);
+        }
+        createInstanceBuffer();
+        vertexBuffers[format] = makeBuffer(GL_ARRAY_BUFFER, GEOMETRY_VERTEX_CAPACITY);
+        vertexAllocators[format].Reset(GEOMETRY_VERTEX_CAPACITY);
+        glGenVertexArrays(1, &vertexArrays[format]);
+        setupVertexArray(format);
+    }
+
+    void setupVertexArray (VertexFormat format)
+    {
+        glBindVertexArray(vertexArrays[format]);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[format]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        SetVertexAttributes(format);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        SetInstanceAttributes(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void createInstanceBuffer ()
+    {
+        if (instanceBuffer) return;
+        instanceCapacity = GEOMETRY_INSTANCE_CAPACITY;
+        instanceBuffer = makeBuffer(GL_ARRAY_BUFFER, instanceCapacity);
+    }
+
+    GLuint makeBuffer (GLenum target, size_t size)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindVertexArray(0);
+        glBindBuffer(target, buffer);
+        glBufferData(target, size, NULL, GL_STATIC_DRAW);
+        glBindBuffer(target, 0);
+        return buffer;
+    }
+
+    // Allocate from allocator, growing buffer until there's room
+    bool allocate (BufferAllocator &allocator, GLuint &buffer, GLenum target, size_t size, size_t alignment, size_t &offset)
+    {
+        while (!allocator.Allocate(size, alignment, offset))
+        {
+            size_t newCapacity = allocator.Capacity() * 2;
+            while (newCapacity < size + alignment) newCapacity *= 2;
+            if (!grow(buffer, target, allocator.Capacity(), newCapacity)) return false;
+            allocator.Grow(newCapacity);
+        }
+        return true;
+    }
+
+    // Swap buffer for a bigger one with the same contents, and point the VAOs at it
+    bool grow (GLuint &buffer, GLenum target, size_t oldCapacity, size_t newCapacity)
+    {
+        // Clear out errors from before, so the check below only sees what glBufferData did
+        while (glGetError() != GL_NO_ERROR) {}
+        GLuint bigger = makeBuffer(target, newCapacity);
+        if (glGetError() == GL_OUT_OF_MEMORY)
+        {
+            glDeleteBuffers(1, &bigger);
+            return false;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldCapacity);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = bigger;
+
+        for (int i = 0; i < GEOMETRY_FORMAT_COUNT; i++)
+        {
+            if (vertexArrays[i]) setupVertexArray((VertexFormat)i);
+        }
+        return true;
+    }
+};
+
+// The pool shared by the whole engine. Only use it from the GL thread.
+GeometryPool & Geometry ()
+{
+    static GeometryPool pool;
+    return pool;
+}
+
+#endif // GEOMETRYPOOL_H_INCLUDED
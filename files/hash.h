@@ -0,0 +1,55 @@
+#ifndef HASH_H_INCLUDED
+#define HASH_H_INCLUDED
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+constexpr uint64_t HashName (const char *name, uint64_t seed = FNV_OFFSET_BASIS);
+uint64_t HashBytes (const void *data, size_t length, uint64_t seed = FNV_OFFSET_BASIS);
+uint64_t HashString (string str, uint64_t seed = FNV_OFFSET_BASIS);
+string HashToHex (uint64_t hash);
+
+// 64 bit FNV-1a. Fast and good enough for cache keys, pass the previous hash as the seed to chain several values
+uint64_t HashBytes (const void *data, size_t length, uint64_t seed)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// HashString for a string literal, worked out by the compiler when it's used as a constant (see UNIFORM in shader.h)
+constexpr uint64_t HashName (const char *name, uint64_t seed)
+{
+    return *name ? HashName(name + 1, (seed ^ (unsigned char)*name) * FNV_PRIME) : seed;
+}
+
+uint64_t HashString (string str, uint64_t seed)
+{
+    return HashBytes(str.c_str(), str.size(), seed);
+}
+
+// Turn a hash into 16 hex digits so it can be used as a file name
+string HashToHex (uint64_t hash)
+{
+    const char *digits = "0123456789abcdef";
+    string hex (16, '0');
+    for (int i = 15; i >= 0; i--)
+    {
+        hex[i] = digits[hash & 0xF];
+        hash >>= 4;
+    }
+    return hex;
+}
+
+#endif // HASH_H_INCLUDED
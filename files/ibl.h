@@ -8,6 +8,8 @@
 #include <gtc/type_ptr.hpp>
 #include <stdio.h>
 #include "stb_image.h"
+#include "assetPack.h"
+#include "shader.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -48,7 +50,7 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
     // ---------------------------------
     stbi_set_flip_vertically_on_load(true);
     int width, height, nrComponents;
-    float *data = stbi_loadf(pathToHDR.c_str(), &width, &height, &nrComponents, 0);
+    float *data = LoadHDRAsset(pathToHDR, &width, &height, &nrComponents, 0);
     stbi_flip_vertically_on_write(true);
 
     unsigned int hdrTexture;
@@ -99,14 +101,19 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
         glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
     };
 
+    // The capture shaders see the camera through the Frame block, like everything else. Only the view changes between faces.
+    UniformBuffer captureBlock (FRAME_BLOCK_BINDING, sizeof(FrameUniforms));
+    FrameUniforms capture;
+    capture.projection = captureProjection;
+    capture.viewPos = glm::vec3(0.0f);
+
     if (!skip)
     {
         // pbr: convert HDR equirectangular environment map to cubemap equivalent
         // ----------------------------------------------------------------------
 
         equirectangularToCubemapShader.Use();
-        glUniform1i (glGetUniformLocation(equirectangularToCubemapShader.Program, "equirectangularMap"), 0);
-        glUniformMatrix4fv (glGetUniformLocation(equirectangularToCubemapShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+        equirectangularToCubemapShader.SetInt(UNIFORM("equirectangularMap"), 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, hdrTexture);
 
@@ -117,7 +124,8 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
         // glReadBuffer(GL_COLOR_ATTACHMENT0);
         for (unsigned int i = 0; i < 6; i++)
         {
-            glUniformMatrix4fv (glGetUniformLocation(equirectangularToCubemapShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
+            capture.view = captureViews[i];
+            captureBlock.Update(&capture);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
 
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -156,8 +164,7 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
 // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
 // -----------------------------------------------------------------------------
         irradianceShader.Use();
-        glUniform1i (glGetUniformLocation(irradianceShader.Program, "environmentMap"), 0);
-        glUniformMatrix4fv (glGetUniformLocation(irradianceShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+        irradianceShader.SetInt(UNIFORM("environmentMap"), 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
@@ -165,7 +172,8 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
         glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
         for (unsigned int i = 0; i < 6; ++i)
         {
-            glUniformMatrix4fv (glGetUniformLocation(irradianceShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
+            capture.view = captureViews[i];
+            captureBlock.Update(&capture);
             glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -202,8 +210,7 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
     if (!skip)
     {
         prefilterShader.Use();
-        glUniform1i (glGetUniformLocation(prefilterShader.Program, "environmentMap"), 0);
-        glUniformMatrix4fv (glGetUniformLocation(prefilterShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(captureProjection));
+        prefilterShader.SetInt(UNIFORM("environmentMap"), 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
@@ -219,10 +226,11 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
             glViewport(0, 0, mipWidth, mipHeight);
 
             float roughness = (float)mip / (float)(maxMipLevels - 1);
-            glUniform1f(glGetUniformLocation(prefilterShader.Program, "roughness"), roughness);
+            prefilterShader.SetFloat(UNIFORM("roughness"), roughness);
             for (unsigned int i = 0; i < 6; ++i)
             {
-                glUniformMatrix4fv (glGetUniformLocation(prefilterShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(captureViews[i]));
+                capture.view = captureViews[i];
+                captureBlock.Update(&capture);
                 glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
 
                 glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -259,7 +267,7 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
 
                 int nrComponents;
                 // Try to read the image into the texture
-                data = stbi_loadf(string(DIRECTORY + name + "/" + name + "_PREMAP_" + levelNumber + "_" + number + ".hdr").c_str(), &width, &height, &nrComponents, 0);
+                data = LoadHDRAsset(string(DIRECTORY + name + "/" + name + "_PREMAP_" + levelNumber + "_" + number + ".hdr"), &width, &height, &nrComponents, 0);
                 glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, GL_RGB16, width, height, 0, GL_RGB, GL_FLOAT, data);
                 if (data) stbi_image_free(data);
             }
@@ -307,12 +315,13 @@ void GetEnvAndIrrCubemap (unsigned int &envCubemap, unsigned int &irradianceMap,
     else
     {
         int nrComponents;
-        data = stbi_loadf(string(string(DIRECTORY) + "BRDF_LUT.hdr").c_str(), &width, &height, &nrComponents, 0);
+        data = LoadHDRAsset(string(string(DIRECTORY) + "BRDF_LUT.hdr"), &width, &height, &nrComponents, 0);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, data);
         if (data) stbi_image_free(data);
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    captureBlock.Delete();
 }
 
 void renderACube()
@@ -452,7 +461,7 @@ bool SetUpCubeMap (string mapType, string name, int width, int height)
         // Try to read the image into the texture
         if (skip)
         {
-            data = stbi_loadf(string(DIRECTORY + name + "/" + name + "_" + mapType + "_" + number + ".hdr").c_str(), &width, &height, &nrComponents, 0);
+            data = LoadHDRAsset(string(DIRECTORY + name + "/" + name + "_" + mapType + "_" + number + ".hdr"), &width, &height, &nrComponents, 0);
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16, width, height, 0, GL_RGB, GL_FLOAT, data);
             if (!data) cout << "There was a problem loading images" << endl;
         }
@@ -489,21 +498,10 @@ void ExportNewTextures (string mapType, string name, int width, int height, unsi
     }
 }
 
-// Check if the desired texture already exists
+// Check if the desired texture already exists, in an asset pack or on disk
 bool AlreadyExists (string pathToImage)
 {
-    ifstream fin;
-    fin.open (pathToImage.c_str());
-    if (!fin.is_open())
-    {
-        //fin.close();
-        return false;
-    }
-    else
-    {
-        fin.close();
-        return true;
-    }
+    return AssetExists(pathToImage);
 }
 
 // If it doesn't already exist, make it
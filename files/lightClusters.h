@@ -0,0 +1,359 @@
+#ifndef LIGHTCLUSTERS_H_INCLUDED
+#define LIGHTCLUSTERS_H_INCLUDED
+
+/***********
+This header sorts the frame's lights into clusters, so each fragment only shades the lights
+that can reach it.
+
+The view frustum is cut into a grid of CLUSTER_X by CLUSTER_Y tiles on screen and CLUSTER_Z
+slices in depth. Slices get exponentially deeper further from the camera, so clusters stay
+roughly cube shaped. Every point light reaches as far as its influence radius, where its
+brightness falls below LIGHT_CUTOFF. A light is added to every cluster its radius sphere
+touches.
+
+The binning runs as a job on the worker pool while the main thread queues the frame's draws.
+If every worker is busy, the main thread does it itself when it needs the result. The result
+goes to the GPU as three buffer textures:
+
+    lightData      two texels a light: position and radius, then colour and type
+    clusterGrid    a texel a cluster: where its lights start in clusterLights, and how many
+    clusterLights  the light indices of every cluster, one cluster after another
+
+A fragment works out its cluster from its screen position and depth (using the cluster
+values in the Frame block), then loops over that cluster's lights only. The cost of a
+fragment goes with how many lights are near it, not how many lights there are.
+************/
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <math.h>
+#include <string.h>
+#include <glew.h>
+#include <glm.hpp>
+#include "shader.h"
+#include "threadPool.h"
+
+#define CLUSTER_X 16// Tiles across the screen
+#define CLUSTER_Y 9// Tiles down the screen
+#define CLUSTER_Z 24// Depth slices
+#define LIGHT_CUTOFF 0.01f// How bright a light has to be to count. A light's radius is where it gets this dim.
+#define LIGHT_DATA_UNIT 10// Texture units for the three buffer textures
+#define CLUSTER_GRID_UNIT 11
+#define CLUSTER_LIGHTS_UNIT 12
+
+using namespace std;
+
+// A light as the clusters see it
+struct ClusterLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 colour;
+    int type;
+};
+
+// What the last binning did
+struct LightClusterStats
+{
+    unsigned int lights;
+    unsigned int references;// Light indices across all clusters
+    unsigned int busiestCluster;// The most lights in one cluster
+};
+
+float LightRadius (glm::vec3 colour);
+
+class LightClusters
+{
+public:
+    LightClusters ()
+    {
+        claimed = make_shared<atomic<bool> >(true);
+        done = true;
+        memset(textures, 0, sizeof(textures));
+        memset(buffers, 0, sizeof(buffers));
+        memset(&stats, 0, sizeof(stats));
+        width = height = 0;
+    }
+
+    // Don't go while a worker is still binning into this
+    ~LightClusters ()
+    {
+        if (!claimed->exchange(true)) return;// Nobody started on the last frame, and now nobody will
+        unique_lock<mutex> lock (doneMutex);
+        finished.wait(lock, [this] { return done; });
+    }
+
+    // Start a new frame, seen through view and projection on a width by height screen, forgetting last frame's lights
+    void Begin (const glm::mat4 &view, const glm::mat4 &projection, int width, int height)
+    {
+        this->view = view;
+        if (projection != this->projection || width != this->width || height != this->height)
+        {
+            this->projection = projection;
+            this->width = width;
+            this->height = height;
+            buildClusters();
+        }
+        lights.clear();
+    }
+
+    // Add a light for this frame. Lights too dim to reach anything are left out.
+    void Add (glm::vec3 position, glm::vec3 colour, int type)
+    {
+        ClusterLight light;
+        light.position = position;
+        light.colour = colour;
+        light.type = type;
+        light.radius = LightRadius(colour);
+        if (light.radius > 0) lights.push_back(light);
+    }
+
+    // Start binning the frame's lights on the worker pool. Nothing may be added until Finish.
+    void Cluster ()
+    {
+        {
+            lock_guard<mutex> lock (doneMutex);
+            done = false;
+        }
+        claimed->store(false);
+
+        // A job left queued from an earlier frame may pick this one up first, which is just as good
+        shared_ptr<atomic<bool> > claim = claimed;
+        WorkerPool().Submit([this, claim] { if (!claim->exchange(true)) this->binAndSignal(); });
+    }
+
+    // Wait for the binning, send it to the GPU and bind it, and fill in the cluster values of frame. GL thread only.
+    void Finish (FrameUniforms &frame)
+    {
+        if (!claimed->exchange(true)) binAndSignal();
+        {
+            unique_lock<mutex> lock (doneMutex);
+            finished.wait(lock, [this] { return done; });
+        }
+
+        upload(0, GL_RGBA32F, lightTexels.empty() ? NULL : &lightTexels[0], lightTexels.size() * sizeof(glm::vec4));
+        upload(1, GL_RG32UI, grid.empty() ? NULL : &grid[0], grid.size() * sizeof(GLuint));
+        upload(2, GL_R32UI, indices.empty() ? NULL : &indices[0], indices.size() * sizeof(GLuint));
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_UNIT + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        frame.clusterTileScale = glm::vec2((float)CLUSTER_X / width, (float)CLUSTER_Y / height);
+        frame.clusterDepthScale = depthScale;
+        frame.clusterDepthBias = depthBias;
+        frame.clusterCount = glm::ivec4(CLUSTER_X, CLUSTER_Y, CLUSTER_Z, 0);
+    }
+
+    // Point a shader's light samplers at their texture units. Call once per shader that uses the clusters.
+    void SetUniforms (Shader &shader)
+    {
+        shader.Use();
+        shader.SetInt(UNIFORM("lightData"), LIGHT_DATA_UNIT);
+        shader.SetInt(UNIFORM("clusterGrid"), CLUSTER_GRID_UNIT);
+        shader.SetInt(UNIFORM("clusterLights"), CLUSTER_LIGHTS_UNIT);
+    }
+
+    // What the last binning did
+    LightClusterStats Stats () const
+    {
+        return stats;
+    }
+
+    void PrintStats () const
+    {
+        cout << "Light clusters: " << stats.lights << " lights, " << stats.references << " references, at most "
+             << stats.busiestCluster << " in one cluster" << endl;
+    }
+
+private:
+    // Set each frame on the main thread, read by the binning
+    glm::mat4 view;
+    glm::mat4 projection;
+    int width, height;
+    vector<ClusterLight> lights;
+
+    // Depends only on the projection: the view space box of every cluster, and how to find a fragment's slice
+    vector<glm::vec3> clusterMin;
+    vector<glm::vec3> clusterMax;
+    float nearPlane, farPlane;
+    float depthScale, depthBias;
+
+    // Written by the binning
+    vector<glm::vec4> lightTexels;
+    vector<GLuint> grid;
+    vector<GLuint> indices;
+    vector<GLuint> pairs;// Cluster and light of every reference, two GLuints each, before they're sorted by cluster
+    LightClusterStats stats;
+
+    // Whoever sets claimed from false bins the frame. Jobs hold their own reference, so one that runs late never touches a deleted object.
+    shared_ptr<atomic<bool> > claimed;
+    mutex doneMutex;
+    condition_variable finished;
+    bool done;
+
+    GLuint textures[3];
+    GLuint buffers[3];
+
+    // Work out the box of every cluster in view space. Assumes a symmetric perspective projection, like glm::perspective makes.
+    void buildClusters ()
+    {
+        // Undo glm::perspective's depth terms to get the clip planes back
+        nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+        farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+        depthScale = CLUSTER_Z / log(farPlane / nearPlane);
+        depthBias = -log(nearPlane) * depthScale;
+
+        clusterMin.resize(CLUSTER_X * CLUSTER_Y * CLUSTER_Z);
+        clusterMax.resize(CLUSTER_X * CLUSTER_Y * CLUSTER_Z);
+        for (int z = 0; z < CLUSTER_Z; z++)
+        {
+            float nearDepth = sliceDepth(z), farDepth = sliceDepth(z + 1);
+            for (int y = 0; y < CLUSTER_Y; y++)
+            {
+                float y0 = -1.0f + 2.0f * y / CLUSTER_Y, y1 = -1.0f + 2.0f * (y + 1) / CLUSTER_Y;
+                for (int x = 0; x < CLUSTER_X; x++)
+                {
+                    float x0 = -1.0f + 2.0f * x / CLUSTER_X, x1 = -1.0f + 2.0f * (x + 1) / CLUSTER_X;
+                    int cluster = x + CLUSTER_X * (y + CLUSTER_Y * z);
+                    // The tile's edges are lines through the eye, so the box is widest at whichever end is further
+                    clusterMin[cluster] = glm::vec3(min(x0 * nearDepth, x0 * farDepth) / projection[0][0], min(y0 * nearDepth, y0 * farDepth) / projection[1][1], -farDepth);
+                    clusterMax[cluster] = glm::vec3(max(x1 * nearDepth, x1 * farDepth) / projection[0][0], max(y1 * nearDepth, y1 * farDepth) / projection[1][1], -nearDepth);
+                }
+            }
+        }
+    }
+
+    // How far from the camera slice starts
+    float sliceDepth (int slice)
+    {
+        return nearPlane * pow(farPlane / nearPlane, (float)slice / CLUSTER_Z);
+    }
+
+    // The slice a depth falls in, clamped to the grid
+    int depthSlice (float depth)
+    {
+        if (depth <= nearPlane) return 0;
+        return max(0, min(CLUSTER_Z - 1, (int)floor(log(depth) * depthScale + depthBias)));
+    }
+
+    // The tile an x or y in normalized device coordinates falls in, clamped to count tiles
+    int tile (float ndc, int count)
+    {
+        return max(0, min(count - 1, (int)floor((ndc * 0.5f + 0.5f) * count)));
+    }
+
+    void binAndSignal ()
+    {
+        bin();
+        lock_guard<mutex> lock (doneMutex);
+        done = true;
+        finished.notify_all();
+    }
+
+    // Find the clusters every light touches, then sort the references by cluster into the grid and index list
+    void bin ()
+    {
+        lightTexels.resize(lights.size() * 2);
+        pairs.clear();
+        for (unsigned int i = 0; i < lights.size(); i++)
+        {
+            const ClusterLight &light = lights[i];
+            lightTexels[i * 2] = glm::vec4(light.position, light.radius);
+            lightTexels[i * 2 + 1] = glm::vec4(light.colour, (float)light.type);
+
+            glm::vec3 centre = glm::vec3(view * glm::vec4(light.position, 1.0f));
+            float radius = light.radius;
+            float nearest = -centre.z - radius, furthest = -centre.z + radius;
+            if (furthest < nearPlane || nearest > farPlane) continue;
+
+            // The tiles the sphere's box covers on screen. x / depth is monotonic in depth, so the ends of the depth range give the extremes.
+            float depths[2] = { max(nearest, nearPlane), furthest };
+            float left = 1e30f, right = -1e30f, bottom = 1e30f, top = -1e30f;
+            for (int d = 0; d < 2; d++)
+            {
+                left = min(left, (centre.x - radius) / depths[d]);
+                right = max(right, (centre.x + radius) / depths[d]);
+                bottom = min(bottom, (centre.y - radius) / depths[d]);
+                top = max(top, (centre.y + radius) / depths[d]);
+            }
+            int x0 = tile(left * projection[0][0], CLUSTER_X), x1 = tile(right * projection[0][0], CLUSTER_X);
+            int y0 = tile(bottom * projection[1][1], CLUSTER_Y), y1 = tile(top * projection[1][1], CLUSTER_Y);
+            int z0 = depthSlice(nearest), z1 = depthSlice(furthest);
+
+            for (int z = z0; z <= z1; z++)
+            {
+                for (int y = y0; y <= y1; y++)
+                {
+                    for (int x = x0; x <= x1; x++)
+                    {
+                        int cluster = x + CLUSTER_X * (y + CLUSTER_Y * z);
+                        glm::vec3 closest = glm::clamp(centre, clusterMin[cluster], clusterMax[cluster]);
+                        glm::vec3 offset = closest - centre;
+                        if (glm::dot(offset, offset) > radius * radius) continue;
+                        pairs.push_back(cluster);
+                        pairs.push_back(i);
+                    }
+                }
+            }
+        }
+
+        // Counting sort by cluster. Lights stay in order within a cluster.
+        size_t clusterCount = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+        grid.assign(clusterCount * 2, 0);
+        for (size_t i = 0; i < pairs.size(); i += 2) grid[pairs[i] * 2 + 1]++;
+        GLuint offset = 0, busiest = 0;
+        for (size_t cluster = 0; cluster < clusterCount; cluster++)
+        {
+            grid[cluster * 2] = offset;
+            offset += grid[cluster * 2 + 1];
+            busiest = max(busiest, grid[cluster * 2 + 1]);
+            grid[cluster * 2 + 1] = 0;// Counted again as the indices go in
+        }
+        indices.resize(offset);
+        for (size_t i = 0; i < pairs.size(); i += 2)
+        {
+            GLuint *cell = &grid[pairs[i] * 2];
+            indices[cell[0] + cell[1]++] = pairs[i + 1];
+        }
+
+        stats.lights = lights.size();
+        stats.references = indices.size();
+        stats.busiestCluster = busiest;
+    }
+
+    // Replace the contents of buffer texture i, making it the first time. The old storage is orphaned rather than waited on.
+    void upload (int i, GLenum format, const GLvoid *data, size_t size)
+    {
+        if (!textures[i])
+        {
+            glGenBuffers(1, &buffers[i]);
+            glGenTextures(1, &textures[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+        if (size) glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        // Reattached every time, as some drivers keep the old storage otherwise
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffers[i]);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+// How far a light of colour reaches before it's dimmer than LIGHT_CUTOFF, going by inverse square falloff
+float LightRadius (glm::vec3 colour)
+{
+    float brightest = max(colour.r, max(colour.g, colour.b));
+    return brightest > 0 ? sqrt(brightest / LIGHT_CUTOFF) : 0;
+}
+
+#endif // LIGHTCLUSTERS_H_INCLUDED
@@ -0,0 +1,666 @@
+#ifndef MATERIALARRAYS_H_INCLUDED
+#define MATERIALARRAYS_H_INCLUDED
+
+/***********
+This header keeps material textures resident in texture arrays, so meshes with different
+materials can be drawn one after another without binding any textures.
+
+Every material texture of the same size, format, mip count and sampling goes in its own
+layer of one GL_TEXTURE_2D_ARRAY. A material is then just a row of the material table, a
+buffer texture with the layers of its albedo, normal and packed (see texturePacking.h) maps
+and a mask of which maps it has. A draw sets one int, the row, and only binds an array when
+the previous draw's material used a different one, which for most scenes is never.
+
+Textures are copied into their layer the first time a material using them is drawn after
+they've finished streaming in. Until then the material draws from its own textures as it
+always has. The copy happens on the GPU, with ARB_copy_image if it's there or through a
+pixel buffer if not. An array starts with one layer, and one that's full is replaced by one
+half again the size, up to MATERIAL_ARRAY_MAX_LAYERS, after which a second array of the same
+kind is started.
+
+Once a material's row is in the table, the storage of the textures it was copied from is
+freed, so nothing is in VRAM twice. The textures keep their names, which is what the registry
+and the materials know them by. A material that has to draw from its own textures again (one
+with a texture still streaming, say) has the freed ones copied back out of their layers first,
+and one that can never go in the arrays keeps its textures' storage for good.
+
+A layer is freed when the texture registry deletes the texture it was copied from.
+************/
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdint.h>
+#include <glew.h>
+#include "shader.h"
+#include "textureRegistry.h"
+#include "asyncTexture.h"
+
+#define MATERIAL_MAP_COUNT 3// Albedo, normal and packed
+#define MATERIAL_ARRAY_UNIT 3// Arrays are bound to this texture unit and the two after it, one per map
+#define MATERIAL_TABLE_UNIT 9// The material table's texture unit
+#define MATERIAL_TABLE_SIZE 4096// Rows in the material table
+#define MATERIAL_ARRAY_MAX_LAYERS 256// The most layers GL 3 promises an array can have
+
+using namespace std;
+
+class MaterialArrays
+{
+public:
+    MaterialArrays ()
+    {
+        table = 0;
+        tableBuffer = 0;
+        copyBuffer = 0;
+        copyBufferSize = 0;
+        generation = 1;
+        layerBytes = 0;
+        InvalidateBindings();
+        Textures().AddReleaseCallback([this] (GLuint id) { this->evict(id); });
+    }
+
+    // Point a shader's array and table samplers at their texture units. Call once per shader that draws materials.
+    void SetUniforms (Shader &shader)
+    {
+        shader.Use();
+        shader.SetInt(UNIFORM("material.albedoArray"), MATERIAL_ARRAY_UNIT);
+        shader.SetInt(UNIFORM("material.normalArray"), MATERIAL_ARRAY_UNIT + 1);
+        shader.SetInt(UNIFORM("material.ORMArray"), MATERIAL_ARRAY_UNIT + 2);
+        shader.SetInt(UNIFORM("materialTable"), MATERIAL_TABLE_UNIT);
+    }
+
+    // The table row of the material with textures maps (-1 where there's no map) and map mask, copying its textures into
+    // arrays if this is the first time. -1 if it can't be drawn from the arrays yet. index and indexGeneration are the
+    // material's own cache of its row, so a material that's already in the table doesn't get looked up. index is -2 for
+    // a material that can't go in the arrays at all (a format that can't be copied, or a full table).
+    int Resolve (const GLint maps[MATERIAL_MAP_COUNT], int mask, int &index, unsigned int &indexGeneration)
+    {
+        if (indexGeneration == generation && index != -1) return max(index, -1);
+        index = -2;
+        indexGeneration = generation;
+
+        uint64_t key = rowKey(maps, mask);
+        unordered_map<uint64_t, int>::iterator it = rowsByKey.find(key);
+        if (it != rowsByKey.end() && sameRow(rows[it->second], maps, mask)) return index = it->second;
+
+        // Another material's row has the same key, so look again next time in case it's gone by then
+        if (it != rowsByKey.end()) return index = fallBack(maps, false);
+
+        // Every texture has to be finished before any of them are copied, or the material would be half resident
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            if (maps[i] >= 0 && AsyncTextures().IsStreaming(maps[i])) return index = fallBack(maps, false);
+        }
+        if (!canAdd(maps)) return fallBack(maps, true);
+
+        Row row;
+        row.mask = mask;
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            row.maps[i] = maps[i];
+            row.array[i] = -1;
+            row.layer[i] = -1;
+            if (maps[i] < 0) continue;
+            if (!makeResident(maps[i], row.array[i], row.layer[i])) return fallBack(maps, true);
+        }
+        if (!addRow(row, index)) return fallBack(maps, true);
+        rowsByKey[key] = index;
+
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            if (maps[i] >= 0) freeStorage(maps[i]);
+        }
+        return index;
+    }
+
+    // Bind the arrays table row index samples from, skipping those that are already bound
+    void Bind (int index)
+    {
+        if (!table) return;
+        const Row &row = rows[index];
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            if (row.array[i] < 0 || arrays[row.array[i]].id == boundArrays[i]) continue;
+            glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[row.array[i]].id);
+            boundArrays[i] = arrays[row.array[i]].id;
+        }
+        if (boundTable != table)
+        {
+            glActiveTexture(GL_TEXTURE0 + MATERIAL_TABLE_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, table);
+            boundTable = table;
+        }
+    }
+
+    // Forget what's bound, for after something else has used the material texture units
+    void InvalidateBindings ()
+    {
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++) boundArrays[i] = 0;
+        boundTable = 0;
+    }
+
+    // Print how many textures are resident and what they cost
+    void PrintStats ()
+    {
+        unsigned int arrayCount = 0, layers = 0;
+        for (unsigned int i = 0; i < arrays.size(); i++)
+        {
+            if (!arrays[i].id) continue;
+            arrayCount++;
+            layers += arrays[i].used;
+        }
+        cout << "Material arrays: " << layers << " textures in " << arrayCount << " arrays, " << rowsByKey.size() << " materials" << endl;
+        cout << "    Using " << layerBytes / 1024 << " KB of VRAM" << endl;
+    }
+
+private:
+    // What a texture has to match to share an array
+    struct ArrayKind
+    {
+        GLint internalFormat;
+        GLint width;
+        GLint height;
+        GLint levels;
+        GLint wrap;
+        GLint minFilter;
+        GLint magFilter;
+        GLint compressed;
+
+        bool operator== (const ArrayKind &other) const
+        {
+            return internalFormat == other.internalFormat && width == other.width && height == other.height && levels == other.levels &&
+                   wrap == other.wrap && minFilter == other.minFilter && magFilter == other.magFilter;
+        }
+    };
+
+    struct TextureArray
+    {
+        GLuint id;// 0 once it's been emptied and deleted
+        ArrayKind kind;
+        int capacity;// Layers allocated
+        int used;// Layers holding a texture
+        vector<int> freeLayers;// Below capacity and not holding a texture
+        uint64_t levelBytes[32];// Size of one layer of each level, for growing compressed arrays
+    };
+
+    struct Residency
+    {
+        int array;
+        int layer;
+        bool freed;// The texture's own storage has been freed, so its pixels are only in the layer
+    };
+
+    struct Row
+    {
+        GLint maps[MATERIAL_MAP_COUNT];
+        int mask;
+        int array[MATERIAL_MAP_COUNT];
+        int layer[MATERIAL_MAP_COUNT];
+    };
+
+    GLuint table;// Buffer texture over tableBuffer, one GL_RGBA16I texel per row
+    GLuint tableBuffer;
+    GLuint copyBuffer;// Pixel buffer for copying without ARB_copy_image
+    size_t copyBufferSize;
+    unsigned int generation;// Changes whenever rows are removed, so materials know to look theirs up again
+    uint64_t layerBytes;
+    GLuint boundArrays[MATERIAL_MAP_COUNT];// What the last Bind left on each array unit
+    GLuint boundTable;
+    vector<TextureArray> arrays;
+    unordered_map<GLuint, Residency> resident;// By texture ID
+    unordered_set<GLuint> kept;// Textures of materials that can't go in the arrays, whose storage is never freed
+    vector<Row> rows;
+    vector<int> freeRows;
+    unordered_map<uint64_t, int> rowsByKey;
+
+    uint64_t rowKey (const GLint maps[MATERIAL_MAP_COUNT], int mask)
+    {
+        return HashBytes(maps, sizeof(GLint) * MATERIAL_MAP_COUNT, (uint64_t)mask);
+    }
+
+    bool sameRow (const Row &row, const GLint maps[MATERIAL_MAP_COUNT], int mask)
+    {
+        if (row.mask != mask) return false;
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            if (row.maps[i] != maps[i]) return false;
+        }
+        return true;
+    }
+
+    // Whether a row for maps fits in the table and every one of its textures can be copied into an array
+    bool canAdd (const GLint maps[MATERIAL_MAP_COUNT])
+    {
+        if (freeRows.empty() && rows.size() >= MATERIAL_TABLE_SIZE) return false;
+        bool copyable = true;
+        for (int i = 0; i < MATERIAL_MAP_COUNT && copyable; i++)
+        {
+            if (maps[i] < 0 || resident.find(maps[i]) != resident.end()) continue;
+            copyable = canCopy(readKind(maps[i]));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return copyable;
+    }
+
+    // Make sure the textures in maps have their own storage for a material to draw from, and keep it for good if keep.
+    // Always -1, the index of a material drawing from its own textures.
+    int fallBack (const GLint maps[MATERIAL_MAP_COUNT], bool keep)
+    {
+        for (int i = 0; i < MATERIAL_MAP_COUNT; i++)
+        {
+            if (maps[i] < 0) continue;
+            if (keep) kept.insert(maps[i]);
+            unordered_map<GLuint, Residency>::iterator it = resident.find(maps[i]);
+            if (it != resident.end() && it->second.freed) restoreStorage(maps[i], it->second);
+        }
+        return -1;
+    }
+
+    // Put row in the table, making the table first if this is the first row
+    bool addRow (const Row &row, int &index)
+    {
+        if (!table)
+        {
+            glGenBuffers(1, &tableBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, tableBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, MATERIAL_TABLE_SIZE * 4 * sizeof(GLshort), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+            glGenTextures(1, &table);
+            glActiveTexture(GL_TEXTURE0 + MATERIAL_TABLE_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, table);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA16I, tableBuffer);
+            boundTable = table;
+        }
+
+        if (!freeRows.empty())
+        {
+            index = freeRows.back();
+            freeRows.pop_back();
+            rows[index] = row;
+        }
+        else if (rows.size() < MATERIAL_TABLE_SIZE)
+        {
+            index = rows.size();
+            rows.push_back(row);
+        }
+        else
+        {
+            return false;
+        }
+
+        GLshort texel[4] = { (GLshort)row.layer[0], (GLshort)row.layer[1], (GLshort)row.layer[2], (GLshort)row.mask };
+        glBindBuffer(GL_TEXTURE_BUFFER, tableBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, index * sizeof(texel), sizeof(texel), texel);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        return true;
+    }
+
+    // Find texture's layer, copying it into one if it hasn't been yet
+    bool makeResident (GLuint texture, int &array, int &layer)
+    {
+        unordered_map<GLuint, Residency>::iterator it = resident.find(texture);
+        if (it != resident.end())
+        {
+            array = it->second.array;
+            layer = it->second.layer;
+            return true;
+        }
+
+        ArrayKind kind = readKind(texture);
+        array = findArray(kind);
+        if (array < 0)
+        {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return false;
+        }
+        TextureArray &target = arrays[array];
+        layer = target.freeLayers.back();
+        target.freeLayers.pop_back();
+        target.used++;
+        copyLayers(GL_TEXTURE_2D, texture, 1, target, layer);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        InvalidateBindings();
+
+        Residency residency = { array, layer, false };
+        resident[texture] = residency;
+        return true;
+    }
+
+    // What kind of array texture would go in, leaving it bound to GL_TEXTURE_2D
+    ArrayKind readKind (GLuint texture)
+    {
+        ArrayKind kind;
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GLint maxLevel;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &kind.internalFormat);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &kind.width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &kind.height);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &kind.compressed);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &kind.wrap);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &kind.minFilter);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &kind.magFilter);
+        kind.levels = min(maxLevel + 1, MipLevelCount(kind.width, kind.height));
+        return kind;
+    }
+
+    // Whether textures of kind can be copied into an array
+    bool canCopy (const ArrayKind &kind)
+    {
+        return kind.compressed || copyFormat(kind.internalFormat) != 0;
+    }
+
+    // An array of kind with a free layer, growing or making one if there isn't. -1 if the format can't be copied.
+    // A texture of kind has to be bound to GL_TEXTURE_2D, in case a new array needs its level sizes.
+    int findArray (const ArrayKind &kind)
+    {
+        if (!canCopy(kind)) return -1;
+
+        int emptySlot = -1;
+        for (unsigned int i = 0; i < arrays.size(); i++)
+        {
+            if (!arrays[i].id)
+            {
+                emptySlot = i;
+                continue;
+            }
+            if (!(arrays[i].kind == kind)) continue;
+            if (!arrays[i].freeLayers.empty()) return i;
+            if (arrays[i].capacity < MATERIAL_ARRAY_MAX_LAYERS)
+            {
+                grow(arrays[i], min(arrays[i].capacity + max(1, arrays[i].capacity / 2), MATERIAL_ARRAY_MAX_LAYERS));
+                return i;
+            }
+        }
+
+        TextureArray array;
+        array.id = 0;
+        array.kind = kind;
+        array.capacity = 0;
+        array.used = 0;
+        for (int level = 0; level < kind.levels; level++)
+        {
+            GLint size = 0;
+            if (kind.compressed) glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            array.levelBytes[level] = size;
+        }
+        if (emptySlot < 0)
+        {
+            emptySlot = arrays.size();
+            arrays.push_back(array);
+        }
+        else
+        {
+            arrays[emptySlot] = array;
+        }
+        grow(arrays[emptySlot], 1);
+        return emptySlot;
+    }
+
+    // Give array capacity layers, copying the ones it has into the new storage
+    void grow (TextureArray &array, int capacity)
+    {
+        const ArrayKind &kind = array.kind;
+        GLuint id;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+        for (int level = 0; level < kind.levels; level++)
+        {
+            int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+            if (kind.compressed)
+            {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, kind.internalFormat, width, height, capacity, 0, array.levelBytes[level] * capacity, NULL);
+            }
+            else
+            {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, kind.internalFormat, width, height, capacity, 0, copyFormat(kind.internalFormat), GL_UNSIGNED_BYTE, NULL);
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, kind.levels - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, kind.wrap);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, kind.wrap);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, kind.minFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, kind.magFilter);
+
+        if (array.id)
+        {
+            TextureArray grown = array;
+            grown.id = id;
+            copyLayers(GL_TEXTURE_2D_ARRAY, array.id, array.capacity, grown, 0);
+            glDeleteTextures(1, &array.id);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        InvalidateBindings();
+
+        for (int layer = capacity - 1; layer >= array.capacity; layer--) array.freeLayers.push_back(layer);
+        layerBytes += layerSize(array) * (capacity - array.capacity);
+        array.id = id;
+        array.capacity = capacity;
+    }
+
+    // Copy every level of layerCount layers of source (a 2D texture or array) into array, starting at layer
+    void copyLayers (GLenum sourceTarget, GLuint source, int layerCount, TextureArray &array, int layer)
+    {
+        const ArrayKind &kind = array.kind;
+        if (GLEW_VERSION_4_3 || GLEW_ARB_copy_image)
+        {
+            for (int level = 0; level < kind.levels; level++)
+            {
+                int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+                glCopyImageSubData(source, sourceTarget, level, 0, 0, 0, array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, layerCount);
+            }
+            return;
+        }
+
+        // Without it, read each level into a pixel buffer and unpack it straight back out, which stays on the GPU too
+        GLint packAlignment, unpackAlignment;
+        glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (!copyBuffer) glGenBuffers(1, &copyBuffer);
+        glBindTexture(sourceTarget, source);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+        for (int level = 0; level < kind.levels; level++)
+        {
+            int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+            size_t size = (kind.compressed ? array.levelBytes[level] : (size_t)width * height * channelCount(kind.internalFormat)) * layerCount;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, copyBuffer);
+            if (size > copyBufferSize)
+            {
+                copyBufferSize = size;
+                glBufferData(GL_PIXEL_PACK_BUFFER, copyBufferSize, NULL, GL_STREAM_COPY);
+            }
+            if (kind.compressed) glGetCompressedTexImage(sourceTarget, level, NULL);
+            else glGetTexImage(sourceTarget, level, copyFormat(kind.internalFormat), GL_UNSIGNED_BYTE, NULL);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, copyBuffer);
+            if (kind.compressed)
+            {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, layerCount, kind.internalFormat, size, NULL);
+            }
+            else
+            {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, layerCount, copyFormat(kind.internalFormat), GL_UNSIGNED_BYTE, NULL);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+    }
+
+    // Free a resident texture's own storage, now that its material draws from its layer
+    void freeStorage (GLuint texture)
+    {
+        Residency &residency = resident[texture];
+        if (residency.freed || kept.find(texture) != kept.end()) return;
+
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (int level = 0; level < arrays[residency.array].kind.levels; level++)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R8, 0, 0, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        residency.freed = true;
+        Textures().SetStorageFreed(texture, true);
+    }
+
+    // Give a texture whose storage was freed its own again, copied back out of its layer
+    void restoreStorage (GLuint texture, Residency &residency)
+    {
+        const TextureArray &array = arrays[residency.array];
+        const ArrayKind &kind = array.kind;
+        glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (GLEW_VERSION_4_3 || GLEW_ARB_copy_image)
+        {
+            for (int level = 0; level < kind.levels; level++)
+            {
+                int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+                specifyLevel(array, level, NULL);
+                glCopyImageSubData(array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, residency.layer, texture, GL_TEXTURE_2D, level, 0, 0, 0, width, height, 1);
+            }
+        }
+        else
+        {
+            // Without it, read each level of the whole array into the pixel buffer and unpack the texture's layer from it
+            GLint packAlignment, unpackAlignment;
+            glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+            glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            if (!copyBuffer) glGenBuffers(1, &copyBuffer);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+            for (int level = 0; level < kind.levels; level++)
+            {
+                int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+                size_t size = kind.compressed ? array.levelBytes[level] : (size_t)width * height * channelCount(kind.internalFormat);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, copyBuffer);
+                if (size * array.capacity > copyBufferSize)
+                {
+                    copyBufferSize = size * array.capacity;
+                    glBufferData(GL_PIXEL_PACK_BUFFER, copyBufferSize, NULL, GL_STREAM_COPY);
+                }
+                if (kind.compressed) glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, NULL);
+                else glGetTexImage(GL_TEXTURE_2D_ARRAY, level, copyFormat(kind.internalFormat), GL_UNSIGNED_BYTE, NULL);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, copyBuffer);
+                specifyLevel(array, level, (const GLvoid *)(size * residency.layer));
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            }
+            glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            InvalidateBindings();
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        residency.freed = false;
+        Textures().SetStorageFreed(texture, false);
+    }
+
+    // Give level of the bound 2D texture the storage of a layer of array, filled from pixels unless they're NULL
+    void specifyLevel (const TextureArray &array, int level, const GLvoid *pixels)
+    {
+        const ArrayKind &kind = array.kind;
+        int width = max(1, kind.width >> level), height = max(1, kind.height >> level);
+        if (kind.compressed)
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, kind.internalFormat, width, height, 0, array.levelBytes[level], pixels);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, kind.internalFormat, width, height, 0, copyFormat(kind.internalFormat), GL_UNSIGNED_BYTE, pixels);
+        }
+    }
+
+    // The size of one layer of array, every level included
+    uint64_t layerSize (const TextureArray &array)
+    {
+        const ArrayKind &kind = array.kind;
+        uint64_t size = 0;
+        for (int level = 0; level < kind.levels; level++)
+        {
+            size += kind.compressed ? array.levelBytes[level] : (uint64_t)max(1, kind.width >> level) * max(1, kind.height >> level) * channelCount(kind.internalFormat);
+        }
+        return size;
+    }
+
+    // The pixel format uncompressed textures of internalFormat are copied as, or 0 if they can't be
+    GLenum copyFormat (GLint internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_R8:
+            return GL_RED;
+        case GL_RG8:
+            return GL_RG;
+        case GL_RGBA:
+        case GL_RGBA8:
+        case GL_SRGB_ALPHA:
+        case GL_SRGB8_ALPHA8:
+            return GL_RGBA;
+        default:
+            return 0;
+        }
+    }
+
+    int channelCount (GLint internalFormat)
+    {
+        GLenum format = copyFormat(internalFormat);
+        return format == GL_RED ? 1 : format == GL_RG ? 2 : 4;
+    }
+
+    // The registry is deleting texture, so give back its layer and drop the rows that use it
+    void evict (GLuint texture)
+    {
+        kept.erase(texture);
+        unordered_map<GLuint, Residency>::iterator it = resident.find(texture);
+        if (it == resident.end()) return;
+
+        TextureArray &array = arrays[it->second.array];
+        array.freeLayers.push_back(it->second.layer);
+        if (--array.used == 0)
+        {
+            // Nothing left in it, so free its memory. Its slot gets reused by the next new array.
+            for (int i = 0; i < MATERIAL_MAP_COUNT; i++) boundArrays[i] = boundArrays[i] == array.id ? 0 : boundArrays[i];
+            glDeleteTextures(1, &array.id);
+            layerBytes -= layerSize(array) * array.capacity;
+            array.id = 0;
+            array.capacity = 0;
+            array.freeLayers.clear();
+        }
+        resident.erase(it);
+
+        for (unordered_map<uint64_t, int>::iterator row = rowsByKey.begin(); row != rowsByKey.end();)
+        {
+            bool uses = false;
+            for (int i = 0; i < MATERIAL_MAP_COUNT; i++) uses = uses || rows[row->second].maps[i] == (GLint)texture;
+            if (!uses)
+            {
+                ++row;
+                continue;
+            }
+            freeRows.push_back(row->second);
+            row = rowsByKey.erase(row);
+        }
+        generation++;
+    }
+};
+
+// The arrays shared by the whole engine. Only use them from the GL thread.
+MaterialArrays & MaterialTextures ()
+{
+    static MaterialArrays arrays;
+    return arrays;
+}
+
+#endif // MATERIALARRAYS_H_INCLUDED
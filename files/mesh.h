@@ -15,23 +15,83 @@
 #include <scene.h>
 #include <postprocess.h>
 #include "pbr.h"
+#include "vertexFormat.h"
+#include "meshlet.h"
+#include "geometryPool.h"
+#include "frustum.h"
 
 
 
 using namespace std;
 
-struct Vertex
+// The type ("texture_albedo" etc.) and file name of one texture used by a mesh, before it's been uploaded
+struct TextureBinding
 {
-    // Position
-    glm::vec3 Position;
-    // Normal
-    glm::vec3 Normal;
-    // Tangent
-    glm::vec3 Tangent;
-    // Tangent
-    glm::vec3 Bitangent;
-    // TexCoords
-    glm::vec2 TexCoords;
+    string type;
+    string path;
+};
+
+// The smallest index type that can address vertexCount vertices
+GLenum IndexTypeFor( GLuint vertexCount )
+{
+    return vertexCount < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// Size in bytes of one index of type
+GLuint IndexSize( GLenum type )
+{
+    return type == GL_UNSIGNED_SHORT ? sizeof( GLushort ) : sizeof( GLuint );
+}
+
+#define MAX_MESH_LODS 4// Full detail plus up to three simplified levels
+
+// One level of detail of a mesh: a range of its index buffer, and how far (in model units) it strays from full detail
+struct MeshLod
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+    float error;
+};
+
+// The CPU side of a mesh, filled in by the importer before anything touches OpenGL.
+// The vertices and indices either live in the vectors or, for cooked meshes, in a mapped cache file.
+// The importer works on 32 bit indices, then CompactIndices makes them 16 bit if the mesh is small enough.
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<GLuint> indices;
+    vector<GLushort> shortIndices;
+    const Vertex *mappedVertices = NULL;
+    const GLvoid *mappedIndices = NULL;
+    GLenum indexType = GL_UNSIGNED_INT;
+    GLuint vertexCount = 0;
+    GLuint indexCount = 0;
+    vector<MeshLod> lods;// Most detailed first. Empty means one level that covers every index.
+    vector<Meshlet> meshlets;// Clusters of the most detailed level, for culling
+    vector<TextureBinding> textures;
+    bool twoSided = false;// Its material is seen from behind too, so it can't be culled for facing away
+
+    const Vertex * Vertices( ) const
+    {
+        return mappedVertices ? mappedVertices : ( vertices.empty( ) ? NULL : &vertices[0] );
+    }
+
+    // The indices, whichever type they are
+    const GLvoid * IndexData( ) const
+    {
+        if ( mappedIndices ) return mappedIndices;
+        if ( indexType == GL_UNSIGNED_SHORT ) return shortIndices.empty( ) ? NULL : &shortIndices[0];
+        return indices.empty( ) ? NULL : &indices[0];
+    }
+
+    // Switch to 16 bit indices if every vertex can be addressed with them
+    void CompactIndices( )
+    {
+        if ( mappedIndices || indexType != GL_UNSIGNED_INT || IndexTypeFor( vertexCount ) != GL_UNSIGNED_SHORT ) return;
+        shortIndices.assign( indices.begin( ), indices.end( ) );
+        vector<GLuint>( ).swap( indices );
+        indexType = GL_UNSIGNED_SHORT;
+    }
 };
 
 /*
@@ -59,7 +119,7 @@ public:
 
     /*  Functions  */
     // Constructor
-    Mesh( vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures )
+    Mesh( vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, VertexFormat format = DEFAULT_VERTEX_FORMAT )
     {
         this->vertices = vertices;
         this->indices = indices;
@@ -67,13 +127,159 @@ public:
         SetMaterial();
 
         // Now that we have all the required data, set the vertex buffers and its attribute pointers.
-        this->setupMesh( );
+        this->setupMesh( &this->vertices[0], this->vertices.size( ), &this->indices[0], GL_UNSIGNED_INT, this->indices.size( ), format );
+    }
+
+    // Constructor for imported and cooked meshes. The vertex and index data go straight to OpenGL without being copied
+    // (cooked meshes upload straight from the cache mapping), so the vertices and indices vectors stay empty for meshes made this way.
+    Mesh( const MeshData &data, vector<Texture> textures, VertexFormat format = DEFAULT_VERTEX_FORMAT )
+    {
+        this->textures = textures;
+        SetMaterial();
+
+        this->setupMesh( data.Vertices( ), data.vertexCount, data.IndexData( ), data.indexType, data.indexCount, format );
+        if ( !data.lods.empty( ) ) this->lods = data.lods;
+        this->meshlets = data.meshlets;
+    }
+
+    // Render the mesh at level of detail lod, clamped to the levels it has, placed by transform
+    void Draw( Shader &shader, int lod = 0, glm::mat4 transform = glm::mat4( ) )
+    {
+        this->beginDraw( shader );
+        this->placeInstance( transform );
+        this->DrawGeometry( shader, lod );
+        this->endDraw( );
+    }
+
+    // Render the mesh at level of detail lod, placed by transform. At full detail, only the meshlets that might be seen are drawn.
+    void Draw( Shader &shader, int lod, glm::mat4 transform, const FrameView &view )
+    {
+        this->beginDraw( shader );
+        this->placeInstance( transform );
+        this->DrawGeometry( shader, lod, transform, view );
+        this->endDraw( );
     }
 
-    // Render the mesh
-    void Draw( Shader &shader )
+    // Issue the draw calls for level of detail lod, with the material and this mesh's VAO already bound (see RenderQueue)
+    void DrawGeometry( Shader &shader, int lod )
     {
+        if ( !this->geometry.valid ) return;
+        lod = max( 0, min( lod, ( int )this->lods.size( ) - 1 ) );
+
+        this->setQuantization( shader );
+        glDrawElementsBaseVertex( GL_TRIANGLES, this->lods[lod].indexCount, this->indexType, this->indexOffset( this->lods[lod].firstIndex ), this->geometry.baseVertex );
+    }
+
+    // Draw count copies of level of detail lod in one go, each placed by its own matrix from the geometry pool's
+    // instance buffer (see GeometryPool::BindInstances). Meshlets aren't culled, since they'd be in view for some copies and not others.
+    void DrawInstances( Shader &shader, int lod, GLsizei count )
+    {
+        if ( !this->geometry.valid ) return;
+        lod = max( 0, min( lod, ( int )this->lods.size( ) - 1 ) );
+
+        this->setQuantization( shader );
+        glDrawElementsInstancedBaseVertex( GL_TRIANGLES, this->lods[lod].indexCount, this->indexType, this->indexOffset( this->lods[lod].firstIndex ), count, this->geometry.baseVertex );
+    }
+
+    // Like DrawGeometry, but culling meshlets at full detail
+    void DrawGeometry( Shader &shader, int lod, glm::mat4 transform, const FrameView &view )
+    {
+        if ( !this->geometry.valid ) return;
+        if ( lod > 0 || this->meshlets.empty( ) )
+        {
+            this->DrawGeometry( shader, lod );
+            return;
+        }
+
+        glm::mat3 linear = glm::mat3( transform );
+        glm::mat3 normalTransform = glm::transpose( glm::inverse( linear ) );
+        float scales[3] = { glm::length( linear[0] ), glm::length( linear[1] ), glm::length( linear[2] ) };
+        float scale = max( scales[0], max( scales[1], scales[2] ) );
+        bool uniformScale = min( scales[0], min( scales[1], scales[2] ) ) > scale * 0.99f;
+
+        // Visible meshlets that are next to each other in the index buffer are drawn as one range
+        this->visibleCounts.clear( );
+        this->visibleOffsets.clear( );
+        GLuint rangeEnd = ( GLuint )-1;
+        for ( GLuint i = 0; i < this->meshlets.size( ); i++ )
+        {
+            const Meshlet &meshlet = this->meshlets[i];
+            if ( !MeshletVisible( meshlet, transform, normalTransform, scale, uniformScale, view ) ) continue;
+
+            if ( meshlet.firstIndex == rangeEnd )
+            {
+                this->visibleCounts.back( ) += meshlet.indexCount;
+            }
+            else
+            {
+                this->visibleCounts.push_back( meshlet.indexCount );
+                this->visibleOffsets.push_back( this->indexOffset( meshlet.firstIndex ) );
+            }
+            rangeEnd = meshlet.firstIndex + meshlet.indexCount;
+        }
+        if ( this->visibleCounts.empty( ) ) return;
+        this->visibleBaseVertices.assign( this->visibleCounts.size( ), this->geometry.baseVertex );
 
+        this->setQuantization( shader );
+        glMultiDrawElementsBaseVertex( GL_TRIANGLES, &this->visibleCounts[0], this->indexType, &this->visibleOffsets[0], this->visibleCounts.size( ), &this->visibleBaseVertices[0] );
+    }
+
+    // Whether the mesh made it into the geometry pool. One that didn't has nothing to draw.
+    bool IsValid( )
+    {
+        return this->geometry.valid;
+    }
+
+    VertexFormat GetVertexFormat( )
+    {
+        return this->format;
+    }
+
+    const vector<MeshLod> & GetLods( )
+    {
+        return this->lods;
+    }
+
+    // A sphere around every vertex, in model space
+    glm::vec3 GetBoundingCentre( )
+    {
+        return this->bounds.centre;
+    }
+
+    float GetBoundingRadius( )
+    {
+        return this->bounds.radius;
+    }
+
+    // The box and sphere around every vertex, in model space
+    const Bounds & GetBounds( )
+    {
+        return this->bounds;
+    }
+
+    // Gives the mesh's vertices and indices back to the geometry pool. Meshes get copied around by value, so this is left to whoever owns the mesh.
+    void Delete( )
+    {
+        Geometry( ).Free( this->geometry );
+    }
+
+private:
+    /*  Render data  */
+    GeometryAllocation geometry;// Where the vertices and indices are in the geometry pool
+    GLuint indexCount;
+    GLenum indexType;// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    VertexFormat format;
+    PositionQuantization quantization;
+    vector<MeshLod> lods;
+    vector<Meshlet> meshlets;
+    vector<GLsizei> visibleCounts;// Index ranges of the meshlets that passed culling, rebuilt every draw
+    vector<const GLvoid *> visibleOffsets;
+    vector<GLint> visibleBaseVertices;
+    Bounds bounds;
+
+    // Binds the material and the VAO
+    void beginDraw( Shader &shader )
+    {
         material.Draw(shader);
         /*
         // Bind appropriate textures
@@ -117,62 +323,73 @@ public:
         glUniform1f( glGetUniformLocation( shader.Program, "material.shininess" ), 16.0f );
         */
 
-        // Draw mesh
-        glBindVertexArray( this->VAO );
-        glDrawElements( GL_TRIANGLES, this->indices.size( ), GL_UNSIGNED_INT, 0 );
-        glBindVertexArray( 0 );
+        // Every mesh of this format shares the one VAO
+        Geometry( ).Bind( this->format );
+    }
 
-        // Always good practice to set everything back to defaults once configured.
-        for ( GLuint i = 0; i < this->textures.size( ); i++ )
-        {
-            glActiveTexture( GL_TEXTURE0 + i );
-            glBindTexture( GL_TEXTURE_2D, 0 );
-        }
+    // Draws outside the render queue are a single instance, so their matrix is set as a constant attribute
+    void placeInstance( const glm::mat4 &transform )
+    {
+        Geometry( ).SetInstance( transform );
     }
 
-private:
-    /*  Render data  */
-    GLuint VAO, VBO, EBO;
+    // Quantized positions are relative to the mesh's bounding box, every other format is scale 1 offset 0
+    void setQuantization( Shader &shader )
+    {
+        shader.SetVec3( UNIFORM( "positionScale" ), this->quantization.scale );
+        shader.SetVec3( UNIFORM( "positionOffset" ), this->quantization.offset );
+    }
+
+    // Where index firstIndex of this mesh is in the pool's index buffer
+    const GLvoid * indexOffset( GLuint firstIndex )
+    {
+        return ( const GLvoid * )( this->geometry.indexOffset + ( size_t )firstIndex * IndexSize( this->indexType ) );
+    }
+
+    // Textures are left bound, so the next mesh with the same material arrays doesn't have to bind them again
+    void endDraw( )
+    {
+        glBindVertexArray( 0 );
+    }
 
     /*  Functions    */
-    // Initializes all the buffer objects/arrays
-    void setupMesh( )
-    {
-        // Create buffers/arrays
-        glGenVertexArrays( 1, &this->VAO );
-        glGenBuffers( 1, &this->VBO );
-        glGenBuffers( 1, &this->EBO );
-
-        glBindVertexArray( this->VAO );
-        // Load data into vertex buffers
-        glBindBuffer( GL_ARRAY_BUFFER, this->VBO );
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData( GL_ARRAY_BUFFER, this->vertices.size( ) * sizeof( Vertex ), &this->vertices[0], GL_STATIC_DRAW );
-
-        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, this->EBO );
-        glBufferData( GL_ELEMENT_ARRAY_BUFFER, this->indices.size( ) * sizeof( GLuint ), &this->indices[0], GL_STATIC_DRAW );
-
-        // Set the vertex attribute pointers
-        // Vertex Positions
-        glEnableVertexAttribArray( 0 );
-        glVertexAttribPointer( 0, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )0 );
-        // Vertex Normals
-        glEnableVertexAttribArray( 1 );
-        glVertexAttribPointer( 1, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, Normal ) );
-        // Vertex Texture Coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer( 2, 2, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, TexCoords ) );
-         // Vertex Texture Coords
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer( 3, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, Tangent ) );
-         // Vertex Texture Coords
-        //glEnableVertexAttribArray(4);
-       // glVertexAttribPointer( 4, 3, GL_FLOAT, GL_FALSE, sizeof( Vertex ), ( GLvoid * )offsetof( Vertex, Bitangent ) );
+    // Puts the mesh in the geometry pool, converting the vertices to format first
+    void setupMesh( const Vertex *vertices, GLuint vertexCount, const GLvoid *indices, GLenum indexType, GLuint indexCount, VertexFormat format )
+    {
+        this->indexCount = indexCount;
+        this->indexType = indexType;
+        this->format = format;
 
+        // Until told otherwise there's just the one level of detail
+        MeshLod full;
+        full.firstIndex = 0;
+        full.indexCount = indexCount;
+        full.error = 0.0f;
+        this->lods.assign( 1, full );
 
-        glBindVertexArray( 0 );
+        // Bound the vertices, for culling and picking the level of detail
+        this->bounds = Bounds( );
+        for ( GLuint i = 0; i < vertexCount; i++ )
+        {
+            this->bounds.minimum = i ? glm::min( this->bounds.minimum, vertices[i].Position ) : vertices[i].Position;
+            this->bounds.maximum = i ? glm::max( this->bounds.maximum, vertices[i].Position ) : vertices[i].Position;
+        }
+        this->bounds.centre = ( this->bounds.minimum + this->bounds.maximum ) * 0.5f;
+        for ( GLuint i = 0; i < vertexCount; i++ )
+        {
+            this->bounds.radius = max( this->bounds.radius, glm::length( vertices[i].Position - this->bounds.centre ) );
+        }
+
+        vector<unsigned char> packed;
+        PackVertices( vertices, vertexCount, format, packed, this->quantization );
+        const GLvoid *vertexData = packed.empty( ) ? ( const GLvoid * )vertices : ( const GLvoid * )&packed[0];
+
+        // Copy into the shared buffers
+        this->geometry = Geometry( ).Allocate( format, vertexData, vertexCount, indices, indexType, indexCount );
+        if ( !this->geometry.valid )
+        {
+            cout << "ERROR::MESH:: No room in the geometry pool, so the mesh won't be drawn" << endl;
+        }
     }
 };
 
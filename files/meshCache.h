@@ -0,0 +1,363 @@
+#ifndef MESHCACHE_H_INCLUDED
+#define MESHCACHE_H_INCLUDED
+
+/***********
+This header holds the cooked binary mesh cache.
+
+The first time a model is imported through Assimp, its meshes are written out as one
+binary file: a header, a table with one entry per mesh, the texture bindings of each
+mesh and then the raw vertex and index blobs, exactly as they get uploaded to OpenGL.
+The file is keyed by the source path, its modification time and size, and the Assimp
+import flags, so editing the model or changing how it's imported invalidates it. If a pack's
+copy is stale, the loose file next to the model is tried too, since that's where the model is
+cooked again after an edit.
+
+On a warm start the file is memory mapped (straight out of the asset pack if it's in one) and the blobs are handed straight to
+Mesh::setupMesh, so loading only costs as much as reading the bytes off the disk.
+
+File layout:
+    MeshCacheHeader
+    source path (header.pathLength bytes)
+    MeshCacheEntry [header.meshCount]
+    texture bindings (uint16 length + chars for the type, then the same for the file name)
+    padding to MESH_CACHE_ALIGNMENT
+    vertex, index and meshlet blobs of each mesh, each aligned to MESH_CACHE_ALIGNMENT
+************/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include "fileUtils.h"
+#include "assetPack.h"
+#include "hash.h"
+#include "mesh.h"
+
+#define MESH_CACHE_DIRECTORY "resources/cache/"
+#define MESH_CACHE_VERSION 8// Bump whenever the layout of the file or of Vertex changes, or the importer makes different meshes
+#define MESH_CACHE_ALIGNMENT 16
+
+using namespace std;
+
+struct MeshCacheHeader
+{
+    char magic[4];// Always "DJMC"
+    uint32_t version;// MESH_CACHE_VERSION when the file was cooked
+    uint32_t importFlags;// The Assimp post processing flags used on import
+    uint32_t meshCount;// How many MeshCacheEntry's follow the path
+    int64_t sourceMTime;// Modification time of the source model
+    uint64_t sourceSize;// Size of the source model in bytes
+    uint32_t pathLength;// Length of the source path that follows the header
+    uint32_t vertexStride;// sizeof(Vertex) when the file was cooked
+};
+
+struct MeshCacheEntry
+{
+    uint64_t vertexOffset;// Byte offset of the vertex blob from the start of the file
+    uint64_t indexOffset;// Byte offset of the index blob from the start of the file
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureOffset;// Byte offset of this mesh's texture bindings from the start of the file
+    uint32_t textureCount;
+    uint32_t indexType;// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    uint32_t lodCount;// How many of the lod arrays are used, at least 1
+    uint32_t lodFirstIndex[MAX_MESH_LODS];
+    uint32_t lodIndexCount[MAX_MESH_LODS];
+    float lodError[MAX_MESH_LODS];
+    uint32_t meshletCount;
+    uint64_t meshletOffset;// Byte offset of the Meshlet array from the start of the file
+};
+
+string MeshCachePath (string sourcePath, uint32_t importFlags);
+bool WriteMeshCache (string sourcePath, uint32_t importFlags, vector<MeshData> &meshes);
+bool RestampMeshCache (string sourcePath, uint32_t importFlags);
+
+/********************
+MeshCache: Reads a cooked mesh file through a memory mapping.
+The pointers handed out stay valid until the cache is closed or destroyed.
+*********************/
+class MeshCache
+{
+public:
+    MeshCache ()
+    {
+        header = NULL;
+        entries = NULL;
+    }
+
+    // Map the cooked file for sourcePath. Returns false if there isn't one, or it's stale or damaged.
+    bool Open (string sourcePath, uint32_t importFlags)
+    {
+        Close();
+
+        int64_t mTime;
+        uint64_t size;
+        if (!GetAssetInfo(sourcePath, mTime, size)) return false;
+        string path = MeshCachePath(sourcePath, importFlags);
+        if (OpenAsset(path, file) && check(sourcePath, importFlags, mTime, size)) return true;
+
+        // A pack can hold an older cook than the loose file the importer has written since the source changed
+        const AssetPack *pack;
+        const AssetPackEntry *entry;
+        if (!Packs().Find(path, pack, entry)) return false;// What was opened was the loose file already
+        return OpenLooseAsset(path, file) && check(sourcePath, importFlags, mTime, size);
+    }
+
+    void Close ()
+    {
+        file.Close();
+        header = NULL;
+        entries = NULL;
+    }
+
+    uint32_t MeshCount ()
+    {
+        return header ? header->meshCount : 0;
+    }
+
+    const Vertex * GetVertices (int i)
+    {
+        return (const Vertex *)(file.Data() + entries[i].vertexOffset);
+    }
+
+    GLuint GetVertexCount (int i)
+    {
+        return entries[i].vertexCount;
+    }
+
+    const GLvoid * GetIndices (int i)
+    {
+        return file.Data() + entries[i].indexOffset;
+    }
+
+    GLenum GetIndexType (int i)
+    {
+        return entries[i].indexType;
+    }
+
+    vector<Meshlet> GetMeshlets (int i)
+    {
+        const Meshlet *meshlets = (const Meshlet *)(file.Data() + entries[i].meshletOffset);
+        return vector<Meshlet>(meshlets, meshlets + entries[i].meshletCount);
+    }
+
+    vector<MeshLod> GetLods (int i)
+    {
+        vector<MeshLod> lods (entries[i].lodCount);
+        for (uint32_t j = 0; j < entries[i].lodCount; j++)
+        {
+            lods[j].firstIndex = entries[i].lodFirstIndex[j];
+            lods[j].indexCount = entries[i].lodIndexCount[j];
+            lods[j].error = entries[i].lodError[j];
+        }
+        return lods;
+    }
+
+    GLuint GetIndexCount (int i)
+    {
+        return entries[i].indexCount;
+    }
+
+    // Read back the texture bindings of mesh i
+    vector<TextureBinding> GetTextures (int i)
+    {
+        vector<TextureBinding> textures;
+        const char *read = file.Data() + entries[i].textureOffset;
+        const char *end = file.Data() + file.Size();
+        for (uint32_t j = 0; j < entries[i].textureCount; j++)
+        {
+            TextureBinding texture;
+            if (!readString(read, end, texture.type) || !readString(read, end, texture.path)) break;
+            textures.push_back(texture);
+        }
+        return textures;
+    }
+
+private:
+    AssetData file;// Mapped from the asset pack, or the loose file
+    const MeshCacheHeader *header;
+    const MeshCacheEntry *entries;
+
+    // Whether the file that's open was cooked from sourcePath as it is now (mTime and size), with importFlags, and is whole
+    bool check (string sourcePath, uint32_t importFlags, int64_t mTime, uint64_t size)
+    {
+        if (file.Size() < sizeof(MeshCacheHeader)) return fail();
+        header = (const MeshCacheHeader *)file.Data();
+        if (memcmp(header->magic, "DJMC", 4) != 0) return fail();
+        if (header->version != MESH_CACHE_VERSION) return fail();
+        if (header->importFlags != importFlags) return fail();
+        if (header->vertexStride != sizeof(Vertex)) return fail();
+        if (header->sourceMTime != mTime || header->sourceSize != size) return fail();
+
+        size_t tableStart = sizeof(MeshCacheHeader) + header->pathLength;
+        if (tableStart + (size_t)header->meshCount * sizeof(MeshCacheEntry) > file.Size()) return fail();
+        if (string(file.Data() + sizeof(MeshCacheHeader), header->pathLength) != sourcePath) return fail();
+        entries = (const MeshCacheEntry *)(file.Data() + tableStart);
+
+        // Make sure every blob is inside the file so a truncated cache can't crash the loader
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const MeshCacheEntry &entry = entries[i];
+            if (entry.vertexOffset % MESH_CACHE_ALIGNMENT || entry.indexOffset % MESH_CACHE_ALIGNMENT) return fail();
+            if (entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex) > file.Size()) return fail();
+            if (entry.indexType != GL_UNSIGNED_SHORT && entry.indexType != GL_UNSIGNED_INT) return fail();
+            if (entry.indexOffset + (uint64_t)entry.indexCount * IndexSize(entry.indexType) > file.Size()) return fail();
+            if (entry.textureOffset > file.Size()) return fail();
+            if (entry.meshletOffset % MESH_CACHE_ALIGNMENT) return fail();
+            if (entry.meshletOffset + (uint64_t)entry.meshletCount * sizeof(Meshlet) > file.Size()) return fail();
+            if (entry.lodCount < 1 || entry.lodCount > MAX_MESH_LODS) return fail();
+            for (uint32_t j = 0; j < entry.lodCount; j++)
+            {
+                if ((uint64_t)entry.lodFirstIndex[j] + entry.lodIndexCount[j] > entry.indexCount) return fail();
+            }
+        }
+        return true;
+    }
+
+    bool fail ()
+    {
+        Close();
+        return false;
+    }
+
+    bool readString (const char *&read, const char *end, string &str)
+    {
+        uint16_t length;
+        if (read + sizeof(length) > end) return false;
+        memcpy(&length, read, sizeof(length));
+        read += sizeof(length);
+        if (read + length > end) return false;
+        str.assign(read, length);
+        read += length;
+        return true;
+    }
+};
+
+// Where the cooked version of a source model lives. The name is a hash of everything that keys the file.
+string MeshCachePath (string sourcePath, uint32_t importFlags)
+{
+    uint64_t key = HashString(sourcePath);
+    key = HashBytes(&importFlags, sizeof(importFlags), key);
+    return string(MESH_CACHE_DIRECTORY) + HashToHex(key) + ".djmesh";
+}
+
+// Write the meshes of a freshly imported model out as a cooked file
+bool WriteMeshCache (string sourcePath, uint32_t importFlags, vector<MeshData> &meshes)
+{
+    MeshCacheHeader header;
+    memcpy(header.magic, "DJMC", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.importFlags = importFlags;
+    header.meshCount = meshes.size();
+    header.pathLength = sourcePath.size();
+    header.vertexStride = sizeof(Vertex);
+    if (!GetAssetInfo(sourcePath, header.sourceMTime, header.sourceSize)) return false;
+
+    // Lay out the texture bindings first since their size decides where the blobs start
+    vector<MeshCacheEntry> entries (meshes.size());
+    string bindings;
+    uint64_t offset = sizeof(MeshCacheHeader) + sourcePath.size() + entries.size() * sizeof(MeshCacheEntry);
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        entries[i].textureOffset = offset + bindings.size();
+        entries[i].textureCount = meshes[i].textures.size();
+        for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+        {
+            string strings[2] = { meshes[i].textures[j].type, meshes[i].textures[j].path };
+            for (int k = 0; k < 2; k++)
+            {
+                uint16_t length = strings[k].size();
+                bindings.append((const char *)&length, sizeof(length));
+                bindings.append(strings[k]);
+            }
+        }
+    }
+    offset += bindings.size();
+
+    // Then give every blob an aligned spot after the bindings
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+        entries[i].vertexOffset = offset;
+        entries[i].vertexCount = meshes[i].vertexCount;
+        offset += meshes[i].vertexCount * sizeof(Vertex);
+
+        offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+        entries[i].indexOffset = offset;
+        entries[i].indexCount = meshes[i].indexCount;
+        entries[i].indexType = meshes[i].indexType;
+
+        // A mesh without levels of detail is stored as having the one level that covers every index
+        entries[i].lodCount = meshes[i].lods.empty() ? 1 : min((size_t)MAX_MESH_LODS, meshes[i].lods.size());
+        for (uint32_t j = 0; j < MAX_MESH_LODS; j++)
+        {
+            bool used = j < entries[i].lodCount;
+            entries[i].lodFirstIndex[j] = used && !meshes[i].lods.empty() ? meshes[i].lods[j].firstIndex : 0;
+            entries[i].lodIndexCount[j] = !used ? 0 : (meshes[i].lods.empty() ? meshes[i].indexCount : meshes[i].lods[j].indexCount);
+            entries[i].lodError[j] = used && !meshes[i].lods.empty() ? meshes[i].lods[j].error : 0.0f;
+        }
+        offset += meshes[i].indexCount * IndexSize(meshes[i].indexType);
+
+        offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+        entries[i].meshletOffset = offset;
+        entries[i].meshletCount = meshes[i].meshlets.size();
+        offset += meshes[i].meshlets.size() * sizeof(Meshlet);
+    }
+
+    // Write to a temporary file and swap it in at the end, so a crash never leaves half a cache behind
+    MakeDirectory(MESH_CACHE_DIRECTORY);
+    string path = MeshCachePath(sourcePath, importFlags);
+    static atomic<unsigned int> tempCounter (0);// Two importers can cook the same model at once, so give each its own temporary file
+    string tempPath = path + "." + to_string(tempCounter++) + ".tmp";
+    ofstream fout (tempPath.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if (!fout.is_open())
+    {
+        cout << "ERROR::MESHCACHE:: Could not write " << tempPath << endl;
+        return false;
+    }
+
+    fout.write((const char *)&header, sizeof(header));
+    fout.write(sourcePath.c_str(), sourcePath.size());
+    if (!entries.empty()) fout.write((const char *)&entries[0], entries.size() * sizeof(MeshCacheEntry));
+    fout.write(bindings.c_str(), bindings.size());
+
+    const char padding[MESH_CACHE_ALIGNMENT] = { 0 };
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        fout.write(padding, entries[i].vertexOffset - (uint64_t)fout.tellp());
+        if (meshes[i].vertexCount) fout.write((const char *)meshes[i].Vertices(), meshes[i].vertexCount * sizeof(Vertex));
+        fout.write(padding, entries[i].indexOffset - (uint64_t)fout.tellp());
+        if (meshes[i].indexCount) fout.write((const char *)meshes[i].IndexData(), meshes[i].indexCount * IndexSize(meshes[i].indexType));
+        fout.write(padding, entries[i].meshletOffset - (uint64_t)fout.tellp());
+        if (!meshes[i].meshlets.empty()) fout.write((const char *)&meshes[i].meshlets[0], meshes[i].meshlets.size() * sizeof(Meshlet));
+    }
+
+    bool written = fout.good();
+    fout.close();
+    remove(path.c_str());// rename won't replace an existing file on Windows
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        cout << "ERROR::MESHCACHE:: Could not write " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// Give the cooked version of sourcePath the source's current modification time and size, for when it was saved without changing
+bool RestampMeshCache (string sourcePath, uint32_t importFlags)
+{
+    MeshCacheHeader header;
+    fstream file (MeshCachePath(sourcePath, importFlags).c_str(), ios_base::in | ios_base::out | ios_base::binary);
+    if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "DJMC", 4) != 0) return false;
+    if (!GetAssetInfo(sourcePath, header.sourceMTime, header.sourceSize)) return false;
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+    return file.good();
+}
+
+#endif // MESHCACHE_H_INCLUDED
@@ -0,0 +1,422 @@
+#ifndef MESHOPTIMIZER_H_INCLUDED
+#define MESHOPTIMIZER_H_INCLUDED
+
+/***********
+This header reorders a mesh's triangles and vertices so the GPU does less work drawing it.
+
+Meshes straight out of a DCC tool or a scanner list their triangles in whatever order they
+were made in, so the GPU ends up shading the same vertex many times and the heavy PBR
+fragment shader runs on pixels that get covered up later. OptimizeMesh runs four passes at
+import time, before the mesh is cooked:
+
+0) Welding: vertices that match in every attribute (to within a small epsilon) are merged.
+1) Vertex cache: triangles are reordered (Forsyth's algorithm) so each one reuses vertices
+   the previous ones just transformed.
+2) Overdraw: the cache-friendly order is cut into clusters (as in Tipsy), and the clusters
+   facing out from the middle of the mesh are drawn first, so they occlude the rest.
+3) Vertex fetch: vertices are renumbered in the order they're first used, so fetches walk
+   through the vertex buffer instead of jumping around it.
+
+Cache efficiency is measured as ACMR (vertices transformed per triangle, 0.5 is perfect and
+3 is the worst) and ATVR (vertices transformed per vertex, 1 is perfect).
+************/
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <glew.h>
+#include <glm.hpp>
+#include "mesh.h"
+#include "hash.h"
+
+using namespace std;
+
+#define VERTEX_CACHE_SIZE 16// FIFO size used to measure ACMR and ATVR, about what GPUs have had since the GeForce 3
+#define FORSYTH_CACHE_SIZE 32// LRU cache size the reordering optimizes for
+#define OVERDRAW_THRESHOLD 1.05f// How much ACMR the overdraw pass may give up, 5%
+#define WELD_POSITION_EPSILON 1e-5f// Vertices closer than these in every attribute are welded into one
+#define WELD_DIRECTION_EPSILON 1e-3f
+#define WELD_TEXCOORD_EPSILON 1e-5f
+
+struct VertexCacheStats
+{
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+    GLuint triangles = 0;
+    GLuint vertices = 0;
+    GLuint transforms = 0;// Cache misses
+};
+
+VertexCacheStats AnalyzeVertexCache (const GLuint *indices, GLuint indexCount, GLuint vertexCount);
+void WeldVertices (vector<Vertex> &vertices, vector<GLuint> &indices);
+void OptimizeVertexCache (vector<GLuint> &indices, GLuint vertexCount);
+void OptimizeOverdraw (vector<GLuint> &indices, const vector<Vertex> &vertices);
+void OptimizeVertexFetch (vector<Vertex> &vertices, vector<GLuint> &indices);
+void OptimizeMesh (MeshData &mesh, VertexCacheStats &before, VertexCacheStats &after);
+
+// Simulate a FIFO post-transform cache over indices and count how many vertices it transforms
+VertexCacheStats AnalyzeVertexCache (const GLuint *indices, GLuint indexCount, GLuint vertexCount)
+{
+    VertexCacheStats stats;
+    vector<GLuint> timestamps (vertexCount, 0);// When each vertex last entered the cache
+    vector<char> used (vertexCount, 0);
+    GLuint time = VERTEX_CACHE_SIZE + 1;
+
+    for (GLuint i = 0; i < indexCount; i++)
+    {
+        GLuint index = indices[i];
+        if (time - timestamps[index] > VERTEX_CACHE_SIZE)
+        {
+            timestamps[index] = time++;
+            stats.transforms++;
+        }
+        if (!used[index])
+        {
+            used[index] = 1;
+            stats.vertices++;
+        }
+    }
+
+    stats.triangles = indexCount / 3;
+    if (stats.triangles) stats.acmr = (float)stats.transforms / stats.triangles;
+    if (stats.vertices) stats.atvr = (float)stats.transforms / stats.vertices;
+    return stats;
+}
+
+// Snap every attribute of a vertex to the weld grid, so near-identical vertices come out exactly equal
+struct WeldKey
+{
+    int64_t values[14];
+
+    WeldKey (const Vertex &vertex)
+    {
+        const float *position = &vertex.Position.x;
+        const float *normal = &vertex.Normal.x;
+        const float *tangent = &vertex.Tangent.x;
+        const float *bitangent = &vertex.Bitangent.x;
+        for (int i = 0; i < 3; i++)
+        {
+            values[i] = snap(position[i], WELD_POSITION_EPSILON);
+            values[3 + i] = snap(normal[i], WELD_DIRECTION_EPSILON);
+            values[6 + i] = snap(tangent[i], WELD_DIRECTION_EPSILON);
+            values[9 + i] = snap(bitangent[i], WELD_DIRECTION_EPSILON);
+        }
+        values[12] = snap(vertex.TexCoords.x, WELD_TEXCOORD_EPSILON);
+        values[13] = snap(vertex.TexCoords.y, WELD_TEXCOORD_EPSILON);
+    }
+
+    bool operator== (const WeldKey &other) const
+    {
+        return memcmp(values, other.values, sizeof(values)) == 0;
+    }
+
+    // The grid cell value falls in. 64 bits hold any sensible coordinate at these epsilons, and anything beyond
+    // (or NaN) is clamped first, since converting an out of range float to an integer is undefined.
+    static int64_t snap (float value, float epsilon)
+    {
+        double cell = floor((double)value / epsilon + 0.5);
+        if (cell != cell) return 0;
+        return (int64_t)max(-4e18, min(cell, 4e18));
+    }
+};
+
+// Merge vertices that match in every attribute, to within the weld epsilons. Assimp splits vertices per face
+// for some formats, and scanned meshes often come with exact duplicates along their seams.
+void WeldVertices (vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+    // Open addressing table of indices into the welded vertices, at most half full
+    GLuint tableSize = 1;
+    while (tableSize < vertices.size() * 2) tableSize *= 2;
+    vector<GLuint> table (tableSize, (GLuint)-1);
+
+    vector<GLuint> remap (vertices.size());
+    vector<Vertex> welded;
+    vector<WeldKey> weldedKeys;
+    welded.reserve(vertices.size());
+    weldedKeys.reserve(vertices.size());
+    for (GLuint i = 0; i < vertices.size(); i++)
+    {
+        WeldKey key (vertices[i]);
+        GLuint slot = HashBytes(key.values, sizeof(key.values)) & (tableSize - 1);
+        while (table[slot] != (GLuint)-1 && !(weldedKeys[table[slot]] == key)) slot = (slot + 1) & (tableSize - 1);
+
+        if (table[slot] == (GLuint)-1)
+        {
+            table[slot] = welded.size();
+            welded.push_back(vertices[i]);
+            weldedKeys.push_back(key);
+        }
+        remap[i] = table[slot];
+    }
+
+    for (unsigned int i = 0; i < indices.size(); i++) indices[i] = remap[indices[i]];
+    vertices.swap(welded);
+}
+
+// How much using a vertex now is worth, given where it is in the cache and how many triangles still need it
+float ForsythVertexScore (int cachePosition, GLuint remainingTriangles)
+{
+    if (remainingTriangles == 0) return -1.0f;// Nothing left uses it
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+        {
+            score = 0.75f;// Used by the last triangle. Fixed, so the triangle doesn't just get drawn again as a strip.
+        }
+        else
+        {
+            score = powf(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+    }
+
+    // Finish off vertices with few triangles left, so they don't need to come back into the cache later
+    return score + 2.0f / sqrtf((float)remainingTriangles);
+}
+
+// Reorder triangles for the post-transform vertex cache, using Tom Forsyth's linear-speed algorithm
+void OptimizeVertexCache (vector<GLuint> &indices, GLuint vertexCount)
+{
+    GLuint triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // Which triangles use each vertex
+    vector<GLuint> remaining (vertexCount, 0);
+    for (GLuint i = 0; i < triangleCount * 3; i++) remaining[indices[i]]++;
+    vector<GLuint> firstTriangle (vertexCount + 1, 0);
+    for (GLuint v = 0; v < vertexCount; v++) firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+    vector<GLuint> vertexTriangles (triangleCount * 3);
+    vector<GLuint> fill (firstTriangle.begin(), firstTriangle.end() - 1);
+    for (GLuint i = 0; i < triangleCount * 3; i++) vertexTriangles[fill[indices[i]]++] = i / 3;
+
+    vector<int> cachePosition (vertexCount, -1);
+    vector<float> vertexScore (vertexCount);
+    for (GLuint v = 0; v < vertexCount; v++) vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+
+    vector<float> triangleScore (triangleCount);
+    vector<char> emitted (triangleCount, 0);
+    for (GLuint t = 0; t < triangleCount; t++)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    }
+
+    vector<GLuint> cache;// Most recently used first
+    vector<GLuint> output;
+    output.reserve(triangleCount * 3);
+    GLuint cursor = 0;// Where to look for a fresh start when nothing in the cache has triangles left
+    int best = -1;
+
+    for (GLuint emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (best < 0)
+        {
+            while (emitted[cursor]) cursor++;
+            best = cursor;
+        }
+
+        // Draw the best triangle and take it off its vertices' lists
+        emitted[best] = 1;
+        for (int k = 0; k < 3; k++)
+        {
+            GLuint v = indices[best * 3 + k];
+            output.push_back(v);
+
+            GLuint *begin = &vertexTriangles[firstTriangle[v]];
+            GLuint *end = begin + remaining[v];
+            *find(begin, end, (GLuint)best) = *(end - 1);
+            remaining[v]--;
+
+            // Move the vertex to the front of the cache
+            vector<GLuint>::iterator it = find(cache.begin(), cache.end(), v);
+            if (it != cache.end()) cache.erase(it);
+            cache.insert(cache.begin(), v);
+        }
+
+        // Update every vertex still in the cache, and those that just fell out of it
+        for (unsigned int i = 0; i < cache.size(); i++)
+        {
+            cachePosition[cache[i]] = i < FORSYTH_CACHE_SIZE ? i : -1;
+        }
+        for (unsigned int i = 0; i < cache.size(); i++)
+        {
+            GLuint v = cache[i];
+            float newScore = ForsythVertexScore(cachePosition[v], remaining[v]);
+            float delta = newScore - vertexScore[v];
+            vertexScore[v] = newScore;
+            for (GLuint j = 0; j < remaining[v]; j++) triangleScore[vertexTriangles[firstTriangle[v] + j]] += delta;
+        }
+
+        // The next triangle is the best one touching the cache, now that all their scores are up to date
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int i = 0; i < cache.size(); i++)
+        {
+            GLuint v = cache[i];
+            for (GLuint j = 0; j < remaining[v]; j++)
+            {
+                GLuint t = vertexTriangles[firstTriangle[v] + j];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        if (cache.size() > FORSYTH_CACHE_SIZE) cache.resize(FORSYTH_CACHE_SIZE);
+    }
+
+    indices.swap(output);
+}
+
+struct OverdrawCluster
+{
+    GLuint start;// First triangle
+    GLuint end;// One past the last triangle
+    float sortKey;
+};
+
+bool DrawClusterFirst (const OverdrawCluster &a, const OverdrawCluster &b)
+{
+    return a.sortKey > b.sortKey;
+}
+
+// Reorder clusters of cache-optimized triangles so that the ones most likely to occlude the rest come first.
+// Clusters are only cut where it costs at most OVERDRAW_THRESHOLD of the ACMR.
+void OptimizeOverdraw (vector<GLuint> &indices, const vector<Vertex> &vertices)
+{
+    GLuint triangleCount = indices.size() / 3;
+    if (triangleCount == 0) return;
+
+    // Cache misses of each triangle if it were drawn straight after the previous one
+    vector<GLuint> timestamps (vertices.size(), 0);
+    GLuint time = VERTEX_CACHE_SIZE + 1;
+    vector<int> misses (triangleCount, 0);
+    for (GLuint t = 0; t < triangleCount; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            GLuint v = indices[t * 3 + k];
+            if (time - timestamps[v] > VERTEX_CACHE_SIZE)
+            {
+                timestamps[v] = time++;
+                misses[t]++;
+            }
+        }
+    }
+
+    // Hard boundaries are where all three vertices missed, the cache starts over there anyway.
+    // Each run between them is cut again wherever its ACMR so far is within the threshold of the whole run's.
+    vector<GLuint> boundaries;
+    for (GLuint t = 0; t < triangleCount; t++)
+    {
+        if (t == 0 || misses[t] == 3) boundaries.push_back(t);
+    }
+    boundaries.push_back(triangleCount);
+
+    vector<OverdrawCluster> clusters;
+    for (unsigned int b = 0; b + 1 < boundaries.size(); b++)
+    {
+        GLuint start = boundaries[b];
+        GLuint end = boundaries[b + 1];
+        int runMisses = 0;
+        for (GLuint t = start; t < end; t++) runMisses += misses[t];
+        float runACMR = (float)runMisses / (end - start);
+
+        OverdrawCluster cluster;
+        cluster.start = start;
+        int clusterMisses = 0;
+        for (GLuint t = start; t < end; t++)
+        {
+            clusterMisses += t == cluster.start ? 3 : misses[t];// A cut makes the cluster's first triangle miss
+            if (t + 1 == end || (float)clusterMisses / (t + 1 - cluster.start) <= runACMR * OVERDRAW_THRESHOLD)
+            {
+                cluster.end = t + 1;
+                clusters.push_back(cluster);
+                cluster.start = t + 1;
+                clusterMisses = 0;
+            }
+        }
+    }
+
+    // Sort by how far out from the centre of the mesh each cluster faces
+    glm::vec3 meshCentre (0.0f);
+    float meshArea = 0.0f;
+    vector<glm::vec3> clusterCentres (clusters.size(), glm::vec3(0.0f));
+    vector<glm::vec3> clusterNormals (clusters.size(), glm::vec3(0.0f));
+    vector<float> clusterAreas (clusters.size(), 0.0f);
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        for (GLuint t = clusters[c].start; t < clusters[c].end; t++)
+        {
+            glm::vec3 p0 = vertices[indices[t * 3]].Position;
+            glm::vec3 p1 = vertices[indices[t * 3 + 1]].Position;
+            glm::vec3 p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);// Length is twice the area
+            float area = glm::length(normal);
+            glm::vec3 centre = (p0 + p1 + p2) / 3.0f;
+
+            clusterCentres[c] += centre * area;
+            clusterNormals[c] += normal;
+            clusterAreas[c] += area;
+            meshCentre += centre * area;
+            meshArea += area;
+        }
+    }
+    if (meshArea > 0.0f) meshCentre /= meshArea;
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        if (clusterAreas[c] > 0.0f) clusterCentres[c] /= clusterAreas[c];
+        float length = glm::length(clusterNormals[c]);
+        glm::vec3 normal = length > 0.0f ? clusterNormals[c] / length : glm::vec3(0.0f);
+        clusters[c].sortKey = glm::dot(clusterCentres[c] - meshCentre, normal);
+    }
+    stable_sort(clusters.begin(), clusters.end(), DrawClusterFirst);
+
+    vector<GLuint> output;
+    output.reserve(indices.size());
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        output.insert(output.end(), indices.begin() + clusters[c].start * 3, indices.begin() + clusters[c].end * 3);
+    }
+    indices.swap(output);
+}
+
+// Renumber vertices in the order the indices first use them. Vertices no triangle uses are dropped.
+void OptimizeVertexFetch (vector<Vertex> &vertices, vector<GLuint> &indices)
+{
+    vector<GLuint> remap (vertices.size(), (GLuint)-1);
+    vector<Vertex> output;
+    output.reserve(vertices.size());
+    for (unsigned int i = 0; i < indices.size(); i++)
+    {
+        GLuint &index = indices[i];
+        if (remap[index] == (GLuint)-1)
+        {
+            remap[index] = output.size();
+            output.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(output);
+}
+
+// Run every pass over a freshly imported mesh, filling in its cache efficiency before and after
+void OptimizeMesh (MeshData &mesh, VertexCacheStats &before, VertexCacheStats &after)
+{
+    before = AnalyzeVertexCache(mesh.indices.empty() ? NULL : &mesh.indices[0], mesh.indices.size(), mesh.vertices.size());
+    if (mesh.indices.size() % 3 == 0 && !mesh.vertices.empty())
+    {
+        WeldVertices(mesh.vertices, mesh.indices);
+        OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+        OptimizeOverdraw(mesh.indices, mesh.vertices);
+        OptimizeVertexFetch(mesh.vertices, mesh.indices);
+        mesh.vertexCount = mesh.vertices.size();
+        mesh.indexCount = mesh.indices.size();
+    }
+    after = AnalyzeVertexCache(mesh.indices.empty() ? NULL : &mesh.indices[0], mesh.indices.size(), mesh.vertices.size());
+}
+
+#endif // MESHOPTIMIZER_H_INCLUDED
@@ -0,0 +1,288 @@
+#ifndef MESHSIMPLIFIER_H_INCLUDED
+#define MESHSIMPLIFIER_H_INCLUDED
+
+/***********
+This header builds the levels of detail (LODs) of a mesh at import time.
+
+Each level is made by collapsing edges of the one before it, cheapest first, where the
+cost of a collapse is its quadric error (Garland and Heckbert): the sum of squared
+distances from the moved vertex to the planes of every triangle it has been merged with.
+Normals and UVs add to the cost too, so collapses that smear the shading or stretch the
+texture are left for last. Vertices on UV seams and open borders never move, so levels
+don't tear or pull away from their outline.
+
+Edges only collapse onto vertices that already exist, so every level reuses the mesh's
+vertex buffer and is just another range of its index buffer. Each level records its error
+in model units, which Model::Draw projects onto the screen to pick the level to draw.
+************/
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <glew.h>
+#include <glm.hpp>
+#include "mesh.h"
+#include "meshOptimizer.h"
+
+using namespace std;
+
+#define LOD_TRIANGLE_RATIO 0.5f// Each level aims for this fraction of the triangles of the one before it
+#define LOD_MIN_TRIANGLES 64// Don't bother making levels smaller than this
+#define SIMPLIFY_ATTRIBUTE_WEIGHT 0.05f// How far (as a fraction of the mesh's radius) a fully broken normal or UV counts as
+
+void GenerateLods (MeshData &mesh);
+
+// A plane quadric: a symmetric 4x4 matrix kept as its upper triangle, plus the area it was built from
+struct Quadric
+{
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double area;
+
+    Quadric ()
+    {
+        a2 = ab = ac = ad = b2 = bc = bd = c2 = cd = d2 = area = 0.0;
+    }
+
+    // The plane through p with unit normal n, weighted by area
+    Quadric (glm::vec3 n, glm::vec3 p, double weight)
+    {
+        double a = n.x, b = n.y, c = n.z;
+        double d = -glm::dot(n, p);
+        a2 = a * a * weight; ab = a * b * weight; ac = a * c * weight; ad = a * d * weight;
+        b2 = b * b * weight; bc = b * c * weight; bd = b * d * weight;
+        c2 = c * c * weight; cd = c * d * weight;
+        d2 = d * d * weight;
+        area = weight;
+    }
+
+    void operator+= (const Quadric &q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        area += q.area;
+    }
+
+    // Area weighted sum of squared distances from p to the planes
+    double Error (glm::vec3 p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                     + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                     + c2 * z * z + 2 * cd * z
+                     + d2;
+        return error > 0.0 ? error : 0.0;
+    }
+};
+
+struct SimplifyCollapse
+{
+    GLuint from;
+    GLuint to;
+    double cost;
+
+    bool operator< (const SimplifyCollapse &other) const
+    {
+        return cost < other.cost;
+    }
+};
+
+// Whether moving vertex from onto vertex to would turn any of from's other triangles over
+bool CollapseFlipsTriangle (const vector<Vertex> &vertices, const vector<GLuint> &indices, const vector<GLuint> &firstTriangle,
+                            const vector<GLuint> &vertexTriangles, GLuint from, GLuint to)
+{
+    for (GLuint i = firstTriangle[from]; i < firstTriangle[from + 1]; i++)
+    {
+        const GLuint *triangle = &indices[vertexTriangles[i] * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to) continue;// Collapses away
+
+        glm::vec3 before[3], after[3];
+        for (int k = 0; k < 3; k++)
+        {
+            before[k] = vertices[triangle[k]].Position;
+            after[k] = triangle[k] == from ? vertices[to].Position : before[k];
+        }
+        glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(normalBefore, normalAfter) <= 0.0f) return true;
+    }
+    return false;
+}
+
+// Simplify mesh's first level over and over, appending each new level to its indices and lods. Call after OptimizeMesh.
+void GenerateLods (MeshData &mesh)
+{
+    vector<Vertex> &vertices = mesh.vertices;
+    GLuint vertexCount = vertices.size();
+    mesh.lods.clear();
+    MeshLod full;
+    full.firstIndex = 0;
+    full.indexCount = mesh.indices.size();
+    full.error = 0.0f;
+    mesh.lods.push_back(full);
+    if (vertexCount == 0 || mesh.indices.size() % 3 != 0 || mesh.indices.size() / 3 < LOD_MIN_TRIANGLES * 2) return;
+
+    vector<GLuint> indices (mesh.indices);
+
+    // Vertices that share a position with a different vertex are on a seam, those on an edge with one triangle are on a border.
+    // Neither may move. Welding has already merged vertices that match in every attribute.
+    vector<char> locked (vertexCount, 0);
+    {
+        vector<GLuint> byPosition (vertexCount);
+        for (GLuint i = 0; i < vertexCount; i++) byPosition[i] = i;
+        sort(byPosition.begin(), byPosition.end(), [&vertices] (GLuint a, GLuint b)
+        {
+            const glm::vec3 &p = vertices[a].Position, &q = vertices[b].Position;
+            return p.x != q.x ? p.x < q.x : (p.y != q.y ? p.y < q.y : p.z < q.z);
+        });
+        vector<GLuint> positionId (vertexCount);
+        for (GLuint i = 0; i < vertexCount; i++)
+        {
+            bool same = i > 0 && vertices[byPosition[i]].Position == vertices[byPosition[i - 1]].Position;
+            positionId[byPosition[i]] = same ? positionId[byPosition[i - 1]] : byPosition[i];
+            if (same) locked[byPosition[i]] = locked[byPosition[i - 1]] = 1;
+        }
+
+        // An edge is on the border if it's only used once, in either direction
+        vector<pair<GLuint, GLuint> > edges;
+        edges.reserve(indices.size());
+        for (GLuint i = 0; i < indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                GLuint a = positionId[indices[i + k]], b = positionId[indices[i + (k + 1) % 3]];
+                edges.push_back(make_pair(min(a, b), max(a, b)));
+            }
+        }
+        sort(edges.begin(), edges.end());
+        vector<char> borderPosition (vertexCount, 0);
+        for (unsigned int i = 0; i < edges.size(); i++)
+        {
+            bool shared = (i > 0 && edges[i] == edges[i - 1]) || (i + 1 < edges.size() && edges[i] == edges[i + 1]);
+            if (!shared) borderPosition[edges[i].first] = borderPosition[edges[i].second] = 1;
+        }
+        for (GLuint i = 0; i < vertexCount; i++)
+        {
+            if (borderPosition[positionId[i]]) locked[i] = 1;
+        }
+    }
+
+    // Every vertex starts with the planes of the triangles around it
+    vector<Quadric> quadrics (vertexCount);
+    glm::vec3 minimum = vertices[0].Position, maximum = vertices[0].Position;
+    for (GLuint i = 0; i < vertexCount; i++)
+    {
+        minimum = glm::min(minimum, vertices[i].Position);
+        maximum = glm::max(maximum, vertices[i].Position);
+    }
+    for (GLuint i = 0; i < indices.size(); i += 3)
+    {
+        glm::vec3 p0 = vertices[indices[i]].Position;
+        glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - p0, vertices[indices[i + 2]].Position - p0);
+        float length = glm::length(normal);
+        if (length <= 0.0f) continue;
+        Quadric plane (normal / length, p0, length * 0.5);
+        for (int k = 0; k < 3; k++) quadrics[indices[i + k]] += plane;
+    }
+    float attributeScale = glm::length(maximum - minimum) * 0.5f * SIMPLIFY_ATTRIBUTE_WEIGHT;
+    attributeScale *= attributeScale;
+
+    double maxError = 0.0;// Largest squared distance any collapse so far has moved the surface by
+    GLuint triangleCount = indices.size() / 3;
+    GLuint target = (GLuint)(triangleCount * LOD_TRIANGLE_RATIO);
+    vector<GLuint> remap (vertexCount);
+
+    while (mesh.lods.size() < MAX_MESH_LODS && target >= LOD_MIN_TRIANGLES)
+    {
+        // Which triangles use each vertex, for the flip check
+        vector<GLuint> firstTriangle (vertexCount + 1, 0);
+        for (GLuint i = 0; i < indices.size(); i++) firstTriangle[indices[i] + 1]++;
+        for (GLuint v = 0; v < vertexCount; v++) firstTriangle[v + 1] += firstTriangle[v];
+        vector<GLuint> vertexTriangles (indices.size());
+        vector<GLuint> fill (firstTriangle.begin(), firstTriangle.end() - 1);
+        for (GLuint i = 0; i < indices.size(); i++) vertexTriangles[fill[indices[i]]++] = i / 3;
+
+        // Cost every edge, both ways round
+        vector<SimplifyCollapse> collapses;
+        collapses.reserve(indices.size() * 2);
+        for (GLuint i = 0; i < indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                GLuint ends[2] = { indices[i + k], indices[i + (k + 1) % 3] };
+                for (int way = 0; way < 2; way++)
+                {
+                    SimplifyCollapse collapse;
+                    collapse.from = ends[way];
+                    collapse.to = ends[1 - way];
+                    if (locked[collapse.from]) continue;
+
+                    const Vertex &from = vertices[collapse.from], &to = vertices[collapse.to];
+                    Quadric merged = quadrics[collapse.from];
+                    merged += quadrics[collapse.to];
+                    glm::vec3 normalChange = from.Normal - to.Normal;
+                    glm::vec2 uvChange = from.TexCoords - to.TexCoords;
+                    double attributeError = (glm::dot(normalChange, normalChange) * 0.25f + glm::dot(uvChange, uvChange)) * attributeScale;
+                    collapse.cost = merged.Error(to.Position) + attributeError * quadrics[collapse.from].area;
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        sort(collapses.begin(), collapses.end());
+
+        // Collapse the cheapest edges. A vertex is only touched once a pass, so the costs and flip checks stay right.
+        for (GLuint v = 0; v < vertexCount; v++) remap[v] = v;
+        vector<char> touched (vertexCount, 0);
+        GLuint removed = 0;
+        for (unsigned int i = 0; i < collapses.size() && triangleCount - removed > target; i++)
+        {
+            const SimplifyCollapse &collapse = collapses[i];
+            if (touched[collapse.from] || touched[collapse.to]) continue;
+            if (CollapseFlipsTriangle(vertices, indices, firstTriangle, vertexTriangles, collapse.from, collapse.to)) continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] += quadrics[collapse.from];
+            double area = quadrics[collapse.to].area;
+            if (area > 0.0) maxError = max(maxError, collapse.cost / area);
+
+            for (GLuint j = firstTriangle[collapse.from]; j < firstTriangle[collapse.from + 1]; j++)
+            {
+                const GLuint *triangle = &indices[vertexTriangles[j] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) removed++;
+                for (int k = 0; k < 3; k++) touched[triangle[k]] = 1;
+            }
+        }
+        if (removed * 100 < triangleCount) break;// Nearly everything left is locked or would flip
+
+        // Apply the collapses and drop the triangles that collapsed to a line
+        GLuint kept = 0;
+        for (GLuint i = 0; i < indices.size(); i += 3)
+        {
+            GLuint a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || c == a) continue;
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+        indices.resize(kept);
+        triangleCount = kept / 3;
+
+        if (triangleCount <= target)
+        {
+            MeshLod lod;
+            lod.firstIndex = mesh.indices.size();
+            lod.indexCount = indices.size();
+            lod.error = (float)sqrt(maxError);
+
+            vector<GLuint> ordered (indices);
+            OptimizeVertexCache(ordered, vertexCount);
+            mesh.indices.insert(mesh.indices.end(), ordered.begin(), ordered.end());
+            mesh.lods.push_back(lod);
+            target = (GLuint)(triangleCount * LOD_TRIANGLE_RATIO);
+        }
+    }
+    mesh.indexCount = mesh.indices.size();
+}
+
+#endif // MESHSIMPLIFIER_H_INCLUDED
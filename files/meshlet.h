@@ -0,0 +1,127 @@
+#ifndef MESHLET_H_INCLUDED
+#define MESHLET_H_INCLUDED
+
+/***********
+This header splits meshes into meshlets: small clusters of triangles that can be culled on
+their own, so a big mesh that's mostly off screen or facing away only submits what's left.
+
+Meshlets are built at import time by walking a mesh's triangles in their optimized order,
+which already keeps neighbouring triangles together, and cutting a new meshlet every
+MESHLET_MAX_TRIANGLES triangles, or sooner (but never before MESHLET_MIN_TRIANGLES) if the
+next triangle faces too far away from the rest. So each meshlet is just a range of the index
+buffer, with a bounding sphere and a cone around its triangles' normals. Meshes whose material
+is two sided (AI_MATKEY_TWOSIDED) are seen from behind as well, so their meshlets get cones that
+never cull.
+
+Each frame, Mesh::Draw tests every meshlet of full detail meshes against the view frustum and
+its normal cone, then draws the ranges that survive (with neighbouring ones merged) in one
+glMultiDrawElementsBaseVertex call.
+************/
+
+#include <vector>
+#include <math.h>
+#include <glew.h>
+#include <glm.hpp>
+#include "vertexFormat.h"
+#include "frustum.h"
+
+using namespace std;
+
+#define MESHLET_MIN_TRIANGLES 64
+#define MESHLET_MAX_TRIANGLES 128
+#define MESHLET_CONE_CULLING 1// Skip meshlets of single sided meshes that face away
+#define MESHLET_NORMAL_SPREAD 0.5f// Past MESHLET_MIN_TRIANGLES, start a new meshlet if a triangle's normal is further than this cosine from the average
+
+struct Meshlet
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+    glm::vec3 centre;// Bounding sphere, in model space
+    float radius;
+    glm::vec3 coneAxis;// Average direction the triangles face
+    float coneCutoff;// Sine of the angle between the axis and the furthest normal. 1 if the cone can't cull.
+};
+
+vector<Meshlet> BuildMeshlets (const vector<Vertex> &vertices, const vector<GLuint> &indices, GLuint indexCount, bool twoSided);
+bool MeshletVisible (const Meshlet &meshlet, glm::mat4 &transform, glm::mat3 &normalTransform, float scale, bool coneCulling, const FrameView &view);
+
+// Cut the first indexCount indices into meshlets. The meshlets of a twoSided mesh are never culled for facing away.
+vector<Meshlet> BuildMeshlets (const vector<Vertex> &vertices, const vector<GLuint> &indices, GLuint indexCount, bool twoSided)
+{
+    vector<Meshlet> meshlets;
+    GLuint triangleCount = indexCount / 3;
+    GLuint start = 0;
+    while (start < triangleCount)
+    {
+        // Grow the meshlet until it's full, or it's big enough and the next triangle points elsewhere
+        glm::vec3 normalSum (0.0f);
+        GLuint end = start;
+        while (end < triangleCount && end - start < MESHLET_MAX_TRIANGLES)
+        {
+            const GLuint *triangle = &indices[end * 3];
+            glm::vec3 p0 = vertices[triangle[0]].Position;
+            glm::vec3 normal = glm::cross(vertices[triangle[1]].Position - p0, vertices[triangle[2]].Position - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) normal = normal / length;
+
+            float sumLength = glm::length(normalSum);
+            if (end - start >= MESHLET_MIN_TRIANGLES && sumLength > 0.0f && glm::dot(normalSum / sumLength, normal) < MESHLET_NORMAL_SPREAD) break;
+            normalSum += normal;
+            end++;
+        }
+
+        Meshlet meshlet;
+        meshlet.firstIndex = start * 3;
+        meshlet.indexCount = (end - start) * 3;
+
+        // Bounding sphere around the box of the vertices
+        glm::vec3 minimum = vertices[indices[start * 3]].Position, maximum = minimum;
+        for (GLuint i = start * 3; i < end * 3; i++)
+        {
+            minimum = glm::min(minimum, vertices[indices[i]].Position);
+            maximum = glm::max(maximum, vertices[indices[i]].Position);
+        }
+        meshlet.centre = (minimum + maximum) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (GLuint i = start * 3; i < end * 3; i++)
+        {
+            meshlet.radius = max(meshlet.radius, glm::length(vertices[indices[i]].Position - meshlet.centre));
+        }
+
+        // Normal cone. If the normals spread over more than a hemisphere it can never cull anything.
+        float axisLength = glm::length(normalSum);
+        meshlet.coneAxis = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        float minimumDot = axisLength > 0.0f ? 1.0f : -1.0f;
+        for (GLuint t = start; t < end; t++)
+        {
+            const GLuint *triangle = &indices[t * 3];
+            glm::vec3 p0 = vertices[triangle[0]].Position;
+            glm::vec3 normal = glm::cross(vertices[triangle[1]].Position - p0, vertices[triangle[2]].Position - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) minimumDot = min(minimumDot, glm::dot(normal / length, meshlet.coneAxis));
+        }
+        meshlet.coneCutoff = twoSided || minimumDot <= 0.0f ? 1.0f : sqrtf(1.0f - minimumDot * minimumDot);
+
+        meshlets.push_back(meshlet);
+        start = end;
+    }
+    return meshlets;
+}
+
+// Whether any of the meshlet could be seen: it's at least partly inside the frustum and some of it faces the camera.
+// normalTransform is the inverse transpose of transform's upper 3x3, and scale the largest scale in transform.
+// Non-uniform scales bend the normal cone out of shape, so coneCulling should be false for those.
+bool MeshletVisible (const Meshlet &meshlet, glm::mat4 &transform, glm::mat3 &normalTransform, float scale, bool coneCulling, const FrameView &view)
+{
+    glm::vec3 centre = glm::vec3(transform * glm::vec4(meshlet.centre, 1.0f));
+    float radius = meshlet.radius * scale;
+    if (!view.frustum.SphereVisible(centre, radius)) return false;
+
+    // Backfacing if the camera is behind every triangle, i.e. outside the cone's mirror image around the sphere
+    if (!MESHLET_CONE_CULLING || !coneCulling || meshlet.coneCutoff >= 1.0f) return true;
+    glm::vec3 axis = glm::normalize(normalTransform * meshlet.coneAxis);
+    glm::vec3 toCentre = centre - view.position;
+    return glm::dot(toCentre, axis) < meshlet.coneCutoff * glm::length(toCentre) + radius;
+}
+
+#endif // MESHLET_H_INCLUDED
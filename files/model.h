@@ -7,7 +7,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
-#include "dirent.h"
+#include <mutex>
 
 #include <glew.h>
 #include <glm.hpp>
@@ -18,29 +18,209 @@
 #include <scene.h>
 #include <postprocess.h>
 #include "mesh.h"
+#include "meshCache.h"
+#include "textureRegistry.h"
+#include "asyncTexture.h"
+#include "directoryIndex.h"
+#include "meshOptimizer.h"
+#include "meshSimplifier.h"
+#include "frustum.h"
+#include "meshlet.h"
+#include "assetPack.h"
+#include "assetIOSystem.h"
+#include "textureCache.h"
+#include "renderQueue.h"
+
+// The Assimp post processing every model gets on import. Part of the mesh cache key.
+#define MODEL_IMPORT_FLAGS ( aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace )
+#define LOD_PIXEL_ERROR 1.0f// How far a level of detail may stray from full detail on screen, in pixels
+#define LOD_NEAR_DISTANCE 0.1f// Meshes closer than this (or around the camera) are treated as being this far away
 
 using namespace std;
 
+// An image decoded on a worker thread, waiting for the GL thread to upload it
+struct DecodedImage
+{
+    unsigned char *pixels = NULL;// RGB, or the whole mip chain if the image is block compressed
+    int width = 0;
+    int height = 0;
+    TextureFormat format = TEXTURE_FORMAT_RGBA8;// Anything else was read compressed from its cooked version
+};
+
+// Everything the CPU half of loading produces for one model. Nothing in here has touched OpenGL yet.
+struct ModelData
+{
+    string path;
+    string directory;
+    bool loaded = false;// False if the model couldn't be imported
+    bool streamTextures = false;// Whether the textures are left to the async loader rather than decoded here
+    vector<MeshData> meshes;
+    map<string, DecodedImage> images;// Decoded textures, by file name
+    MeshCache cache;// Keeps the cooked file mapped until the meshes are uploaded
+
+    // Free any decoded images that never got uploaded, e.g. because the registry already had them
+    ~ModelData( )
+    {
+        for ( map<string, DecodedImage>::iterator it = images.begin( ); it != images.end( ); ++it )
+        {
+            if ( it->second.pixels ) stbi_image_free( it->second.pixels );
+        }
+    }
+};
+
+ModelData * ImportModel( string path, bool streamTextures );
 GLint TextureFromFile( const char *path, string directory );
-void CreateFileList (string directory);
+DecodedImage DecodeImage( string filename );
+GLint TextureFromImage( DecodedImage &image, TextureParams params = TextureParams( ) );
 
 
 class Model
 {
 public:
     /*  Functions   */
+    Model( )
+    {
+        this->vertexFormat = DEFAULT_VERTEX_FORMAT;
+    }
+
+    // Frees the model's buffers and textures. Models hold GL objects, so they're shared (see ModelCache) rather than copied.
+    ~Model( )
+    {
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            this->meshes[i].Delete( );
+        }
+        for ( GLuint i = 0; i < this->textureRefs.size( ); i++ )
+        {
+            Textures( ).Release( this->textureRefs[i] );
+        }
+    }
+
     // Constructor, expects a filepath to a 3D model.
-    void LoadModel( GLchar *path )
+    void LoadModel( const GLchar *path )
     {
         this->loadModel( path );
     }
 
-    // Draws the model, and thus all its meshes
-    void Draw( Shader shader )
+    // The CPU half of loading: imports a model with supported ASSIMP extensions (or its cooked version) and
+    // decodes its textures, unless streamTextures says they'll be streamed in instead. Doesn't touch OpenGL or
+    // any Model, so it's safe to run on a worker thread. Read streamTextures from AsyncTextures( ) on the GL thread.
+    static ModelData * Import( string path, bool streamTextures )
+    {
+        ModelData *data = new ModelData;
+        data->path = path;
+        data->streamTextures = streamTextures;
+        // Retrieve the directory path of the filepath
+        data->directory = path.substr( 0, path.find_last_of( '/' ) );
+
+        // Skip Assimp entirely if there's an up to date cooked version of the model.
+        // Otherwise Assimp reads the model and whatever it references out of the asset pack, if it's in one.
+        if ( !importCookedModel( data ) && !importSource( data, new AssetIOSystem ) )
+        {
+            return data;
+        }
+
+        // Decode every texture the meshes use, once each, unless it's already uploaded for another model.
+        // Streamed textures are decoded later by the async loader instead.
+        for ( GLuint i = 0; i < data->meshes.size( ) && !streamTextures; i++ )
+        {
+            for ( GLuint j = 0; j < data->meshes[i].textures.size( ); j++ )
+            {
+                string file = data->meshes[i].textures[j].path;
+                TextureParams params = TextureParamsForType( data->meshes[i].textures[j].type, file );
+                if ( data->images.find( file ) == data->images.end( ) && !Textures( ).Contains( data->directory + '/' + file, params ) )
+                {
+                    data->images[file] = DecodeImage( data->directory + '/' + file );
+                }
+            }
+        }
+
+        data->loaded = true;
+        return data;
+    }
+
+    // Import a model from its source and write its cooked version, without decoding textures. Fills dependencies
+    // with every file Assimp read to do it. Used by the offline cooker.
+    static bool Cook( string path, vector<string> &dependencies )
+    {
+        ModelData data;
+        data.path = path;
+        data.directory = path.substr( 0, path.find_last_of( '/' ) );
+        AssetIOSystem *io = new AssetIOSystem( &dependencies );
+        return importSource( &data, io );
+    }
+
+    // The GL half of loading: uploads the meshes and textures of a model made by Import.
+    // Must be called on the thread that owns the OpenGL context.
+    void Upload( ModelData *data )
+    {
+        this->directory = data->directory;
+
+        for ( GLuint i = 0; i < data->meshes.size( ); i++ )
+        {
+            MeshData &meshData = data->meshes[i];
+            vector<Texture> textures;
+            for ( GLuint j = 0; j < meshData.textures.size( ); j++ )
+            {
+                textures.push_back( this->loadTexture( meshData.textures[j].path, meshData.textures[j].type, data ) );
+            }
+
+            this->meshes.push_back( Mesh( meshData, textures, this->vertexFormat ) );
+            this->bounds = this->meshes.size( ) == 1 ? this->meshes[0].GetBounds( ) : MergeBounds( this->bounds, this->meshes.back( ).GetBounds( ) );
+        }
+    }
+
+    // The box and sphere around every mesh, in model space
+    const Bounds & GetBounds( )
+    {
+        return this->bounds;
+    }
+
+    // Sets the layout the vertices of meshes uploaded from now on are stored in on the GPU (see vertexFormat.h)
+    void SetVertexFormat( VertexFormat format )
+    {
+        this->vertexFormat = format;
+    }
+
+    // Draws the model, and thus all its meshes, placed by transform
+    void Draw( Shader shader, glm::mat4 transform = glm::mat4( ) )
     {
         for ( GLuint i = 0; i < this->meshes.size( ); i++ )
         {
-            this->meshes[i].Draw( shader );
+            if ( !this->meshes[i].IsValid( ) ) continue;
+            this->meshes[i].Draw( shader, 0, transform );
+        }
+    }
+
+    // Draws every mesh that might be in view, each at the coarsest level of detail whose error would stay under
+    // LOD_PIXEL_ERROR pixels on screen. transform places the model.
+    void Draw( Shader shader, glm::mat4 transform, const FrameView &view )
+    {
+        float scale = max( glm::length( glm::vec3( transform[0] ) ), max( glm::length( glm::vec3( transform[1] ) ), glm::length( glm::vec3( transform[2] ) ) ) );
+
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            int lod;
+            float distance;
+            if ( !this->meshes[i].IsValid( ) || !this->pickLod( this->meshes[i], transform, scale, view, lod, distance ) ) continue;
+            this->meshes[i].Draw( shader, lod, transform, view );
+        }
+    }
+
+    // Like Draw, but adds the meshes in view to queue, to be drawn sorted by the state they need
+    void Queue( RenderQueue &queue, Shader &shader, glm::mat4 transform )
+    {
+        float scale = max( glm::length( glm::vec3( transform[0] ) ), max( glm::length( glm::vec3( transform[1] ) ), glm::length( glm::vec3( transform[2] ) ) ) );
+        const FrameView &view = queue.View( );
+        int transformIndex = -1;
+
+        for ( GLuint i = 0; i < this->meshes.size( ); i++ )
+        {
+            int lod;
+            float distance;
+            if ( !this->meshes[i].IsValid( ) || !this->pickLod( this->meshes[i], transform, scale, view, lod, distance ) ) continue;
+            if ( transformIndex < 0 ) transformIndex = queue.AddTransform( transform );
+            queue.Add( shader, this->meshes[i], lod, transformIndex, distance );
         }
     }
     void SetMeshMaterial (Material &mmaterial, int i)
@@ -53,34 +233,162 @@ public:
         return this->meshes[i].material;
     }
 private:
+    Model( const Model & );
+    Model & operator=( const Model & );
+
     /*  Model Data  */
     vector<Mesh> meshes;
+    Bounds bounds;
     string directory;
-    vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    VertexFormat vertexFormat;
+    vector<GLuint> textureRefs;	// Every texture reference this model holds in the texture registry, released when the model goes away
 
     /*  Functions   */
+    // Whether mesh might be in view, and if it is, its level of detail and how far it is from the camera. scale is the biggest scale in transform.
+    bool pickLod( Mesh &mesh, const glm::mat4 &transform, float scale, const FrameView &view, int &lod, float &distance )
+    {
+        glm::vec3 centre = glm::vec3( transform * glm::vec4( mesh.GetBoundingCentre( ), 1.0f ) );
+        float radius = mesh.GetBoundingRadius( ) * scale;
+        if ( !view.frustum.SphereVisible( centre, radius ) ) return false;
+
+        distance = max( glm::length( centre - view.position ) - radius, LOD_NEAR_DISTANCE );
+        const vector<MeshLod> &lods = mesh.GetLods( );
+        lod = 0;
+        while ( lod + 1 < ( int )lods.size( ) && lods[lod + 1].error * scale * view.pixelsPerUnit / distance <= LOD_PIXEL_ERROR )
+        {
+            lod++;
+        }
+        return true;
+    }
+
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel( string path )
+    {
+        ModelData *data = Import( path, AsyncTextures( ).IsEnabled( ) );
+        this->Upload( data );
+        delete data;
+    }
+
+    // Imports the model at data->path through Assimp, optimizes its meshes and writes the cooked version.
+    // io is how Assimp reads files, the importer deletes it.
+    static bool importSource( ModelData *data, Assimp::IOSystem *io )
     {
         // Read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene *scene = importer.ReadFile( path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace );
+        importer.SetIOHandler( io );
+        const aiScene *scene = importer.ReadFile( data->path, MODEL_IMPORT_FLAGS );
 
         // Check for errors
         if( !scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode ) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString( ) << endl;
-            return;
+            return false;
         }
-        // Retrieve the directory path of the filepath
-        this->directory = path.substr( 0, path.find_last_of( '/' ) );
 
         // Process ASSIMP's root node recursively
-        this->processNode( scene->mRootNode, scene );
+        processNode( data, scene->mRootNode, scene );
+
+        // Weld duplicate vertices, reorder for the vertex cache, overdraw and vertex fetch, then build the levels of detail.
+        // The cooked version keeps the result.
+        VertexCacheStats before, after, totalBefore, totalAfter;
+        for ( GLuint i = 0; i < data->meshes.size( ); i++ )
+        {
+            OptimizeMesh( data->meshes[i], before, after );
+            totalBefore.triangles += before.triangles;
+            totalBefore.vertices += before.vertices;
+            totalBefore.transforms += before.transforms;
+            totalAfter.triangles += after.triangles;
+            totalAfter.vertices += after.vertices;
+            totalAfter.transforms += after.transforms;
+            data->meshes[i].meshlets = BuildMeshlets( data->meshes[i].vertices, data->meshes[i].indices, data->meshes[i].indices.size( ), data->meshes[i].twoSided );
+            GenerateLods( data->meshes[i] );
+            data->meshes[i].CompactIndices( );
+        }
+        if ( totalBefore.triangles && totalBefore.vertices )
+        {
+            cout << "Optimized " << data->path << ": ACMR " << ( float )totalBefore.transforms / totalBefore.triangles << " -> " << ( float )totalAfter.transforms / totalAfter.triangles
+                 << ", ATVR " << ( float )totalBefore.transforms / totalBefore.vertices << " -> " << ( float )totalAfter.transforms / totalAfter.vertices << endl;
+        }
+
+        // Cook the result so the next launch can skip all of the above
+        WriteMeshCache( data->path, MODEL_IMPORT_FLAGS, data->meshes );
+        return true;
+    }
+
+    // Fills in the meshes from the cooked mesh cache. Returns false if there's no usable cooked file.
+    static bool importCookedModel( ModelData *data )
+    {
+        if ( !data->cache.Open( data->path, MODEL_IMPORT_FLAGS ) )
+        {
+            return false;
+        }
+
+        for ( GLuint i = 0; i < data->cache.MeshCount( ); i++ )
+        {
+            // The blobs stay in the mapping and get uploaded straight from there
+            MeshData meshData;
+            meshData.mappedVertices = data->cache.GetVertices( i );
+            meshData.vertexCount = data->cache.GetVertexCount( i );
+            meshData.mappedIndices = data->cache.GetIndices( i );
+            meshData.indexType = data->cache.GetIndexType( i );
+            meshData.lods = data->cache.GetLods( i );
+            meshData.meshlets = data->cache.GetMeshlets( i );
+            meshData.indexCount = data->cache.GetIndexCount( i );
+            meshData.textures = data->cache.GetTextures( i );
+            data->meshes.push_back( meshData );
+        }
+        return true;
+    }
+
+    // Gets a texture from the texture registry, uploading or streaming it if no model has yet. data may have it decoded already.
+    Texture loadTexture( string file, string type, ModelData *data )
+    {
+        string path = this->directory + '/' + file;
+        TextureParams params = TextureParamsForType( type, file );
+
+        Texture texture;
+        texture.path = file;
+        texture.type = type;
+        texture.id = Textures( ).Acquire( path, params );
+        if ( texture.id == 0 && data->streamTextures )
+        {
+            // Stream it in over the next few frames, drawing with a flat placeholder until then
+            texture.id = AsyncTextures( ).Load( path, params, PlaceholderForType( type ) );
+            Textures( ).Add( path, params, texture.id, 1, 1, 4 );
+        }
+        else if ( texture.id == 0 )
+        {
+            // Use the image decoded by the importer if there is one, or decode it now if not
+            DecodedImage image;
+            map<string, DecodedImage>::iterator it = data->images.find( file );
+            if ( it != data->images.end( ) && it->second.pixels )
+            {
+                image = it->second;
+                it->second.pixels = NULL;// TextureFromImage frees it
+            }
+            else
+            {
+                image = DecodeImage( path );
+            }
+
+            // A texture that can't be read isn't registered, so the next model to ask for it tries again
+            if ( !image.pixels )
+            {
+                cout << "ERROR::MODEL:: Failed to load texture " << path << endl;
+                texture.id = -1;
+                return texture;
+            }
+
+            TextureFormat format = image.format;
+            texture.id = TextureFromImage( image, params );
+            Textures( ).Add( path, params, texture.id, image.width, image.height, 4, StoredTextureFormat( format, params.internalFormat ) );
+        }
+        this->textureRefs.push_back( texture.id );
+        return texture;
     }
 
     // Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode( aiNode* node, const aiScene* scene )
+    static void processNode( ModelData *data, aiNode* node, const aiScene* scene )
     {
         // Process each mesh located at the current node
         for ( GLuint i = 0; i < node->mNumMeshes; i++ )
@@ -89,22 +397,22 @@ private:
             // The scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 
-            this->meshes.push_back( this->processMesh( mesh, scene ) );
+            data->meshes.push_back( processMesh( data, mesh, scene ) );
         }
 
         // After we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for ( GLuint i = 0; i < node->mNumChildren; i++ )
         {
-            this->processNode( node->mChildren[i], scene );
+            processNode( data, node->mChildren[i], scene );
         }
     }
 
-    Mesh processMesh( aiMesh *mesh, const aiScene *scene )
+    static MeshData processMesh( ModelData *data, aiMesh *mesh, const aiScene *scene )
     {
         // Data to fill
-        vector<Vertex> vertices;
-        vector<GLuint> indices;
-        vector<Texture> textures;
+        MeshData meshData;
+        vector<Vertex> &vertices = meshData.vertices;
+        vector<GLuint> &indices = meshData.indices;
 
         // Walk through each of the mesh's vertices
         for ( GLuint i = 0; i < mesh->mNumVertices; i++ )
@@ -190,167 +498,106 @@ private:
             */
 
             //TextFromDir(textures, material);
-            TexFromFileList(textures, material);
+            TexFromFileList(meshData.textures, data->directory, material);
+
+            int twoSided = 0;
+            if ( material->Get( AI_MATKEY_TWOSIDED, twoSided ) == AI_SUCCESS ) meshData.twoSided = twoSided != 0;
         }
 
-        // Return a mesh object created from the extracted mesh data
-        return Mesh( vertices, indices, textures );
+        // Return the extracted mesh data, ready to be uploaded
+        meshData.vertexCount = vertices.size( );
+        meshData.indexCount = indices.size( );
+        return meshData;
     }
 
-    void TexFromFileList (vector<Texture> &textures, aiMaterial *mat)
+    // Binds the first texture of each type found next to the model. The directory is only listed once, however many meshes ask.
+    static void TexFromFileList (vector<TextureBinding> &textures, string directory, aiMaterial *mat)
     {
-        CreateFileList(directory);
-        // Make input file
-        ifstream fin;
-        fin.open( string(directory + "/FileList.txt").c_str() );
-        if (!fin.is_open())
-        {
-            cout << "FileList.txt failed to open!" << endl;
-            return;
-        }
-        // Read from FileList.txt and put each file in the string
-        vector <string> strVec;
-        do
+        shared_ptr<const DirectoryTextures> found = Directories( ).Get( directory );
+        for ( map<string, string>::const_iterator it = found->bySemantic.begin( ); it != found->bySemantic.end( ); ++it )
         {
-            string strHold;
-            // Read line
-            getline(fin,strHold);
-            // Check each file and see if it has a texture prefix
-            if (strHold[0]=='T' && strHold[1]=='_') strVec.push_back(strHold);
-        }
-        while (!fin.eof());
-        // Check each file and see if it has a texture prefix
-        fin.close();
-
-        for (int i = 0; i < strVec.size(); i++)
-        {
-            string str = strVec[i];
-            GLboolean skip = false;
-            for ( GLuint j = 0; j < textures_loaded.size( ); j++ )
-            {
-                if( textures_loaded[j].path == aiString(str) )
-                {
-                    textures.push_back( textures_loaded[j] );
-                    skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-
-                    break;
-                }
-            }
-
-            if( !skip )
-            {
-                // If texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile( str.c_str( ), this->directory );
-                texture.path = str;
-                if ( str[2] == 'A' && str[3] == 'L' && str[4] == '_' )
-                {
-                    texture.type = "texture_albedo";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'S' && str[3] == 'P' && str[4] == '_')
-                {
-                    texture.type = "texture_specular";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'N' && str[3] == 'O' && str[4] == '_')
-                {
-                    texture.type = "texture_normal";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'M' && str[3] == 'E' && str[4] == '_')
-                {
-                    texture.type = "texture_metallic";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'R' && str[3] == 'O' && str[4] == '_')
-                {
-                    texture.type = "texture_roughness";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'O' && str[3] == 'P' && str[4] == '_')
-                {
-                    texture.type = "texture_opacity";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'A' && str[3] == 'O' && str[4] == '_')
-                {
-                    texture.type = "texture_AO";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'S' && str[3] == 'C' && str[4] == '_')
-                {
-                    texture.type = "texture_SSColour";
-                    textures.push_back( texture );
-                }
-                if ( str[2] == 'S' && str[3] == 'S' && str[4] == '_')
-                {
-                    texture.type = "texture_SSS";
-                    textures.push_back( texture );
-                }
-                this->textures_loaded.push_back( texture );  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            if ( IsPackedTextureType( it->first ) ) continue;// Those are only bound packed into texture_ORM
+            TextureBinding texture;
+            texture.type = it->first;
+            texture.path = it->second;
+            textures.push_back( texture );
         }
     }
 };
 
+// Imports a model on the calling thread. Shorthand for Model::Import so loaders can pass it around.
+ModelData * ImportModel( string path, bool streamTextures )
+{
+    return Model::Import( path, streamTextures );
+}
+
 GLint TextureFromFile( const char *path, string directory )
 {
     //Generate texture ID and load texture data
     string filename = string( path );
     filename = directory + '/' + filename;
-    GLuint textureID;
-    glGenTextures( 1, &textureID );
+    DecodedImage image = DecodeImage( filename );
+    return TextureFromImage( image );
+}
 
-    int width, height, nrComponents;
-    unsigned char *image = stbi_load(filename.c_str( ), &width, &height, &nrComponents, STBI_rgb );
+// Decodes an image file into RGB pixels, or reads its block compressed mip chain if it's been cooked to one.
+// Doesn't touch OpenGL, so it's safe on a worker thread.
+DecodedImage DecodeImage( string filename )
+{
+    DecodedImage image;
+    int nrComponents;
+    image.format = CompressedTextureFormat( filename );
+    if ( image.format != TEXTURE_FORMAT_RGBA8 && TextureAssetInfo( filename, &image.width, &image.height, &nrComponents ) )
+    {
+        image.pixels = ( unsigned char * )malloc( TextureChainSize( image.format, image.width, image.height, MipLevelCount( image.width, image.height ) ) );
+        if ( image.pixels && LoadCompressedTextureAsset( filename, image.format, image.width, image.height, image.pixels ) ) return image;
+        free( image.pixels );// Cooked again since it was checked, so decode the source after all
+    }
+    image.format = TEXTURE_FORMAT_RGBA8;
+    image.pixels = LoadTextureAsset( filename, &image.width, &image.height, &nrComponents, STBI_rgb_alpha );// Alpha too, for packed textures' specular channel
     //unsigned char *image = SOIL_load_image( filename.c_str( ), &width, &height, 0, SOIL_LOAD_RGB );
+    return image;
+}
+
+// Uploads a decoded image as a texture, then frees its pixels
+GLint TextureFromImage( DecodedImage &image, TextureParams params )
+{
+    GLuint textureID;
+    glGenTextures( 1, &textureID );
 
     // Assign texture to ID
     glBindTexture( GL_TEXTURE_2D, textureID );
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_SRGB_ALPHA, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image );
-    glGenerateMipmap( GL_TEXTURE_2D );
+    if ( image.format != TEXTURE_FORMAT_RGBA8 )
+    {
+        // Compressed images come with their mip chain, which is uploaded as it is
+        GLint internalFormat = StoredTextureFormat( image.format, params.internalFormat );
+        int levels = params.mipmaps ? MipLevelCount( image.width, image.height ) : 1;
+        unsigned char *level = image.pixels;
+        for ( int i = 0; i < levels; i++ )
+        {
+            int width = max( 1, image.width >> i ), height = max( 1, image.height >> i );
+            GLsizei size = TextureLevelSize( image.format, width, height );
+            glCompressedTexImage2D( GL_TEXTURE_2D, i, internalFormat, width, height, 0, size, level );
+            level += size;
+        }
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1 );
+    }
+    else
+    {
+        glTexImage2D( GL_TEXTURE_2D, 0, params.internalFormat, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels );
+        if ( params.mipmaps ) glGenerateMipmap( GL_TEXTURE_2D );
+    }
 
     // Parameters
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, params.wrap );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, params.wrap );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, params.minFilter );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, params.magFilter );
     glBindTexture( GL_TEXTURE_2D, 0 );
-    stbi_image_free(image);
+    if ( image.pixels ) stbi_image_free( image.pixels );
+    image.pixels = NULL;
 
     return textureID;
 }
 
-// If a list doesn't already exist, make a list of the files in the object's directory
-void CreateFileList (string directory)
-{
-    // Check if a file list already exists
-    ifstream fin;
-    fin.open( string(directory + "/FileList.txt").c_str() );
-    // If the file can't open (doesn't exist) then make one
-    if (!fin.is_open())
-    {
-        DIR *dir;
-        struct dirent *ent;
-        if (((dir = opendir (directory.c_str()))) != NULL)
-        {
-            ofstream fout;
-            fout.open (string(directory + "/FileList.txt").c_str(),ios_base::out|ios_base::app);
-            while ((ent = readdir (dir)) != NULL)
-            {
-                fout << ent->d_name <<endl;
-            }
-            closedir (dir);
-            fout.close();
-        }
-        else
-        {
-            /* could not open directory */
-            perror ("");
-        }
-    }
-    fin.close();
-}
-
 #endif // MODEL_H_INCLUDED
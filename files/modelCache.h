@@ -0,0 +1,151 @@
+#ifndef MODELCACHE_H_INCLUDED
+#define MODELCACHE_H_INCLUDED
+
+/***********
+This header holds the process-wide model cache.
+
+Objects and lights used to own a Model each, so four lights with the same sphere meant four
+imports, four sets of buffers and four sets of textures. Now the cache loads each path once
+and hands out ModelHandle's that all point at the same model. The model is freed once the
+last handle to it goes away, so memory scales with unique assets, not with instances.
+************/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include "model.h"
+#include "modelLoader.h"
+
+using namespace std;
+
+/********************
+ModelHandle: A cheap, copyable reference to a model shared through the ModelCache.
+A handle only draws the model, so one instance can't change what the others look like.
+*********************/
+class ModelHandle
+{
+public:
+    ModelHandle ()
+    {
+    }
+
+    explicit ModelHandle (shared_ptr<Model> model)
+    {
+        this->model = model;
+    }
+
+    // Draws the shared model, placed by transform
+    void Draw (Shader shader, glm::mat4 transform = glm::mat4()) const
+    {
+        if (model) model->Draw(shader, transform);
+    }
+
+    // Draws the parts of the shared model in view, at the level of detail that suits how big it is on screen (see Model::Draw)
+    void Draw (Shader shader, glm::mat4 transform, const FrameView &view) const
+    {
+        if (model) model->Draw(shader, transform, view);
+    }
+
+    // Queues the parts of the shared model in view to be drawn in state order (see Model::Queue)
+    void Queue (RenderQueue &queue, Shader &shader, glm::mat4 transform) const
+    {
+        if (model) model->Queue(queue, shader, transform);
+    }
+
+    // The box and sphere around the shared model, in model space. Empty if nothing's loaded.
+    Bounds GetBounds () const
+    {
+        return model ? model->GetBounds() : Bounds();
+    }
+
+    // Whether the handle points at a model
+    bool IsLoaded () const
+    {
+        return model != NULL;
+    }
+
+    const Model * Get () const
+    {
+        return model.get();
+    }
+
+private:
+    shared_ptr<Model> model;
+};
+
+class ModelCache
+{
+public:
+    // Get a handle to the model at path, loading it if it isn't already loaded
+    ModelHandle Get (string path)
+    {
+        vector<string> paths (1, path);
+        return GetAll(paths)[0];
+    }
+
+    // Get handles to every model in paths. Any that aren't loaded yet are loaded together, in parallel.
+    vector<ModelHandle> GetAll (vector<string> paths)
+    {
+        vector<ModelHandle> handles (paths.size());
+        vector<Model *> toLoad;
+        vector<string> toLoadPaths;
+        map<string, shared_ptr<Model> > pending;
+
+        for (unsigned int i = 0; i < paths.size(); i++)
+        {
+            string key = canonicalPath(paths[i]);
+            shared_ptr<Model> model = models[key].lock();
+            if (!model)
+            {
+                // Not resident, or asked for twice in this same call
+                model = pending[key];
+                if (!model)
+                {
+                    model = shared_ptr<Model>(new Model);
+                    pending[key] = model;
+                    models[key] = model;
+                    toLoad.push_back(model.get());
+                    toLoadPaths.push_back(key);
+                }
+            }
+            handles[i] = ModelHandle(model);
+        }
+
+        LoadModels(toLoad, toLoadPaths);
+        return handles;
+    }
+
+    // How many distinct models are loaded right now
+    unsigned int ResidentCount ()
+    {
+        unsigned int count = 0;
+        for (map<string, weak_ptr<Model> >::iterator it = models.begin(); it != models.end(); ++it)
+        {
+            if (!it->second.expired()) count++;
+        }
+        return count;
+    }
+
+private:
+    map<string, weak_ptr<Model> > models;// Weak, so the cache alone doesn't keep a model alive
+
+    // The same file spelled with different slashes should still only load once
+    string canonicalPath (string path)
+    {
+        for (unsigned int i = 0; i < path.size(); i++)
+        {
+            if (path[i] == '\\') path[i] = '/';
+        }
+        return path;
+    }
+};
+
+// The cache shared by the whole engine. Only use it from the GL thread.
+ModelCache & Models ()
+{
+    static ModelCache cache;
+    return cache;
+}
+
+#endif // MODELCACHE_H_INCLUDED
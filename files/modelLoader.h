@@ -0,0 +1,108 @@
+#ifndef MODELLOADER_H_INCLUDED
+#define MODELLOADER_H_INCLUDED
+
+/***********
+This header loads many models at once.
+
+Loading is split in two: Model::Import does the Assimp import (or cooked cache read), builds
+the vertex data and decodes the textures, and runs on the worker pool. Model::Upload makes the
+buffers and textures, so it runs here on the GL thread, one model at a time as imports finish.
+************/
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <condition_variable>
+#include "model.h"
+#include "threadPool.h"
+
+using namespace std;
+
+void LoadModels (vector<Model *> &models, vector<string> &paths);
+void BenchmarkModelLoading (vector<string> paths);
+
+// Load paths[i] into models[i] for every i, importing in parallel. Returns once everything is uploaded.
+void LoadModels (vector<Model *> &models, vector<string> &paths)
+{
+    // Finished imports wait here for the GL thread
+    mutex doneMutex;
+    condition_variable importDone;
+    deque<pair<int, ModelData *> > done;
+
+    // The loader's settings belong to this thread, so the workers get a copy
+    bool streamTextures = AsyncTextures().IsEnabled();
+    for (unsigned int i = 0; i < paths.size(); i++)
+    {
+        string path = paths[i];
+        WorkerPool().Submit([i, path, streamTextures, &doneMutex, &importDone, &done]
+        {
+            ModelData *data = Model::Import(path, streamTextures);
+            {
+                lock_guard<mutex> lock (doneMutex);
+                done.push_back(make_pair(i, data));
+            }
+            importDone.notify_one();
+        });
+    }
+
+    // Upload each model as soon as its import is done, while the rest keep importing
+    for (unsigned int uploaded = 0; uploaded < paths.size(); uploaded++)
+    {
+        pair<int, ModelData *> next;
+        {
+            unique_lock<mutex> lock (doneMutex);
+            importDone.wait(lock, [&done] { return !done.empty(); });
+            next = done.front();
+            done.pop_front();
+        }
+        models[next.first]->Upload(next.second);
+        delete next.second;
+    }
+}
+
+// Prints how long it takes to load every model in paths one after another on this thread, and through LoadModels
+void BenchmarkModelLoading (vector<string> paths)
+{
+    typedef chrono::steady_clock Clock;
+
+    // Every run loads into fresh models, since loading twice into the same model appends to it
+    vector<Model *> models[3];
+    for (int run = 0; run < 3; run++)
+    {
+        for (unsigned int i = 0; i < paths.size(); i++) models[run].push_back(new Model);
+    }
+
+    // The first load of a model pays for cooking it and for the OS reading it off the disk.
+    // Get that out of the way first so it doesn't count against whichever run goes first.
+    LoadModels(models[0], paths);
+    glFinish();
+
+    Clock::time_point start = Clock::now();
+    for (unsigned int i = 0; i < paths.size(); i++)
+    {
+        models[1][i]->LoadModel(paths[i].c_str());
+    }
+    glFinish();// Uploads are queued by the driver, so wait for them before stopping the clock
+    double serialTime = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    LoadModels(models[2], paths);
+    glFinish();
+    double parallelTime = chrono::duration<double, milli>(Clock::now() - start).count();
+
+    cout << "Loaded " << paths.size() << " models" << endl;
+    cout << "Serial:   " << serialTime << " ms" << endl;
+    cout << "Parallel: " << parallelTime << " ms on " << WorkerPool().Size() << " worker threads" << endl;
+    cout << "Speedup:  " << serialTime / parallelTime << "x" << endl;
+
+    // Only the Model objects are freed here, the benchmark doesn't bother cleaning up their GL objects
+    for (int run = 0; run < 3; run++)
+    {
+        for (unsigned int i = 0; i < models[run].size(); i++) delete models[run][i];
+    }
+}
+
+#endif // MODELLOADER_H_INCLUDED
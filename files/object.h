@@ -2,6 +2,8 @@
 #define OBJECT_H_INCLUDED
 
 #include "model.h"
+#include "modelCache.h"
+#include "lightClusters.h"
 #include <iostream>
 #include <string>
 #include <SDL_opengl.h>
@@ -30,7 +32,7 @@ public:
 
     GLchar * meshDir;// Mesh directory for the model
 
-    Model model;// The object's model
+    ModelHandle model;// The object's model, shared with every other object using the same mesh
 
     Object (glm::vec3 location, glm::vec3 rotation, glm::vec3 scale, GLchar * meshDir)
     {
@@ -39,6 +41,25 @@ public:
         this->scale = scale;
         this->meshDir = meshDir;
     }
+
+    // The model matrix: scaled, rotated about z, y then x, and moved to location
+    glm::mat4 Transform () const
+    {
+        glm::mat4 model;
+        model = glm::translate(model, location);
+        model = glm::scale(model, scale);
+        model = glm::rotate(model, rotation.z, glm::vec3(0.0f,0.0f,1.0f));
+        model = glm::rotate(model, rotation.y, glm::vec3(0.0f,1.0f,0.0f));
+        model = glm::rotate(model, rotation.x, glm::vec3(1.0f,0.0f,0.0f));
+        return model;
+    }
+
+    // The box and sphere around the object where it is now. After changing location, rotation or scale, give these
+    // to the scene's BVH::Refit.
+    Bounds WorldBounds () const
+    {
+        return TransformBounds(model.GetBounds(), Transform());
+    }
 };
 
 // Light
@@ -60,7 +81,7 @@ public:
 
     GLchar * meshDir;// Mesh directory for the model
 
-    Model model;// The object's model
+    ModelHandle model;// The object's model, shared with every other object using the same mesh
 
     Light (glm::vec3 locaton, glm::vec3 diffuse, glm::vec3 ambient, glm::vec3 direction, float cutOff, float outerCutOff, int type, GLchar * meshDir)
     {
@@ -75,6 +96,15 @@ public:
         this->meshDir = meshDir;
     }
 
+    // Where the light's model is drawn: at the light, a tenth of its size
+    glm::mat4 Transform () const
+    {
+        glm::mat4 model;
+        model = glm::translate(model, location);
+        model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
+        return model;
+    }
+
     void Draw( Shader shader )// A function meant to be used in a loop to automate the process of passing all uniform information to the fragment shader
     {
         // OpenGL is weird. I need to specify the exact name of the uniform I want to find the location of, but in a GLchar
@@ -164,36 +194,13 @@ public:
     }
 };
 
-void DrawAllLights(Shader shader, vector <Light> lights );
-string name (string index, string parameter);
+void AddLights(LightClusters &clusters, const vector<Light> &lights );
 
-void DrawAllLights(Shader shader, vector<Light> lights )// A function meant to be used in a loop to automate the process of passing all uniform information to the fragment shader
+void AddLights(LightClusters &clusters, const vector<Light> &lights )// Hand every light to the clusters for this frame
 {
-    for (int i = 0; i < lights.size(); i++)
-    {
-        // Convert index to char pointer
-        char * indexChar = new char [lights.size()];
-        (itoa(i, indexChar, 10));
-        // Convert char pointer to string
-        string index = string(indexChar);
-        delete [] indexChar;
-        // Set uniforms
-        glUniform3f(glGetUniformLocation(shader.Program, name(index, "position").c_str() ), lights[i].location.x, lights[i].location.y, lights[i].location.z);
-        glUniform3f(glGetUniformLocation(shader.Program, name(index, "diffuse").c_str() ), lights[i].diffuse.r, lights[i].diffuse.g, lights[i].diffuse.b);
-        glUniform3f(glGetUniformLocation(shader.Program, name(index, "ambient").c_str() ), lights[i].ambient.r, lights[i].ambient.g, lights[i].ambient.b);
-        glUniform3f(glGetUniformLocation(shader.Program, name(index, "direction").c_str() ), lights[i].direction.x, lights[i].direction.y, lights[i].direction.z);
-        glUniform1f(glGetUniformLocation(shader.Program, name(index, "cutOff").c_str() ), lights[i].cutOff);
-        glUniform1f(glGetUniformLocation(shader.Program, name(index, "outerCutOff").c_str() ), lights[i].outerCutOff);
-        glUniform1f(glGetUniformLocation(shader.Program, name(index, "type").c_str() ), lights[i].type);
-    }
-    // Tell the fragment shader how many lights there are
-    glUniform1i (glGetUniformLocation(shader.Program, "LIGHT_AMOUNT" ), lights.size());
+    for (int i = 0; i < lights.size(); i++) clusters.Add(lights[i].location, lights[i].diffuse, lights[i].type);
 }
 
-string name (string index, string parameter)
-{
-    return string("light[" + index + "]." + parameter);
-}
 /*
 GLchar const * name (string index, string parameter)
 {
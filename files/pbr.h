@@ -10,9 +10,15 @@
 #include <Importer.hpp>
 #include <scene.h>
 #include <postprocess.h>
+#include "texturePacking.h"
+#include "materialArrays.h"
+#include "hash.h"
+#include "shader.h"
 
 using namespace std;
 
+UniformBlockPool & MaterialBlocks ();
+
 struct Texture
 {
     GLint id = -1;
@@ -33,11 +39,18 @@ private:
 
     // The authorable texture components of the material
     Texture albedoTexture;
-    Texture specularTexture;
     Texture normalTexture;
-    Texture metallicTexture;
-    Texture roughnessTexture;
-    Texture AOTexture;
+    Texture ORMTexture;// Occlusion, roughness, metallic and specular packed into one (see texturePacking.h)
+
+    // Which maps the material has: bit 0 albedo, bit 1 normal, bits 2 to 5 the packed channels
+    int mapMask = 0;
+
+    // The material's row in the material table, if its textures are in the material arrays (see materialArrays.h)
+    int tableIndex = -1;
+    unsigned int tableGeneration = 0;
+
+    // Where the material's values are in the material blocks, -1 until they're first needed
+    GLintptr blockOffset = -1;
 
     // A function to author a material
 public:
@@ -45,11 +58,13 @@ public:
     void SetText (Texture &texture, string type)
     {
         if (type == "texture_albedo") albedoTexture = texture;
-        if (type == "texture_specular") specularTexture = texture;
         if (type == "texture_normal") normalTexture = texture;
-        if (type == "texture_metallic") metallicTexture = texture;
-        if (type == "texture_roughness") roughnessTexture = texture;
-        if (type == "texture_AO") AOTexture = texture;
+        if (type == "texture_ORM") ORMTexture = texture;
+
+        mapMask = (albedoTexture.id >= 0 ? 1 : 0) | (normalTexture.id >= 0 ? 2 : 0);
+        if (ORMTexture.id >= 0) mapMask |= PackedChannelMask(ORMTexture.path.C_Str()) << 2;
+        tableIndex = -1;
+        blockOffset = -1;
     }
 
     void SetMMaterial (glm::vec3 albedo, float specular, glm::vec3 normal, float metallic, float roughness, float AO)
@@ -60,56 +75,67 @@ public:
         this->metallicHolder = metallic;
         this->roughnessHolder = roughness;
         this->AOHolder = AO;
+        this->blockOffset = -1;
+    }
+
+    // A hash of everything Draw sets, so draws of materials that look the same can share one Draw (see RenderQueue)
+    uint64_t StateHash ()
+    {
+        GLint ids[3] = { albedoTexture.id, normalTexture.id, ORMTexture.id };
+        float holders[10] = { albedoHolder.r, albedoHolder.g, albedoHolder.b, specularHolder, normalHolder.r, normalHolder.g, normalHolder.b,
+                              metallicHolder, roughnessHolder, AOHolder };
+        return HashBytes(holders, sizeof(holders), HashBytes(ids, sizeof(ids), mapMask));
     }
 
     void Draw (Shader &shader)
     {
-        glActiveTexture( GL_TEXTURE0 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_albedo"), 0);
-        glBindTexture( GL_TEXTURE_2D, albedoTexture.id );
-
-        glActiveTexture( GL_TEXTURE0 + 1 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_specular"), 1);
-        glBindTexture( GL_TEXTURE_2D, specularTexture.id );
-
-        glActiveTexture( GL_TEXTURE0 + 2 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_normal"), 2);
-        glBindTexture( GL_TEXTURE_2D, normalTexture.id );
-
-        glActiveTexture( GL_TEXTURE0 + 3 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_metallic"), 3);
-        glBindTexture( GL_TEXTURE_2D, metallicTexture.id );
-
-        glActiveTexture( GL_TEXTURE0 + 4 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_roughness"), 4);
-        glBindTexture( GL_TEXTURE_2D, roughnessTexture.id );
-
-        glActiveTexture( GL_TEXTURE0 + 5 ); // Active proper texture unit before binding
-        glUniform1i(glGetUniformLocation(shader.Program, "material.texture_AO"), 5);
-        glBindTexture( GL_TEXTURE_2D, AOTexture.id );
-
-        // Send info about which textures are missing
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasAL"), albedoTexture.id + 1);
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasSP"), specularTexture.id + 1);
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasNO"), normalTexture.id + 1);
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasME"), metallicTexture.id + 1);
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasRO"), roughnessTexture.id + 1);
-        glUniform1i(glGetUniformLocation(shader.Program, "material.hasAO"), AOTexture.id + 1);
-
-    int hasAL;
-    int hasSP;
-    int hasNO;
-    int hasME;
-    int hasRO;
-    int hasAO;
-
-        glUniform3f(glGetUniformLocation(shader.Program, "material.albedoHolder"), albedoHolder.r, albedoHolder.g, albedoHolder.b);
-        glUniform1f(glGetUniformLocation(shader.Program, "material.specularHolder"), specularHolder);
-        glUniform3f(glGetUniformLocation(shader.Program, "material.normalHolder"), normalHolder.r, normalHolder.g, normalHolder.b);
-        glUniform1f(glGetUniformLocation(shader.Program, "material.metallicHolder"), metallicHolder);
-        glUniform1f(glGetUniformLocation(shader.Program, "material.roughnessHolder"), roughnessHolder);
-        glUniform1f(glGetUniformLocation(shader.Program, "material.AOHolder"), AOHolder);
+        // A material whose textures are in the material arrays only has to say which row of the table it is
+        GLint maps[MATERIAL_MAP_COUNT] = { albedoTexture.id, normalTexture.id, ORMTexture.id };
+        int index = MaterialTextures().Resolve(maps, mapMask, tableIndex, tableGeneration);
+        shader.SetInt(UNIFORM("material.index"), index);
+        if (index >= 0)
+        {
+            MaterialTextures().Bind(index);
+        }
+        else
+        {
+            glActiveTexture( GL_TEXTURE0 ); // Active proper texture unit before binding
+            shader.SetInt(UNIFORM("material.texture_albedo"), 0);
+            glBindTexture( GL_TEXTURE_2D, albedoTexture.id );
+
+            glActiveTexture( GL_TEXTURE0 + 1 ); // Active proper texture unit before binding
+            shader.SetInt(UNIFORM("material.texture_normal"), 1);
+            glBindTexture( GL_TEXTURE_2D, normalTexture.id );
+
+            glActiveTexture( GL_TEXTURE0 + 2 ); // Active proper texture unit before binding
+            shader.SetInt(UNIFORM("material.texture_ORM"), 2);
+            glBindTexture( GL_TEXTURE_2D, ORMTexture.id );
+
+        }
+
+        // The values and which textures are missing are in the material's block, written once and bound by range after that
+        if (blockOffset < 0)
+        {
+            MaterialUniforms values;
+            values.albedoHolder = albedoHolder;
+            values.specularHolder = specularHolder;
+            values.normalHolder = normalHolder;
+            values.metallicHolder = metallicHolder;
+            values.roughnessHolder = roughnessHolder;
+            values.AOHolder = AOHolder;
+            values.has = mapMask;
+            values.padding = 0;
+            blockOffset = MaterialBlocks().Add(&values);
+        }
+        MaterialBlocks().Bind(blockOffset);
     }
 };
 
+// The blocks of every material, shared by the whole engine. Only use it from the GL thread.
+UniformBlockPool & MaterialBlocks ()
+{
+    static UniformBlockPool pool (MATERIAL_BLOCK_BINDING, sizeof(MaterialUniforms));
+    return pool;
+}
+
 #endif // PBR_H_INCLUDED
@@ -0,0 +1,310 @@
+#ifndef RENDERQUEUE_H_INCLUDED
+#define RENDERQUEUE_H_INCLUDED
+
+/***********
+This header holds the render queue, which sorts a frame's draws by the state they need.
+
+Instead of drawing as they're visited, models add a packet per visible mesh to the queue:
+the shader, the mesh (and so its material and VAO), the level of detail, the index of the
+model's transform, and how far away it is. Submit sorts the packets by a 64 bit key and
+draws them in order, only changing the program, material or VAO when the next packet needs
+a different one. State changes then go with the number of distinct states in the frame, not
+the number of objects in it.
+
+Packets for the same mesh at the same level of detail with the same program and material
+end up next to each other, and are drawn as one instanced draw: their model matrices are
+copied to the geometry pool's instance buffer in draw order, and the run is drawn with
+Mesh::DrawInstances. A thousand copies of a rock then cost one draw call. A mesh drawn once
+goes through Mesh::DrawGeometry instead, which can still cull its meshlets.
+
+Key layout, most significant first:
+    1 bit    layer (0 opaque, 1 for anything that has to be drawn after it)
+    11 bits  program
+    20 bits  material
+    4 bits   vertex format, which picks the VAO
+    12 bits  mesh, so copies of a mesh are next to each other to be instanced
+    16 bits  depth, front to back
+
+Programs, materials and meshes are numbered in the order they're first seen in the frame, and
+the numbers are forgotten when the next frame begins. So the tables only hold what's in view,
+and a mesh or program made where a deleted one used to be doesn't inherit its number.
+Material numbers come from a hash of everything the material sets (see Material::StateHash),
+so two meshes with the same textures and values share one. Depth is the top bits of the distance as a float,
+which sort the same way as the distances do. Depth coming after the mesh means front to back
+only holds within a mesh's instances, which is the price of drawing them together.
+
+The keys are sorted with an LSD radix sort, a byte a pass, skipping the bytes every key has
+the same.
+************/
+
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <string.h>
+#include <stdint.h>
+#include <glew.h>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+#include "shader.h"
+#include "frustum.h"
+#include "geometryPool.h"
+#include "mesh.h"
+
+#define RENDER_KEY_LAYER_SHIFT 63
+#define RENDER_KEY_PROGRAM_SHIFT 52
+#define RENDER_KEY_MATERIAL_SHIFT 32
+#define RENDER_KEY_FORMAT_SHIFT 28
+#define RENDER_KEY_MESH_SHIFT 16
+#define RENDER_KEY_PROGRAM_BITS 11
+#define RENDER_KEY_MATERIAL_BITS 20
+#define RENDER_KEY_MESH_BITS 12
+#define RENDER_KEY_DEPTH_BITS 16
+
+using namespace std;
+
+enum RenderLayer
+{
+    RENDER_LAYER_OPAQUE,
+    RENDER_LAYER_LATE// Drawn after everything opaque, like transparent meshes
+};
+
+// One draw waiting in the queue
+struct DrawPacket
+{
+    uint64_t key;
+    Shader *shader;
+    Mesh *mesh;
+    int lod;
+    unsigned int transform;// Index into the queue's transforms
+    uint64_t material;// The material's full state hash, in case two materials ever get the same number
+};
+
+// What the last Submit did
+struct RenderQueueStats
+{
+    unsigned int draws;
+    unsigned int instances;// Meshes drawn, counting every copy an instanced draw made
+    unsigned int programChanges;
+    unsigned int materialChanges;
+    unsigned int vertexArrayChanges;
+};
+
+// A key and where the packet it belongs to is, for sorting
+struct SortItem
+{
+    uint64_t key;
+    uint32_t index;
+};
+
+void RadixSort (vector<SortItem> &items, vector<SortItem> &scratch);
+
+class RenderQueue
+{
+public:
+    RenderQueue ()
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    // Start a new frame, seen from view, forgetting last frame's packets
+    void Begin (const FrameView &view)
+    {
+        this->view = view;
+        packets.clear();
+        transforms.clear();
+        programNumbers.clear();
+        materialNumbers.clear();
+        meshNumbers.clear();
+    }
+
+    // The view the frame is seen from, for culling and picking levels of detail
+    const FrameView & View () const
+    {
+        return view;
+    }
+
+    // Keep a model matrix for this frame's packets to refer to
+    unsigned int AddTransform (const glm::mat4 &transform)
+    {
+        transforms.push_back(transform);
+        return transforms.size() - 1;
+    }
+
+    // Queue a draw of mesh at level of detail lod with shader. depth is how far the mesh is from the camera.
+    void Add (Shader &shader, Mesh &mesh, int lod, unsigned int transform, float depth, RenderLayer layer = RENDER_LAYER_OPAQUE)
+    {
+        if (!mesh.IsValid()) return;// It never made it into the geometry pool
+
+        DrawPacket packet;
+        packet.shader = &shader;
+        packet.mesh = &mesh;
+        packet.lod = lod;
+        packet.transform = transform;
+        packet.material = mesh.material.StateHash();
+
+        uint32_t depthBits;
+        depth = max(depth, 0.0f);
+        memcpy(&depthBits, &depth, sizeof(depthBits));
+        packet.key = (uint64_t)layer << RENDER_KEY_LAYER_SHIFT |
+                     (uint64_t)programNumber(shader.Program) << RENDER_KEY_PROGRAM_SHIFT |
+                     (uint64_t)materialNumber(packet.material) << RENDER_KEY_MATERIAL_SHIFT |
+                     (uint64_t)mesh.GetVertexFormat() << RENDER_KEY_FORMAT_SHIFT |
+                     (uint64_t)meshNumber(&mesh) << RENDER_KEY_MESH_SHIFT |
+                     depthBits >> (32 - RENDER_KEY_DEPTH_BITS);
+        packets.push_back(packet);
+    }
+
+    // Sort the frame's packets and draw them, changing only the state that differs from the packet before, and
+    // drawing runs of the same mesh as one instanced draw
+    void Submit ()
+    {
+        items.resize(packets.size());
+        for (unsigned int i = 0; i < packets.size(); i++)
+        {
+            items[i].key = packets[i].key;
+            items[i].index = i;
+        }
+        RadixSort(items, scratch);
+
+        // The matrices go up in draw order, so each run's instances are next to each other
+        instances.resize(items.size());
+        for (unsigned int i = 0; i < items.size(); i++) instances[i] = transforms[packets[items[i].index].transform];
+        if (!instances.empty()) Geometry().UploadInstances(&instances[0], instances.size());
+
+        memset(&stats, 0, sizeof(stats));
+        GLuint program = 0;
+        uint64_t material = 0;
+        bool materialBound = false;
+        int format = -1;
+        for (unsigned int i = 0, count; i < items.size(); i += count)
+        {
+            DrawPacket &packet = packets[items[i].index];
+            count = 1;
+            while (i + count < items.size() && sameDraw(packet, packets[items[i + count].index])) count++;
+
+            if (packet.shader->Program != program)
+            {
+                program = packet.shader->Program;
+                glUseProgram(program);
+                materialBound = false;// Uniforms belong to the program, so the new one needs its material set too
+                stats.programChanges++;
+            }
+            if (!materialBound || packet.material != material)
+            {
+                packet.mesh->material.Draw(*packet.shader);
+                material = packet.material;
+                materialBound = true;
+                stats.materialChanges++;
+            }
+            if (packet.mesh->GetVertexFormat() != format)
+            {
+                format = packet.mesh->GetVertexFormat();
+                Geometry().Bind((VertexFormat)format);
+                stats.vertexArrayChanges++;
+            }
+
+            Geometry().BindInstances(i);
+            if (count == 1) packet.mesh->DrawGeometry(*packet.shader, packet.lod, instances[i], view);
+            else packet.mesh->DrawInstances(*packet.shader, packet.lod, count);
+            stats.draws++;
+            stats.instances += count;
+        }
+        if (format >= 0) glBindVertexArray(0);
+    }
+
+    // What the last Submit did
+    RenderQueueStats Stats () const
+    {
+        return stats;
+    }
+
+    void PrintStats () const
+    {
+        cout << "Render queue: " << stats.draws << " draws of " << stats.instances << " meshes, " << stats.programChanges << " program changes, " << stats.materialChanges
+             << " material changes, " << stats.vertexArrayChanges << " VAO changes" << endl;
+    }
+
+private:
+    FrameView view;
+    vector<DrawPacket> packets;
+    vector<glm::mat4> transforms;
+    vector<glm::mat4> instances;// transforms in the order they're drawn
+    vector<SortItem> items;// Kept between frames so sorting doesn't allocate
+    vector<SortItem> scratch;
+    unordered_map<GLuint, uint32_t> programNumbers;// This frame's, in the order they were first added
+    unordered_map<uint64_t, uint32_t> materialNumbers;
+    unordered_map<Mesh *, uint32_t> meshNumbers;
+    RenderQueueStats stats;
+
+    // Whether b can be drawn as another instance of a
+    bool sameDraw (const DrawPacket &a, const DrawPacket &b)
+    {
+        return a.mesh == b.mesh && a.lod == b.lod && a.shader->Program == b.shader->Program && a.material == b.material;
+    }
+
+    uint32_t programNumber (GLuint program)
+    {
+        unordered_map<GLuint, uint32_t>::iterator it = programNumbers.find(program);
+        if (it != programNumbers.end()) return it->second;
+        uint32_t number = programNumbers.size() & ((1 << RENDER_KEY_PROGRAM_BITS) - 1);
+        programNumbers[program] = number;
+        return number;
+    }
+
+    // Numbers wrap once there are more materials than the key has room for, which only costs some extra material changes
+    uint32_t materialNumber (uint64_t hash)
+    {
+        unordered_map<uint64_t, uint32_t>::iterator it = materialNumbers.find(hash);
+        if (it != materialNumbers.end()) return it->second;
+        uint32_t number = materialNumbers.size() & ((1 << RENDER_KEY_MATERIAL_BITS) - 1);
+        materialNumbers[hash] = number;
+        return number;
+    }
+
+    // Wraps like materialNumber, which costs draws that could have been instanced
+    uint32_t meshNumber (Mesh *mesh)
+    {
+        unordered_map<Mesh *, uint32_t>::iterator it = meshNumbers.find(mesh);
+        if (it != meshNumbers.end()) return it->second;
+        uint32_t number = meshNumbers.size() & ((1 << RENDER_KEY_MESH_BITS) - 1);
+        meshNumbers[mesh] = number;
+        return number;
+    }
+};
+
+// Sort items by key, least significant byte first. scratch is somewhere to put them between passes.
+void RadixSort (vector<SortItem> &items, vector<SortItem> &scratch)
+{
+    size_t count = items.size();
+    if (count < 2) return;
+    scratch.resize(count);
+
+    // Count every byte in one go
+    uint32_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t key = items[i].key;
+        for (int pass = 0; pass < 8; pass++) histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+
+    SortItem *source = &items[0], *destination = &scratch[0];
+    for (int pass = 0; pass < 8; pass++)
+    {
+        // Every key has the same byte here, so this pass wouldn't move anything
+        uint32_t *histogram = histograms[pass];
+        if (histogram[(source[0].key >> (pass * 8)) & 0xFF] == count) continue;
+
+        uint32_t offsets[256], total = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            offsets[i] = total;
+            total += histogram[i];
+        }
+        for (size_t i = 0; i < count; i++) destination[offsets[(source[i].key >> (pass * 8)) & 0xFF]++] = source[i];
+        swap(source, destination);
+    }
+    if (source != &items[0]) memcpy(&items[0], source, count * sizeof(SortItem));
+}
+
+#endif // RENDERQUEUE_H_INCLUDED
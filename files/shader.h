@@ -11,7 +11,69 @@
 #include <SDL_mixer.h>
 #include <SDL_image.h>
 #include <SDL_opengl.h>
+#include <memory>
+#include <string.h>
+#include <stdio.h>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+#include "hash.h"
 
+// Where each uniform block is bound. Programs get their blocks pointed at these when they're linked.
+#define FRAME_BLOCK_BINDING 0
+#define MATERIAL_BLOCK_BINDING 1
+
+// The hash of a uniform's name, worked out at compile time, for the Shader setters: shader.SetInt( UNIFORM( "material.index" ), 2 )
+#define UNIFORM( name ) ( std::integral_constant< uint64_t, HashName( name ) >::value )
+
+uint64_t UniformElement( uint64_t array, int index );
+uint64_t UniformMember( uint64_t structure, const char *member );
+GLint UniformBlockBinding( const char *block );
+
+// The std140 blocks the shaders share. The C++ structs are laid out to match the GLSL ones byte for byte: a vec3
+// takes 16 bytes unless a float or int follows it to fill the last 4.
+
+// Per frame, used by every shader that needs the camera (layout ( std140 ) uniform Frame). The cluster values
+// say which light cluster a fragment is in (see lightClusters.h).
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 viewPos;
+    GLfloat clusterDepthScale;// Slice = log( depth ) * clusterDepthScale + clusterDepthBias
+    glm::vec2 clusterTileScale;// Tiles per pixel across and down
+    GLfloat clusterDepthBias;
+    GLfloat padding;
+    glm::ivec4 clusterCount;// Tiles across, tiles down and slices
+};
+
+// The values of one material (layout ( std140 ) uniform MaterialBlock)
+struct MaterialUniforms
+{
+    glm::vec3 albedoHolder;
+    GLfloat specularHolder;
+    glm::vec3 normalHolder;
+    GLfloat metallicHolder;
+    GLfloat roughnessHolder;
+    GLfloat AOHolder;
+    GLint has;
+    GLint padding;
+};
+
+static_assert( sizeof( FrameUniforms ) == 176, "FrameUniforms doesn't match the std140 Frame block" );
+static_assert( sizeof( MaterialUniforms ) == 48, "MaterialUniforms doesn't match the std140 MaterialBlock" );
+
+// A uniform the program uses, and the last value the setters gave it
+struct ShaderUniform
+{
+    GLint location;
+    GLenum type;
+    bool set;// Whether value holds anything yet
+    GLfloat value[16];// Big enough for a mat4. Ints are kept as their bits.
+};
 
 class Shader
 {
@@ -92,12 +154,291 @@ public:
         glDeleteShader( vertex );
         glDeleteShader( fragment );
 
+        this->reflectUniforms( );
+        this->bindUniformBlocks( );
     }
     // Uses the current shader
     void Use( )
     {
         glUseProgram( this->Program );
     }
+
+    // Where the uniform with hashed name (see UNIFORM) is, or -1 if the program doesn't use it
+    GLint Location( uint64_t name )
+    {
+        ShaderUniform *uniform = this->find( name );
+        return uniform ? uniform->location : -1;
+    }
+
+    // Typed setters. The shader has to be in use. A value the uniform already has isn't sent again.
+    void SetInt( uint64_t name, GLint value )
+    {
+        ShaderUniform *uniform = this->find( name );
+        if ( uniform && this->changed( uniform, &value, sizeof( value ) ) ) glUniform1i( uniform->location, value );
+    }
+
+    void SetFloat( uint64_t name, GLfloat value )
+    {
+        ShaderUniform *uniform = this->find( name );
+        if ( uniform && this->changed( uniform, &value, sizeof( value ) ) ) glUniform1f( uniform->location, value );
+    }
+
+    void SetVec3( uint64_t name, const glm::vec3 &value )
+    {
+        ShaderUniform *uniform = this->find( name );
+        if ( uniform && this->changed( uniform, glm::value_ptr( value ), sizeof( value ) ) ) glUniform3fv( uniform->location, 1, glm::value_ptr( value ) );
+    }
+
+    void SetMat4( uint64_t name, const glm::mat4 &value )
+    {
+        ShaderUniform *uniform = this->find( name );
+        if ( uniform && this->changed( uniform, glm::value_ptr( value ), sizeof( value ) ) ) glUniformMatrix4fv( uniform->location, 1, GL_FALSE, glm::value_ptr( value ) );
+    }
+
+private:
+    // Every active uniform by the hash of its name. Shaders get passed around by value, so the copies share it,
+    // and with it the values the program has been given.
+    std::shared_ptr< std::unordered_map< uint64_t, ShaderUniform > > uniforms;
+
+    // List the program's active uniforms once, after linking, so nothing looks a name up while drawing.
+    // Arrays of basic types are listed as a whole and as each element.
+    void reflectUniforms( )
+    {
+        this->uniforms = std::make_shared< std::unordered_map< uint64_t, ShaderUniform > >( );
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv( this->Program, GL_ACTIVE_UNIFORMS, &count );
+        glGetProgramiv( this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength );
+        std::string name( maxLength + 16, '\0' );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            GLsizei length;
+            GLint size;
+            GLenum type;
+            glGetActiveUniform( this->Program, i, name.size( ), &length, &size, &type, &name[0] );
+            std::string full( name.c_str( ), length );
+
+            ShaderUniform uniform;
+            uniform.type = type;
+            uniform.set = false;
+            uniform.location = glGetUniformLocation( this->Program, full.c_str( ) );
+            if ( uniform.location < 0 ) continue;// In a uniform block
+
+            // Arrays come back as name[0]
+            size_t bracket = full.size( ) >= 3 && full.compare( full.size( ) - 3, 3, "[0]" ) == 0 ? full.size( ) - 3 : std::string::npos;
+            if ( bracket == std::string::npos )
+            {
+                ( *this->uniforms )[HashString( full )] = uniform;
+                continue;
+            }
+            std::string base = full.substr( 0, bracket );
+            ( *this->uniforms )[HashString( base )] = uniform;
+            for ( GLint element = 0; element < size; element++ )
+            {
+                char elementName[16];
+                snprintf( elementName, sizeof( elementName ), "[%d]", element );
+                uniform.location = glGetUniformLocation( this->Program, ( base + elementName ).c_str( ) );
+                ( *this->uniforms )[HashString( base + elementName )] = uniform;
+            }
+        }
+    }
+
+    // GLSL 330 can't say where a block is bound, so point each block the program uses at its binding here
+    void bindUniformBlocks( )
+    {
+        GLint count = 0;
+        glGetProgramiv( this->Program, GL_ACTIVE_UNIFORM_BLOCKS, &count );
+        for ( GLint i = 0; i < count; i++ )
+        {
+            GLchar name[64];
+            glGetActiveUniformBlockName( this->Program, i, sizeof( name ), NULL, name );
+            GLint binding = UniformBlockBinding( name );
+            if ( binding < 0 )
+            {
+                std::cout << "ERROR::SHADER::UNKNOWN_UNIFORM_BLOCK " << name << std::endl;
+                continue;
+            }
+            glUniformBlockBinding( this->Program, i, binding );
+        }
+    }
+
+    ShaderUniform * find( uint64_t name )
+    {
+        if ( !this->uniforms ) return NULL;
+        std::unordered_map< uint64_t, ShaderUniform >::iterator it = this->uniforms->find( name );
+        return it == this->uniforms->end( ) ? NULL : &it->second;
+    }
+
+    // Remember value as the uniform's, and say whether it's different from what it had
+    bool changed( ShaderUniform *uniform, const void *value, size_t size )
+    {
+        if ( uniform->set && memcmp( uniform->value, value, size ) == 0 ) return false;
+        memcpy( uniform->value, value, size );
+        uniform->set = true;
+        return true;
+    }
+};
+
+// The hash of element index of an array uniform, like light[2] from UNIFORM( "light" )
+uint64_t UniformElement( uint64_t array, int index )
+{
+    char element[16];
+    int length = snprintf( element, sizeof( element ), "[%d]", index );
+    return HashBytes( element, length, array );
+}
+
+// The hash of a member of a struct uniform, like light[2].position from UniformElement( UNIFORM( "light" ), 2 )
+uint64_t UniformMember( uint64_t structure, const char *member )
+{
+    return HashName( member, HashName( ".", structure ) );
+}
+
+// The binding a uniform block of this name goes on, or -1 if it isn't one of ours
+GLint UniformBlockBinding( const char *block )
+{
+    if ( strcmp( block, "Frame" ) == 0 ) return FRAME_BLOCK_BINDING;
+    if ( strcmp( block, "MaterialBlock" ) == 0 ) return MATERIAL_BLOCK_BINDING;
+    return -1;
+}
+
+// A uniform buffer holding one block, rewritten whole when it changes (once a frame for the frame block)
+class UniformBuffer
+{
+public:
+    UniformBuffer( GLuint binding, GLsizeiptr size )
+    {
+        this->binding = binding;
+        this->size = size;
+        this->buffer = 0;
+    }
+
+    // Replace the block's contents with data, which is size bytes, and bind it to its binding point
+    void Update( const void *data )
+    {
+        if ( !this->buffer )
+        {
+            glGenBuffers( 1, &this->buffer );
+            glBindBuffer( GL_UNIFORM_BUFFER, this->buffer );
+            glBufferData( GL_UNIFORM_BUFFER, this->size, NULL, GL_DYNAMIC_DRAW );
+        }
+        glBindBuffer( GL_UNIFORM_BUFFER, this->buffer );
+        glBufferSubData( GL_UNIFORM_BUFFER, 0, this->size, data );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+        this->Bind( );
+    }
+
+    // Point the binding at this buffer, in case something else was bound there since
+    void Bind( )
+    {
+        if ( this->buffer ) glBindBufferBase( GL_UNIFORM_BUFFER, this->binding, this->buffer );
+    }
+
+    void Delete( )
+    {
+        if ( this->buffer ) glDeleteBuffers( 1, &this->buffer );
+        this->buffer = 0;
+    }
+
+private:
+    GLuint binding;
+    GLsizeiptr size;
+    GLuint buffer;
+};
+
+// Many blocks of one kind in one buffer, bound a range at a time. Blocks with the same contents share a range, and
+// ranges are never given back, so a block costs a buffer update when it's first added and a range bind after that.
+class UniformBlockPool
+{
+public:
+    UniformBlockPool( GLuint binding, GLsizeiptr blockSize )
+    {
+        this->binding = binding;
+        this->blockSize = blockSize;
+        this->stride = 0;
+        this->capacity = 0;
+        this->used = 0;
+        this->buffer = 0;
+        this->bound = -1;
+    }
+
+    // Where a block with these contents is, adding it if there isn't one yet. data is the pool's block size.
+    GLintptr Add( const void *data )
+    {
+        uint64_t key = HashBytes( data, this->blockSize );
+        std::unordered_map< uint64_t, GLintptr >::iterator it = this->offsets.find( key );
+        if ( it != this->offsets.end( ) && memcmp( &this->contents[it->second], data, this->blockSize ) == 0 ) return it->second;
+
+        if ( !this->stride )
+        {
+            // Ranges have to start on the driver's alignment
+            GLint alignment = 256;
+            glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+            this->stride = ( this->blockSize + alignment - 1 ) / alignment * alignment;
+        }
+        if ( this->used + this->stride > this->capacity ) this->grow( std::max( this->capacity * 2, this->stride * 64 ) );
+
+        GLintptr offset = this->used;
+        this->used += this->stride;
+        memcpy( &this->contents[offset], data, this->blockSize );
+        glBindBuffer( GL_UNIFORM_BUFFER, this->buffer );
+        glBufferSubData( GL_UNIFORM_BUFFER, offset, this->blockSize, data );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+        this->offsets[key] = offset;
+        return offset;
+    }
+
+    // Bind the block at offset, unless it's the one already bound
+    void Bind( GLintptr offset )
+    {
+        if ( offset == this->bound ) return;
+        glBindBufferRange( GL_UNIFORM_BUFFER, this->binding, this->buffer, offset, this->blockSize );
+        this->bound = offset;
+    }
+
+    // Forget which block is bound, for when something else has used the binding
+    void InvalidateBinding( )
+    {
+        this->bound = -1;
+    }
+
+    // How many distinct blocks there are
+    size_t Count( ) const
+    {
+        return this->offsets.size( );
+    }
+
+private:
+    GLuint binding;
+    GLsizeiptr blockSize;
+    GLsizeiptr stride;// blockSize rounded up to the offset alignment
+    GLsizeiptr capacity;
+    GLsizeiptr used;
+    GLuint buffer;
+    GLintptr bound;
+    std::unordered_map< uint64_t, GLintptr > offsets;// By a hash of the contents
+    std::vector< unsigned char > contents;// A copy of the buffer, to check two blocks really are the same
+
+    // Swap the buffer for a bigger one with the same blocks at the same offsets
+    void grow( GLsizeiptr newCapacity )
+    {
+        GLuint bigger;
+        glGenBuffers( 1, &bigger );
+        glBindBuffer( GL_UNIFORM_BUFFER, bigger );
+        glBufferData( GL_UNIFORM_BUFFER, newCapacity, NULL, GL_STATIC_DRAW );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+        if ( this->buffer )
+        {
+            glBindBuffer( GL_COPY_READ_BUFFER, this->buffer );
+            glBindBuffer( GL_COPY_WRITE_BUFFER, bigger );
+            glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, this->used );
+            glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+            glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+            glDeleteBuffers( 1, &this->buffer );
+        }
+        this->buffer = bigger;
+        this->capacity = newCapacity;
+        this->contents.resize( newCapacity );
+        this->bound = -1;
+    }
 };
 
 /*
@@ -14,7 +14,7 @@ unsigned int LoadCubeMap (vector<std::string> faces)
     int width, height, nrChannels;                                                                                          // Integers to hold the width, height, and number of channels in the image
     for (unsigned int i = 0; i < faces.size(); i++)                                                                           // Loop through the number of faces
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
+        unsigned char *data = LoadImageAsset(faces[i], &width, &height, &nrChannels, 0);
         //unsigned char *data = SOIL_load_image(faces[i].c_str(), &width, &height, &nrChannels, 0);                           // Create variable with the path and image parameters of the texutre
         if (data)                                                                                                           // If image loaded successfully
         {
@@ -0,0 +1,275 @@
+#ifndef TEXTURECACHE_H_INCLUDED
+#define TEXTURECACHE_H_INCLUDED
+
+/***********
+This header holds cooked textures: images already decoded, so loading one is a copy out of a
+mapping instead of a PNG or JPEG decode.
+
+Most are block compressed (see blockCompression.h) with their whole mip chain, and go to the
+GPU as they are with glCompressedTexImage2D, taking a quarter to an eighth of the memory and
+bandwidth. Images the cooker doesn't know the use of are plain RGBA, and get mipmapped on load.
+A compressed texture the driver can't sample is loaded from its source instead.
+
+They're written by the offline cooker (djcook), one file per source image (or per packed
+texture, see texturePacking.h), and keyed like the mesh cache: by the source's path, and checked
+against its modification time and size, so an edited image falls back to decoding the source
+until it's cooked again.
+
+File layout:
+    TextureCacheHeader
+    source path (header.pathLength bytes)
+    padding to TEXTURE_CACHE_ALIGNMENT
+    header.levelCount mip levels, largest first, each TextureLevelSize bytes of header.format
+************/
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "fileUtils.h"
+#include "hash.h"
+#include <glew.h>
+#include "assetPack.h"
+#include "blockCompression.h"
+#include "texturePacking.h"
+#include "stb_image.h"
+
+#define TEXTURE_CACHE_DIRECTORY "resources/cache/"
+#define TEXTURE_CACHE_VERSION 2// Bump whenever the layout of the file changes
+#define TEXTURE_CACHE_ALIGNMENT 16
+
+using namespace std;
+
+struct TextureCacheHeader
+{
+    char magic[4];// Always "DJTX"
+    uint32_t version;// TEXTURE_CACHE_VERSION when the file was cooked
+    int64_t sourceMTime;// Modification time of the source image
+    uint64_t sourceSize;// Size of the source image in bytes
+    uint32_t width;
+    uint32_t height;
+    uint32_t pathLength;// Length of the source path that follows the header
+    uint32_t pixelOffset;// Byte offset of the pixels from the start of the file
+    uint32_t format;// A TextureFormat
+    uint32_t levelCount;// Mip levels stored, 1 for RGBA8
+};
+
+string TextureCachePath (string sourcePath);
+bool WriteTextureCache (string sourcePath, TextureFormat format, int width, int height, int levelCount, const unsigned char *pixels);
+bool RestampTextureCache (string sourcePath);
+bool OpenTextureCache (string sourcePath, AssetData &file, const TextureCacheHeader *&header);
+unsigned char * LoadTextureAsset (string path, int *width, int *height, int *components, int requiredComponents);
+bool TextureAssetInfo (string path, int *width, int *height, int *components);
+bool TextureSourceInfo (string path, int64_t &mTime, uint64_t &size);
+TextureFormat CompressedTextureFormat (string path);
+bool LoadCompressedTextureAsset (string path, TextureFormat format, int width, int height, unsigned char *destination);
+bool TextureFormatSupported (TextureFormat format);
+GLint StoredTextureFormat (TextureFormat format, GLint internalFormat);
+
+// Where the cooked version of a source image lives
+string TextureCachePath (string sourcePath)
+{
+    return string(TEXTURE_CACHE_DIRECTORY) + HashToHex(HashString(NormalizeAssetPath(sourcePath))) + ".djtex";
+}
+
+// Write levelCount mip levels of pixels in format out as the cooked version of sourcePath
+bool WriteTextureCache (string sourcePath, TextureFormat format, int width, int height, int levelCount, const unsigned char *pixels)
+{
+    TextureCacheHeader header;
+    memcpy(header.magic, "DJTX", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.pathLength = sourcePath.size();
+    header.format = format;
+    header.levelCount = levelCount;
+    header.pixelOffset = (sizeof(header) + sourcePath.size() + TEXTURE_CACHE_ALIGNMENT - 1) / TEXTURE_CACHE_ALIGNMENT * TEXTURE_CACHE_ALIGNMENT;
+    if (!TextureSourceInfo(sourcePath, header.sourceMTime, header.sourceSize)) return false;
+
+    // Write to a temporary file and swap it in at the end, so a crash never leaves half a texture behind
+    MakeDirectory(TEXTURE_CACHE_DIRECTORY);
+    string path = TextureCachePath(sourcePath);
+    string tempPath = path + ".tmp";
+    ofstream fout (tempPath.c_str(), ios_base::out | ios_base::binary | ios_base::trunc);
+    if (!fout.is_open())
+    {
+        cout << "ERROR::TEXTURECACHE:: Could not write " << tempPath << endl;
+        return false;
+    }
+    const char padding[TEXTURE_CACHE_ALIGNMENT] = { 0 };
+    fout.write((const char *)&header, sizeof(header));
+    fout.write(sourcePath.c_str(), sourcePath.size());
+    fout.write(padding, header.pixelOffset - sizeof(header) - sourcePath.size());
+    fout.write((const char *)pixels, TextureChainSize(format, width, height, levelCount));
+
+    bool written = fout.good();
+    fout.close();
+    remove(path.c_str());// rename won't replace an existing file on Windows
+    if (!written || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        cout << "ERROR::TEXTURECACHE:: Could not write " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+// Give the cooked version of sourcePath the source's current modification time and size, for when it was saved without changing
+bool RestampTextureCache (string sourcePath)
+{
+    TextureCacheHeader header;
+    fstream file (TextureCachePath(sourcePath).c_str(), ios_base::in | ios_base::out | ios_base::binary);
+    if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "DJTX", 4) != 0) return false;
+    if (!TextureSourceInfo(sourcePath, header.sourceMTime, header.sourceSize)) return false;
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+    return file.good();
+}
+
+// Map the cooked version of sourcePath. Returns false if there isn't one, or it's stale or damaged.
+bool OpenTextureCache (string sourcePath, AssetData &file, const TextureCacheHeader *&header)
+{
+    int64_t mTime;
+    uint64_t size;
+    if (!TextureSourceInfo(sourcePath, mTime, size)) return false;
+    if (!OpenAsset(TextureCachePath(sourcePath), file)) return false;
+
+    header = (const TextureCacheHeader *)file.Data();
+    bool valid = file.Size() >= sizeof(TextureCacheHeader)
+                 && memcmp(header->magic, "DJTX", 4) == 0
+                 && header->version == TEXTURE_CACHE_VERSION
+                 && header->sourceMTime == mTime && header->sourceSize == size
+                 && sizeof(TextureCacheHeader) + header->pathLength <= header->pixelOffset
+                 && header->format < TEXTURE_FORMAT_COUNT && header->width > 0 && header->height > 0
+                 && header->levelCount >= 1 && (int)header->levelCount <= MipLevelCount(header->width, header->height)
+                 && header->pixelOffset + TextureChainSize((TextureFormat)header->format, header->width, header->height, header->levelCount) <= file.Size()
+                 && NormalizeAssetPath(string(file.Data() + sizeof(TextureCacheHeader), header->pathLength)) == NormalizeAssetPath(sourcePath);
+    if (!valid) file.Close();
+    return valid;
+}
+
+// stbi_load for a texture, reading the cooked version instead of decoding the source if there's a good RGBA one.
+// Returns pixels to free with stbi_image_free.
+unsigned char * LoadTextureAsset (string path, int *width, int *height, int *components, int requiredComponents)
+{
+    AssetData file;
+    const TextureCacheHeader *header;
+    if (!OpenTextureCache(path, file, header) || header->format != TEXTURE_FORMAT_RGBA8)
+    {
+        if (IsPackedTexture(path)) return LoadPackedTexture(path, width, height, components, requiredComponents);
+        return LoadImageAsset(path, width, height, components, requiredComponents);
+    }
+
+    // Cooked textures are always RGBA, so drop alpha or copy as asked
+    int channels = requiredComponents ? requiredComponents : 4;
+    size_t pixelCount = (size_t)header->width * header->height;
+    const unsigned char *source = (const unsigned char *)file.Data() + header->pixelOffset;
+    unsigned char *pixels = (unsigned char *)malloc(pixelCount * channels);// stbi_image_free is free
+    if (!pixels) return NULL;
+    if (channels == 4)
+    {
+        memcpy(pixels, source, pixelCount * 4);
+    }
+    else
+    {
+        for (size_t i = 0; i < pixelCount; i++)
+        {
+            for (int c = 0; c < channels; c++) pixels[i * channels + c] = source[i * 4 + min(c, 3)];
+        }
+    }
+    *width = header->width;
+    *height = header->height;
+    *components = 4;
+    return pixels;
+}
+
+// stbi_info for a texture, from the cooked version if there's a good one
+bool TextureAssetInfo (string path, int *width, int *height, int *components)
+{
+    AssetData file;
+    const TextureCacheHeader *header;
+    if (!OpenTextureCache(path, file, header))
+    {
+        *components = 4;
+        if (IsPackedTexture(path)) return PackedTextureInfo(path, width, height);
+        return ImageAssetInfo(path, width, height, components);
+    }
+    *width = header->width;
+    *height = header->height;
+    *components = 4;
+    return true;
+}
+
+// GetAssetInfo for the source of a texture, which for a packed texture is every map in it
+bool TextureSourceInfo (string path, int64_t &mTime, uint64_t &size)
+{
+    if (IsPackedTexture(path)) return PackedTextureSourceInfo(path, mTime, size);
+    return GetAssetInfo(path, mTime, size);
+}
+
+// The block format the cooked version of path is in, if it has one this driver can sample. TEXTURE_FORMAT_RGBA8 if not.
+// Safe on worker threads once GLEW is initialised.
+TextureFormat CompressedTextureFormat (string path)
+{
+    AssetData file;
+    const TextureCacheHeader *header;
+    if (!OpenTextureCache(path, file, header)) return TEXTURE_FORMAT_RGBA8;
+    TextureFormat format = (TextureFormat)header->format;
+    return TextureFormatSupported(format) ? format : TEXTURE_FORMAT_RGBA8;
+}
+
+// Copy the full mip chain of the cooked version of path into destination, which must hold
+// TextureChainSize bytes. Fails if it isn't in format at width by height, e.g. if it was cooked again since it was checked.
+bool LoadCompressedTextureAsset (string path, TextureFormat format, int width, int height, unsigned char *destination)
+{
+    AssetData file;
+    const TextureCacheHeader *header;
+    if (!OpenTextureCache(path, file, header)) return false;
+    int levelCount = MipLevelCount(width, height);
+    if (header->format != (uint32_t)format || (int)header->width != width || (int)header->height != height || (int)header->levelCount != levelCount) return false;
+    memcpy(destination, file.Data() + header->pixelOffset, TextureChainSize(format, width, height, levelCount));
+    return true;
+}
+
+// Whether the driver can sample a block format. RGTC is core in 3.0, S3TC and BPTC are extensions before 4.2.
+bool TextureFormatSupported (TextureFormat format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_RGBA8:
+        return true;
+    case TEXTURE_FORMAT_BC1:
+        return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+    case TEXTURE_FORMAT_BC4:
+    case TEXTURE_FORMAT_BC5:
+        return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+    case TEXTURE_FORMAT_BC7:
+        return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+    default:
+        return false;
+    }
+}
+
+// The internal format to upload texels in format as, for a texture that asked for internalFormat. sRGB stays sRGB.
+GLint StoredTextureFormat (TextureFormat format, GLint internalFormat)
+{
+    bool srgb = internalFormat == GL_SRGB || internalFormat == GL_SRGB8 || internalFormat == GL_SRGB_ALPHA || internalFormat == GL_SRGB8_ALPHA8;
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1:
+        return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXTURE_FORMAT_BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case TEXTURE_FORMAT_BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    case TEXTURE_FORMAT_BC7:
+        return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB : GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+    default:
+        return internalFormat;
+    }
+}
+
+#endif // TEXTURECACHE_H_INCLUDED
@@ -0,0 +1,206 @@
+#ifndef TEXTUREPACKING_H_INCLUDED
+#define TEXTUREPACKING_H_INCLUDED
+
+/***********
+This header packs a material's scalar maps into the channels of one texture.
+
+Ambient occlusion, roughness, metallic and specular are each one channel, so instead of four
+textures (and four binds and samplers a draw) a material gets one:
+
+    R  ambient occlusion (T_AO_)
+    G  roughness (T_RO_)
+    B  metallic (T_ME_)
+    A  specular (T_SP_)
+
+The packed texture doesn't exist on disk. It's named after the maps it's made of, like
+"ORM:T_AO_Brick.png|T_RO_Brick.png||" for a material with no metallic or specular map, and
+loading it loads and packs them. The texture is only as wide as the channels it uses: R8 for
+occlusion alone, RG8 up to roughness, RGBA8 otherwise (or BC4, BC5 and BC7 once cooked).
+Channels without a map read as PackedChannelDefault, and the material ignores them.
+************/
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdint.h>
+#include "assetPack.h"
+#include "stb_image.h"
+
+#define PACKED_TEXTURE_PREFIX "ORM:"
+#define PACKED_CHANNEL_COUNT 4
+
+using namespace std;
+
+string PackedTextureName (const string files[PACKED_CHANNEL_COUNT]);
+bool IsPackedTexture (string path);
+bool SplitPackedTexture (string path, string files[PACKED_CHANNEL_COUNT]);
+int PackedChannelMask (string path);
+int PackedChannelCount (string path);
+unsigned char PackedChannelDefault (int channel);
+const char * PackedChannelType (int channel);
+bool IsPackedTextureType (string type);
+bool PackedTextureInfo (string path, int *width, int *height);
+bool PackedTextureSourceInfo (string path, int64_t &mTime, uint64_t &size);
+unsigned char * LoadPackedTexture (string path, int *width, int *height, int *components, int requiredComponents);
+
+// The name of the texture packing files, which are in channel order with empty strings for channels that have no map
+string PackedTextureName (const string files[PACKED_CHANNEL_COUNT])
+{
+    string name = PACKED_TEXTURE_PREFIX;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++) name += (i ? "|" : "") + files[i];
+    return name;
+}
+
+// Whether path names a packed texture rather than a file
+bool IsPackedTexture (string path)
+{
+    size_t slash = path.find_last_of("/\\");
+    size_t name = slash == string::npos ? 0 : slash + 1;
+    return path.compare(name, sizeof(PACKED_TEXTURE_PREFIX) - 1, PACKED_TEXTURE_PREFIX) == 0;
+}
+
+// The paths of the maps packed into path, in channel order. Channels without a map get an empty string.
+bool SplitPackedTexture (string path, string files[PACKED_CHANNEL_COUNT])
+{
+    if (!IsPackedTexture(path)) return false;
+    size_t slash = path.find_last_of("/\\");
+    string directory = slash == string::npos ? string() : path.substr(0, slash + 1);
+    string list = path.substr(directory.size() + sizeof(PACKED_TEXTURE_PREFIX) - 1);
+
+    size_t start = 0;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+    {
+        size_t end = min(list.find('|', start), list.size());
+        string file = start < list.size() ? list.substr(start, end - start) : string();
+        files[i] = file.empty() ? string() : directory + file;
+        start = end + 1;
+    }
+    return true;
+}
+
+// Bit i is set if channel i has a map
+int PackedChannelMask (string path)
+{
+    string files[PACKED_CHANNEL_COUNT];
+    if (!SplitPackedTexture(path, files)) return 0;
+    int mask = 0;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++) mask |= files[i].empty() ? 0 : 1 << i;
+    return mask;
+}
+
+// How many channels the texture needs: up to the last one with a map
+int PackedChannelCount (string path)
+{
+    int mask = PackedChannelMask(path), count = 0;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++) count = mask & (1 << i) ? i + 1 : count;
+    return count;
+}
+
+// What a channel holds where there's no map: unoccluded, half rough, dielectric, fully specular
+unsigned char PackedChannelDefault (int channel)
+{
+    static const unsigned char defaults[PACKED_CHANNEL_COUNT] = { 255, 128, 0, 255 };
+    return defaults[channel];
+}
+
+// The texture type of the map that goes in a channel
+const char * PackedChannelType (int channel)
+{
+    static const char *types[PACKED_CHANNEL_COUNT] = { "texture_AO", "texture_roughness", "texture_metallic", "texture_specular" };
+    return types[channel];
+}
+
+// Whether maps of type go in a packed texture instead of being bound themselves
+bool IsPackedTextureType (string type)
+{
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+    {
+        if (type == PackedChannelType(i)) return true;
+    }
+    return false;
+}
+
+// The size of a packed texture, which is the size of its biggest map
+bool PackedTextureInfo (string path, int *width, int *height)
+{
+    string files[PACKED_CHANNEL_COUNT];
+    if (!SplitPackedTexture(path, files)) return false;
+    *width = 0;
+    *height = 0;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+    {
+        int mapWidth, mapHeight, components;
+        if (files[i].empty()) continue;
+        if (!ImageAssetInfo(files[i], &mapWidth, &mapHeight, &components)) return false;
+        *width = max(*width, mapWidth);
+        *height = max(*height, mapHeight);
+    }
+    return *width > 0 && *height > 0;
+}
+
+// Like GetAssetInfo for a packed texture: the newest modification time of its maps, and their total size
+bool PackedTextureSourceInfo (string path, int64_t &mTime, uint64_t &size)
+{
+    string files[PACKED_CHANNEL_COUNT];
+    if (!SplitPackedTexture(path, files)) return false;
+    mTime = 0;
+    size = 0;
+    for (int i = 0; i < PACKED_CHANNEL_COUNT; i++)
+    {
+        int64_t mapTime;
+        uint64_t mapSize;
+        if (files[i].empty()) continue;
+        if (!GetAssetInfo(files[i], mapTime, mapSize)) return false;
+        mTime = max(mTime, mapTime);
+        size += mapSize;
+    }
+    return true;
+}
+
+// stbi_load for a packed texture: loads each map and packs its first channel. Maps smaller than the
+// biggest are scaled up to it (nearest texel). Returns pixels to free with stbi_image_free.
+unsigned char * LoadPackedTexture (string path, int *width, int *height, int *components, int requiredComponents)
+{
+    string files[PACKED_CHANNEL_COUNT];
+    if (!SplitPackedTexture(path, files) || !PackedTextureInfo(path, width, height)) return NULL;
+
+    size_t pixelCount = (size_t)*width * *height;
+    unsigned char *pixels = (unsigned char *)malloc(pixelCount * 4);// stbi_image_free is free
+    if (!pixels) return NULL;
+    for (int c = 0; c < PACKED_CHANNEL_COUNT; c++)
+    {
+        if (files[c].empty())
+        {
+            for (size_t i = 0; i < pixelCount; i++) pixels[i * 4 + c] = PackedChannelDefault(c);
+            continue;
+        }
+
+        int mapWidth, mapHeight, mapComponents;
+        unsigned char *map = LoadImageAsset(files[c], &mapWidth, &mapHeight, &mapComponents, 0);
+        if (!map)
+        {
+            cout << "ERROR::TEXTUREPACKING:: Could not decode " << files[c] << endl;
+            free(pixels);
+            return NULL;
+        }
+        for (int y = 0; y < *height; y++)
+        {
+            const unsigned char *row = map + (size_t)(y * mapHeight / *height) * mapWidth * mapComponents;
+            for (int x = 0; x < *width; x++) pixels[((size_t)y * *width + x) * 4 + c] = row[(x * mapWidth / *width) * mapComponents];
+        }
+        stbi_image_free(map);
+    }
+
+    // Drop the channels that weren't asked for. Each texel only moves down, so it can be done in place.
+    *components = 4;
+    int channels = requiredComponents ? requiredComponents : 4;
+    for (size_t i = 0; i < pixelCount && channels != 4; i++)
+    {
+        for (int c = 0; c < channels; c++) pixels[i * channels + c] = pixels[i * 4 + c];
+    }
+    return pixels;
+}
+
+#endif // TEXTUREPACKING_H_INCLUDED
@@ -0,0 +1,308 @@
+#ifndef TEXTUREREGISTRY_H_INCLUDED
+#define TEXTUREREGISTRY_H_INCLUDED
+
+/***********
+This header holds the engine-wide texture registry.
+
+Every model texture is registered under a hash of its canonical path and the parameters
+it was uploaded with, so a texture used by any number of meshes and models is decoded and
+uploaded once. Lookups are a single hash map probe. Each texture is reference counted and
+deleted when the last model using it lets go.
+
+The registry also keeps hit/miss counts and how many bytes of uploads and VRAM the hits saved.
+************/
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <stdint.h>
+#include <string.h>
+#include <glew.h>
+#include "hash.h"
+#include "texturePacking.h"
+
+using namespace std;
+
+// How a texture gets sampled and stored. Two uploads of the same file with different parameters are different textures.
+struct TextureParams
+{
+    GLint internalFormat = GL_SRGB_ALPHA;
+    GLint wrap = GL_REPEAT;
+    GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    GLint magFilter = GL_LINEAR;
+    GLint mipmaps = GL_TRUE;
+};
+
+TextureParams TextureParamsForType (string type, string file);
+string CanonicalTexturePath (string path);
+
+class TextureRegistry
+{
+public:
+    TextureRegistry ()
+    {
+        hits = 0;
+        misses = 0;
+        bytesUploaded = 0;
+        bytesSaved = 0;
+        vramUsed = 0;
+        vramSaved = 0;
+    }
+
+    // Get the texture for path and params if it's already uploaded, adding a reference to it. Returns 0 if it isn't.
+    GLuint Acquire (string path, TextureParams params)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        path = CanonicalTexturePath(path);
+        unordered_map<uint64_t, Entry>::iterator it = find(path, params);
+        if (it == entries.end())
+        {
+            misses++;
+            return 0;
+        }
+
+        Entry &entry = it->second;
+        entry.refCount++;
+        hits++;
+        bytesSaved += entry.uploadBytes;
+        vramSaved += entry.vramBytes;
+        return entry.id;
+    }
+
+    // Whether path and params are already uploaded. Safe to call from worker threads, e.g. to skip decoding.
+    bool Contains (string path, TextureParams params)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        return find(CanonicalTexturePath(path), params) != entries.end();
+    }
+
+    // Register a texture that was just uploaded, with one reference held by the caller.
+    // storedFormat is the internal format it was really uploaded as, if not params.internalFormat (a compressed one, say).
+    void Add (string path, TextureParams params, GLuint id, int width, int height, int sourceChannels, GLint storedFormat = 0)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        Entry entry;
+        entry.path = CanonicalTexturePath(path);
+        entry.params = params;
+        entry.id = id;
+        entry.refCount = 1;
+        entry.storageFreed = false;
+        setSize(entry, width, height, sourceChannels, storedFormat);
+
+        bytesUploaded += entry.uploadBytes;
+        vramUsed += entry.vramBytes;
+        uint64_t key = makeKey(entry.path, params);
+        entries[key] = entry;
+        keysById[id] = key;
+    }
+
+    // Update the size of a texture whose pixels arrive after it's registered, like a streamed texture
+    void SetSize (GLuint id, int width, int height, int sourceChannels, GLint storedFormat = 0)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        unordered_map<GLuint, uint64_t>::iterator idIt = keysById.find(id);
+        if (idIt == keysById.end()) return;
+
+        Entry &entry = entries[idIt->second];
+        bytesUploaded -= entry.uploadBytes;
+        vramUsed -= entry.vramBytes;
+        setSize(entry, width, height, sourceChannels, storedFormat);
+        bytesUploaded += entry.uploadBytes;
+        vramUsed += entry.vramBytes;
+    }
+
+    // Leave a texture out of the VRAM count while its own storage is freed and its pixels are kept somewhere else,
+    // like a layer of the material arrays (see materialArrays.h)
+    void SetStorageFreed (GLuint id, bool freed)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        unordered_map<GLuint, uint64_t>::iterator idIt = keysById.find(id);
+        if (idIt == keysById.end()) return;
+
+        Entry &entry = entries[idIt->second];
+        if (entry.storageFreed == freed) return;
+        if (freed) vramUsed -= entry.vramBytes;
+        else vramUsed += entry.vramBytes;
+        entry.storageFreed = freed;
+    }
+
+    // Add a function to be called with a texture's ID just before it's deleted, so anything still working on it can stop
+    void AddReleaseCallback (function<void(GLuint)> callback)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        releaseCallbacks.push_back(callback);
+    }
+
+    // Stop handing a texture out for its path, like one that failed to load, so the next Acquire misses and loads it
+    // again. Whoever holds it keeps their reference, and it's still deleted once they've all let go.
+    void Forget (GLuint id)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        unordered_map<GLuint, uint64_t>::iterator idIt = keysById.find(id);
+        if (idIt == keysById.end()) return;
+
+        unordered_map<uint64_t, Entry>::iterator it = entries.find(idIt->second);
+        forgotten[id] = it->second;
+        entries.erase(it);
+        keysById.erase(idIt);
+    }
+
+    // Drop a reference to a texture, deleting it once nobody uses it. Must be called on the GL thread.
+    void Release (GLuint id)
+    {
+        lock_guard<mutex> lock (registryMutex);
+        unordered_map<GLuint, uint64_t>::iterator idIt = keysById.find(id);
+        if (idIt != keysById.end())
+        {
+            unordered_map<uint64_t, Entry>::iterator it = entries.find(idIt->second);
+            if (!dropReference(it->second)) return;
+            entries.erase(it);
+            keysById.erase(idIt);
+            return;
+        }
+
+        unordered_map<GLuint, Entry>::iterator forgottenIt = forgotten.find(id);
+        if (forgottenIt != forgotten.end() && dropReference(forgottenIt->second)) forgotten.erase(forgottenIt);
+    }
+
+    // Print how well the registry is doing
+    void PrintStats ()
+    {
+        lock_guard<mutex> lock (registryMutex);
+        uint64_t lookups = hits + misses;
+        cout << "Texture registry: " << entries.size() << " textures resident" << endl;
+        cout << "    " << hits << " hits, " << misses << " misses";
+        if (lookups) cout << " (" << 100.0 * hits / lookups << "% hit rate)";
+        cout << endl;
+        cout << "    Uploaded " << bytesUploaded / 1024 << " KB, saved " << bytesSaved / 1024 << " KB of uploads" << endl;
+        cout << "    Using " << vramUsed / 1024 << " KB of VRAM, saved " << vramSaved / 1024 << " KB" << endl;
+    }
+
+private:
+    struct Entry
+    {
+        string path;
+        TextureParams params;
+        GLuint id;
+        int refCount;
+        uint64_t uploadBytes;// Size of the decoded pixels sent to the driver
+        uint64_t vramBytes;// Estimated size on the GPU, including mipmaps
+        bool storageFreed;// The pixels are only kept elsewhere, so vramBytes isn't counted
+    };
+
+    unordered_map<uint64_t, Entry> entries;// By key
+    unordered_map<GLuint, uint64_t> keysById;// So a texture can be released by its ID alone
+    unordered_map<GLuint, Entry> forgotten;// By ID. Still held, but no longer found by path.
+    mutex registryMutex;
+    vector<function<void(GLuint)> > releaseCallbacks;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytesUploaded;
+    uint64_t bytesSaved;
+    uint64_t vramUsed;
+    uint64_t vramSaved;
+
+    // Drop one of entry's references, deleting its texture if it was the last. Returns whether it was.
+    bool dropReference (Entry &entry)
+    {
+        if (--entry.refCount > 0) return false;
+
+        if (!entry.storageFreed) vramUsed -= entry.vramBytes;
+        for (unsigned int i = 0; i < releaseCallbacks.size(); i++) releaseCallbacks[i](entry.id);
+        glDeleteTextures(1, &entry.id);
+        return true;
+    }
+
+    uint64_t makeKey (string &path, TextureParams &params)
+    {
+        return HashBytes(&params, sizeof(params), HashString(path));
+    }
+
+    // Look up a canonical path. The stored path is checked as well, in case two keys ever collide.
+    unordered_map<uint64_t, Entry>::iterator find (string path, TextureParams &params)
+    {
+        unordered_map<uint64_t, Entry>::iterator it = entries.find(makeKey(path, params));
+        if (it != entries.end() && (it->second.path != path || memcmp(&it->second.params, &params, sizeof(params)) != 0))
+        {
+            return entries.end();
+        }
+        return it;
+    }
+
+    // Work out what a texture costs. Compressed textures are uploaded as they're stored, mipmaps and all.
+    void setSize (Entry &entry, int width, int height, int sourceChannels, GLint storedFormat)
+    {
+        if (storedFormat == 0) storedFormat = entry.params.internalFormat;
+        entry.vramBytes = (uint64_t)width * height * bitsPerTexel(storedFormat) / 8;
+        if (entry.params.mipmaps) entry.vramBytes = entry.vramBytes * 4 / 3;// A full mip chain adds a third
+        entry.uploadBytes = storedFormat != entry.params.internalFormat ? entry.vramBytes : (uint64_t)width * height * sourceChannels;
+    }
+
+    int bitsPerTexel (GLint internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1:
+            return 4;
+        case GL_R8:
+        case GL_COMPRESSED_RG_RGTC2:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM_ARB:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB:
+            return 8;
+        case GL_RG8:
+            return 16;
+        case GL_RGB8:
+        case GL_SRGB8:
+            return 24;
+        case GL_RGBA16F:
+            return 64;
+        default:
+            return 32;
+        }
+    }
+};
+
+// How a kind of map is stored. Only colours are sRGB. Normals keep x and y (the shader rebuilds z), scalar maps one
+// channel, and packed textures as many channels as they use.
+TextureParams TextureParamsForType (string type, string file)
+{
+    static const GLint packedFormats[PACKED_CHANNEL_COUNT + 1] = { GL_R8, GL_R8, GL_RG8, GL_RGBA8, GL_RGBA8 };
+    TextureParams params;
+    if (type == "texture_normal") params.internalFormat = GL_RG8;
+    else if (type == "texture_ORM") params.internalFormat = packedFormats[PackedChannelCount(file)];
+    else if (type != "texture_albedo" && type != "texture_SSColour") params.internalFormat = GL_R8;
+    return params;
+}
+
+// Turn a path into the one spelling the registry uses: forward slashes, no doubled slashes, no "./"
+string CanonicalTexturePath (string path)
+{
+    string canonical;
+    for (unsigned int i = 0; i < path.size(); i++)
+    {
+        char c = path[i] == '\\' ? '/' : path[i];
+        if (c == '/' && !canonical.empty() && canonical[canonical.size() - 1] == '/') continue;
+        canonical += c;
+        if (canonical.size() >= 2 && canonical.compare(canonical.size() - 2, 2, "./") == 0 &&
+            (canonical.size() == 2 || canonical[canonical.size() - 3] == '/'))
+        {
+            canonical.erase(canonical.size() - 2);
+        }
+    }
+    return canonical;
+}
+
+// The registry shared by the whole engine
+TextureRegistry & Textures ()
+{
+    static TextureRegistry registry;
+    return registry;
+}
+
+#endif // TEXTUREREGISTRY_H_INCLUDED
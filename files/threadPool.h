@@ -0,0 +1,112 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+/***********
+This header holds a small pool of worker threads for CPU work (importing, decoding, cooking).
+Nothing submitted to the pool may call OpenGL, since the context only belongs to the main thread.
+************/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+class ThreadPool
+{
+public:
+    // Start threadCount workers, or one per core if threadCount is 0
+    ThreadPool (unsigned int threadCount = 0)
+    {
+        if (threadCount == 0) threadCount = thread::hardware_concurrency();
+        if (threadCount == 0) threadCount = 4;// hardware_concurrency is allowed to not know
+
+        stopping = false;
+        busy = 0;
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            workers.push_back(thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    // Finish whatever's queued, then stop the workers
+    ~ThreadPool ()
+    {
+        {
+            lock_guard<mutex> lock (jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    // Queue a job for the next free worker
+    void Submit (function<void()> job)
+    {
+        {
+            lock_guard<mutex> lock (jobMutex);
+            jobs.push_back(job);
+        }
+        jobReady.notify_one();
+    }
+
+    // Block until the queue is empty and every worker is idle
+    void Wait ()
+    {
+        unique_lock<mutex> lock (jobMutex);
+        allDone.wait(lock, [this] { return jobs.empty() && busy == 0; });
+    }
+
+    unsigned int Size ()
+    {
+        return workers.size();
+    }
+
+private:
+    vector<thread> workers;
+    deque<function<void()> > jobs;
+    mutex jobMutex;
+    condition_variable jobReady;
+    condition_variable allDone;
+    bool stopping;
+    unsigned int busy;// How many workers are running a job right now
+
+    void workerLoop ()
+    {
+        while (true)
+        {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock (jobMutex);
+                jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;// Only empty here when stopping
+                job = jobs.front();
+                jobs.pop_front();
+                busy++;
+            }
+
+            job();
+
+            {
+                lock_guard<mutex> lock (jobMutex);
+                busy--;
+                if (jobs.empty() && busy == 0) allDone.notify_all();
+            }
+        }
+    }
+
+    ThreadPool (const ThreadPool &);
+    ThreadPool & operator= (const ThreadPool &);
+};
+
+// The pool shared by the whole engine, started the first time it's asked for
+ThreadPool & WorkerPool ()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+#endif // THREADPOOL_H_INCLUDED
@@ -0,0 +1,240 @@
+#ifndef VERTEXFORMAT_H_INCLUDED
+#define VERTEXFORMAT_H_INCLUDED
+
+/***********
+This header holds the layouts a mesh's vertices can be stored in on the GPU.
+
+Vertex is what the importer and the mesh cache work with: 56 bytes of floats. Most of that
+precision is wasted once it's on the GPU, so meshes can instead be uploaded as:
+
+VERTEX_FORMAT_PACKED:    24 bytes. Float positions, normal and tangent as signed 10:10:10:2
+                         (the 2 bit w of the tangent is the bitangent's sign), half float UVs.
+VERTEX_FORMAT_QUANTIZED: 20 bytes. As above, but positions are 16 bit, relative to the mesh's
+                         bounding box. The shader scales them back with positionScale and
+                         positionOffset, which Mesh::Draw sets.
+
+The bitangent itself is never stored, the shader rebuilds it from the normal, tangent and sign.
+Packing happens when a mesh is uploaded, so cooked caches keep full precision.
+************/
+
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <glew.h>
+#include <glm.hpp>
+
+using namespace std;
+
+#define DEFAULT_VERTEX_FORMAT VERTEX_FORMAT_PACKED// What meshes are uploaded as unless told otherwise
+#define INSTANCE_ATTRIBUTE 4// The per-instance model matrix takes this attribute and the three after it, a column each
+
+struct Vertex
+{
+    // Position
+    glm::vec3 Position;
+    // Normal
+    glm::vec3 Normal;
+    // Tangent
+    glm::vec3 Tangent;
+    // Tangent
+    glm::vec3 Bitangent;
+    // TexCoords
+    glm::vec2 TexCoords;
+};
+
+enum VertexFormat
+{
+    VERTEX_FORMAT_FULL,// Vertex as is
+    VERTEX_FORMAT_PACKED,// PackedVertex
+    VERTEX_FORMAT_QUANTIZED// QuantizedVertex
+};
+
+struct PackedVertex
+{
+    glm::vec3 Position;
+    GLuint Normal;// GL_INT_2_10_10_10_REV
+    GLuint Tangent;// GL_INT_2_10_10_10_REV, bitangent sign in w
+    GLushort TexCoords[2];// Half floats
+};
+
+struct QuantizedVertex
+{
+    GLshort Position[4];// Normalized to the mesh's bounding box. The 4th is padding.
+    GLuint Normal;
+    GLuint Tangent;
+    GLushort TexCoords[2];
+};
+
+// How to get a quantized position back to model space: position * scale + offset
+struct PositionQuantization
+{
+    glm::vec3 scale = glm::vec3(1.0f);
+    glm::vec3 offset = glm::vec3(0.0f);
+};
+
+GLsizei VertexStride (VertexFormat format);
+void PackVertices (const Vertex *vertices, GLuint vertexCount, VertexFormat format, vector<unsigned char> &packed, PositionQuantization &quantization);
+void SetVertexAttributes (VertexFormat format);
+void SetInstanceAttributes (GLintptr offset);
+GLuint PackSnorm1010102 (glm::vec3 v, float w);
+GLushort FloatToHalf (float f);
+
+// Size of one vertex in format
+GLsizei VertexStride (VertexFormat format)
+{
+    switch (format)
+    {
+    case VERTEX_FORMAT_PACKED:
+        return sizeof(PackedVertex);
+    case VERTEX_FORMAT_QUANTIZED:
+        return sizeof(QuantizedVertex);
+    default:
+        return sizeof(Vertex);
+    }
+}
+
+// Convert vertices to format, into packed. For VERTEX_FORMAT_FULL packed is left empty, upload the vertices as they are.
+void PackVertices (const Vertex *vertices, GLuint vertexCount, VertexFormat format, vector<unsigned char> &packed, PositionQuantization &quantization)
+{
+    quantization = PositionQuantization();
+    packed.clear();
+    if (format == VERTEX_FORMAT_FULL || vertexCount == 0) return;
+
+    // Quantize relative to the bounding box, so the full 16 bits cover just the mesh
+    if (format == VERTEX_FORMAT_QUANTIZED)
+    {
+        glm::vec3 minimum = vertices[0].Position;
+        glm::vec3 maximum = vertices[0].Position;
+        for (GLuint i = 1; i < vertexCount; i++)
+        {
+            minimum = glm::min(minimum, vertices[i].Position);
+            maximum = glm::max(maximum, vertices[i].Position);
+        }
+        quantization.offset = (minimum + maximum) * 0.5f;
+        quantization.scale = (maximum - minimum) * 0.5f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (quantization.scale[axis] <= 0.0f) quantization.scale[axis] = 1.0f;// Flat along this axis
+        }
+    }
+
+    packed.resize(vertexCount * VertexStride(format));
+    for (GLuint i = 0; i < vertexCount; i++)
+    {
+        const Vertex &vertex = vertices[i];
+
+        // Only the sign of the bitangent is kept. Mirrored UVs flip it.
+        float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        GLuint normal = PackSnorm1010102(vertex.Normal, 0.0f);
+        GLuint tangent = PackSnorm1010102(vertex.Tangent, handedness);
+        GLushort u = FloatToHalf(vertex.TexCoords.x);
+        GLushort v = FloatToHalf(vertex.TexCoords.y);
+
+        if (format == VERTEX_FORMAT_PACKED)
+        {
+            PackedVertex *out = (PackedVertex *)&packed[i * sizeof(PackedVertex)];
+            out->Position = vertex.Position;
+            out->Normal = normal;
+            out->Tangent = tangent;
+            out->TexCoords[0] = u;
+            out->TexCoords[1] = v;
+        }
+        else
+        {
+            QuantizedVertex *out = (QuantizedVertex *)&packed[i * sizeof(QuantizedVertex)];
+            glm::vec3 position = (vertex.Position - quantization.offset) / quantization.scale;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                out->Position[axis] = (GLshort)floorf(glm::clamp(position[axis], -1.0f, 1.0f) * 32767.0f + 0.5f);
+            }
+            out->Position[3] = 0;
+            out->Normal = normal;
+            out->Tangent = tangent;
+            out->TexCoords[0] = u;
+            out->TexCoords[1] = v;
+        }
+    }
+}
+
+// Point the attributes of the bound vertex array at the bound buffer, laid out as format.
+// 0 position, 1 normal, 2 texture coordinates, 3 tangent (w is the bitangent's sign, 1 if not stored)
+void SetVertexAttributes (VertexFormat format)
+{
+    GLsizei stride = VertexStride(format);
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    switch (format)
+    {
+    case VERTEX_FORMAT_PACKED:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(PackedVertex, Position));
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *)offsetof(PackedVertex, Normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(PackedVertex, TexCoords));
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *)offsetof(PackedVertex, Tangent));
+        break;
+    case VERTEX_FORMAT_QUANTIZED:
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, stride, (GLvoid *)offsetof(QuantizedVertex, Position));
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *)offsetof(QuantizedVertex, Normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(QuantizedVertex, TexCoords));
+        glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (GLvoid *)offsetof(QuantizedVertex, Tangent));
+        break;
+    default:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(Vertex, Position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(Vertex, Normal));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(Vertex, TexCoords));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid *)offsetof(Vertex, Tangent));
+        break;
+    }
+}
+
+// Point the instance attributes at the model matrices in the bound GL_ARRAY_BUFFER, starting offset bytes in.
+// They step once per instance rather than once per vertex.
+void SetInstanceAttributes (GLintptr offset)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        GLuint attribute = INSTANCE_ATTRIBUTE + column;
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid *)(offset + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(attribute, 1);
+    }
+}
+
+// Pack a unit vector into 10 bits per component, and w (-1 or 1) into the top 2 bits
+GLuint PackSnorm1010102 (glm::vec3 v, float w)
+{
+    GLuint packed = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        int component = (int)floorf(glm::clamp(v[i], -1.0f, 1.0f) * 511.0f + 0.5f);
+        packed |= ((GLuint)component & 0x3FF) << (i * 10);
+    }
+    // -2 rather than -1, since before GL 4.2 a 2 bit -1 only unpacks to -1/3
+    int sign = w < 0.0f ? -2 : (w > 0.0f ? 1 : 0);
+    packed |= ((GLuint)sign & 0x3) << 30;
+    return packed;
+}
+
+// Convert to an IEEE half float, rounding to nearest. Values too small for a half become 0.
+GLushort FloatToHalf (float f)
+{
+    GLuint bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    GLushort sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    GLuint mantissa = bits & 0x7FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF) return sign | 0x7C00 | (mantissa ? 0x200 : 0);// Inf or NaN
+    if (exponent <= 0) return sign;
+    if (exponent >= 31) return sign | 0x7C00;
+
+    GLuint half = ((GLuint)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++;// Round. A carry into the exponent is still the right answer.
+    return sign | (GLushort)min(half, (GLuint)0x7C00);
+}
+
+#endif // VERTEXFORMAT_H_INCLUDED
@@ -23,8 +23,12 @@
 #include "mesh.h"
 #include "files/model.h"
 #include "files/object.h"
+#include "files/modelLoader.h"
 #include "files/skybox.h"
 #include "files/globalIllumination.h"
+#include "files/deferred.h"
+#include "files/culling.h"
+#include "files/bvh.h"
 
 
 
@@ -109,6 +113,9 @@ int main(int argc, char *argv[])
     // END INITIALIZE SDL                                                                           //
     //**********************************************************************************************//
 
+    // Read assets out of the pack djcook -pack makes, if there is one
+    Packs().Mount(ASSET_PACK_PATH);
+
     // Setup OpenGL options
     glEnable(GL_MULTISAMPLE); // Enabled by default on some drivers, but not all so always enable to make sure
     glEnable(GL_DEPTH_TEST);
@@ -126,6 +133,13 @@ int main(int argc, char *argv[])
     Shader skyboxShader ("resources/shaders/skybox.vs", "resources/shaders/skybox.frag");       // Create variable for skybox shader
     Shader PBR_Shader ("resources/shaders/pbr.vs", "resources/shaders/pbr.frag");
     Shader backgroundShader("resources/shaders/background.vs", "resources/shaders/background.frag");
+    Shader gBufferShader ("resources/shaders/pbr.vs", "resources/shaders/gbuffer.frag");              // Deferred shading's geometry pass
+    Shader lightingShader ("resources/shaders/deferred.vs", "resources/shaders/deferred.frag");       // and its lighting pass
+
+    // Run with -deferred to light the scene once per pixel from a G-buffer, instead of once per fragment drawn
+    bool deferred = false;
+    for (int i = 1; i < argc; i++) if (string(argv[i]) == "-deferred") deferred = true;
+    GBuffer gBuffer;
 
     vector<string> faces;                                                                       // Create vector of the cube map face textures
     faces.push_back("resources/images/skybox/right.jpg");                                       //
@@ -142,12 +156,20 @@ int main(int argc, char *argv[])
 
     // Set up both shaders
     PBR_Shader.Use();
-    glUniform1i(glGetUniformLocation (PBR_Shader.Program, "irradianceMap"), 6);
-    glUniform1i(glGetUniformLocation (PBR_Shader.Program, "prefilterMap"), 7);
-    glUniform1i(glGetUniformLocation (PBR_Shader.Program, "brdfLUT"), 8);
+    PBR_Shader.SetInt(UNIFORM("irradianceMap"), 6);
+    PBR_Shader.SetInt(UNIFORM("prefilterMap"), 7);
+    PBR_Shader.SetInt(UNIFORM("brdfLUT"), 8);
+    MaterialTextures().SetUniforms(PBR_Shader);                                                 // Materials in texture arrays sample units 3 to 5 and 9
+
+    MaterialTextures().SetUniforms(gBufferShader);
+    lightingShader.Use();
+    lightingShader.SetInt(UNIFORM("irradianceMap"), 6);
+    lightingShader.SetInt(UNIFORM("prefilterMap"), 7);
+    lightingShader.SetInt(UNIFORM("brdfLUT"), 8);
+    gBuffer.SetUniforms(lightingShader);                                                        // The G-buffer is on units 13 to 16
 
     backgroundShader.Use();
-    glUniform1i(glGetUniformLocation (backgroundShader.Program, "environmentMap"), 0);
+    backgroundShader.SetInt(UNIFORM("environmentMap"), 0);
 
     // Test getting HDR cubemap
     unsigned int envCubemap;
@@ -156,6 +178,14 @@ int main(int argc, char *argv[])
     unsigned int brdfLUTTexture;
     GetEnvAndIrrCubemap(envCubemap, irradianceMap, prefilterMap, brdfLUTTexture, "Newport_Loft");
 
+    // The camera goes to every shader through a uniform block, updated once a frame
+    UniformBuffer frameBlock (FRAME_BLOCK_BINDING, sizeof(FrameUniforms));
+
+    // Lights are sorted into clusters each frame, so each fragment only shades the ones near it
+    LightClusters lightClusters;
+    lightClusters.SetUniforms(PBR_Shader);
+    lightClusters.SetUniforms(lightingShader);
+
     // Set up object vector
     vector <Object> objects;
     objects.push_back(Object(glm::vec3 (5.0f,0.0f,0.0f), glm::vec3 (0.0f,0.0f,0.0f), glm::vec3 (1.0f,1.0f,1.0f), "resources/models/Cube2/Cube.obj"));
@@ -163,12 +193,6 @@ int main(int argc, char *argv[])
     objects.push_back(Object(glm::vec3 (0.0f,-1.0f,0.0f), glm::vec3 (0.0f,0.0f,0.0f), glm::vec3 (1.0f,1.0f,1.0f), "resources/models/Floor/TestScene.obj"));
     objects.push_back(Object(glm::vec3 (0.0f,0.0f,5.0f), glm::vec3 (0.0f,0.0f,0.0f), glm::vec3 (1.0f,1.0f,1.0f), "resources/models/TestModel/TestModel.obj"));
 
-    // Load object all models
-    for (int i = 0; i < objects.size(); i++)
-    {
-        objects[i].model.LoadModel(objects[i].meshDir);
-    }
-
     vector <Light> lights;// LOL
 
     lights.push_back(Light( glm::vec3(0.5f, 0.0f, 5.0f), glm::vec3(100.0f, 100.0f, 100.0f), glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 1.0f, POINT, "resources/models/MatTestSphere/MatTestSphere.obj"));
@@ -176,12 +200,49 @@ int main(int argc, char *argv[])
     lights.push_back(Light( glm::vec3(0.0f, 0.0f, 6.5f), glm::vec3(100.0f, 100.0f, 100.0f), glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 1.0f, POINT,"resources/models/MatTestSphere/MatTestSphere.obj"));
     lights.push_back(Light( glm::vec3(0.0f, 0.0f, 4.5f), glm::vec3(100.0f, 100.0f, 100.0f), glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f), 1.0f, 1.0f, POINT,"resources/models/MatTestSphere/MatTestSphere.obj"));
 
-    // Load all light models
-    for (int i = 0; i < lights.size(); i++)
+    // Run with -benchmarkloading to compare loading the scene's models serially and in parallel
+    vector <string> modelPaths;
+    for (int i = 0; i < objects.size(); i++) modelPaths.push_back(objects[i].meshDir);
+    for (int i = 0; i < lights.size(); i++) modelPaths.push_back(lights[i].meshDir);
+    if (argc > 1 && string(argv[1]) == "-benchmarkloading")
     {
-        lights[i].model.LoadModel(lights[i].meshDir);
+        AsyncTextures().SetEnabled(false);                                                                                  // Time the texture decodes too, not just starting them
+        BenchmarkModelLoading(modelPaths);
+        SDL_DestroyWindow(window);
+        SDL_GL_DeleteContext(context);
+        SDL_Quit();
+        return 0;
     }
 
+    // Run with -benchmarkculling to time culling big made up scenes
+    if (argc > 1 && string(argv[1]) == "-benchmarkculling")
+    {
+        BenchmarkCulling(100000);
+        BenchmarkBVH();
+        SDL_DestroyWindow(window);
+        SDL_GL_DeleteContext(context);
+        SDL_Quit();
+        return 0;
+    }
+
+    // Load all object and light models. Each distinct path is only loaded once, in parallel, and shared by everything that uses it.
+    vector <ModelHandle> handles = Models().GetAll(modelPaths);
+    for (int i = 0; i < objects.size(); i++) objects[i].model = handles[i];
+    for (int i = 0; i < lights.size(); i++) lights[i].model = handles[objects.size() + i];
+    Textures().PrintStats();
+
+    // Where everything is and what it covers, objects then lights. Nothing moves, so it's all worked out once.
+    vector <glm::mat4> sceneTransforms;
+    for (int i = 0; i < objects.size(); i++) sceneTransforms.push_back(objects[i].Transform());
+    for (int i = 0; i < lights.size(); i++) sceneTransforms.push_back(lights[i].Transform());
+    vector <Bounds> sceneBounds;
+    for (int i = 0; i < objects.size(); i++) sceneBounds.push_back(objects[i].WorldBounds());
+    for (int i = 0; i < lights.size(); i++) sceneBounds.push_back(TransformBounds(lights[i].model.GetBounds(), sceneTransforms[objects.size() + i]));
+    BVH sceneTree;                                                                                                          // Culls whole models before their meshes are looked at. Refit it when something moves.
+    sceneTree.Build(sceneBounds);
+    sceneTree.PrintStats();
+    vector <uint32_t> visibleModels;
+
 
     float skyboxVertices[] =
     {
@@ -244,11 +305,6 @@ int main(int argc, char *argv[])
     // Projection type      //          // Projection Type//Field of view//Aspect ratio        // Near clip // Far clip
     glm::mat4 projection = glm::perspective(camera.GetZoom(), (GLfloat)SCREEN_WIDTH/(GLfloat)SCREEN_HEIGHT, 0.1f, 1000.0f);
 
-    PBR_Shader.Use();
-    glUniformMatrix4fv (glGetUniformLocation(PBR_Shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    backgroundShader.Use();
-    glUniformMatrix4fv (glGetUniformLocation(backgroundShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
     // then before rendering, configure the viewport to the original framebuffer's screen dimensions
     glViewport(0, 0, WIDTH, HEIGHT);
 
@@ -258,6 +314,8 @@ int main(int argc, char *argv[])
     clock_t t = clock();
     int frames = 0;
 
+    RenderQueue renderQueue;                                                                                                // Sorts each frame's draws by program, material and VAO
+
     //**********************************************************************************************************************//
     // MAIN LOOP                                                                                                            //
     //**********************************************************************************************************************//
@@ -341,22 +399,15 @@ int main(int argc, char *argv[])
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Use the shader and set up some ititial values
-        PBR_Shader.Use();
-        GLint viewPosLoc = glGetUniformLocation( PBR_Shader.Program, "viewPos");
-        glUniform3f (viewPosLoc, camera.GetPosition( ).x, camera.GetPosition( ).y, camera.GetPosition().z );
-        //glUniform1f(glGetUniformLocation(PBR_Shader.Program, "material.shininess"), 32.0f);
-        glUniform1i(glGetUniformLocation(PBR_Shader.Program, "NUMBER_OF_LIGHTS"), NUMBER_OF_LIGHTS);
-
         // Create camera transformation
         glm::mat4 view;
         view = camera.GetViewMatrix();
-        GLint modelLoc = glGetUniformLocation ( PBR_Shader.Program, "model");
-        GLint viewLoc = glGetUniformLocation ( PBR_Shader.Program, "view");
-        GLint projLoc = glGetUniformLocation ( PBR_Shader.Program, "projection");
 
-        glUniformMatrix4fv ( viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv ( projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        // Start sorting the lights into clusters on a worker while the draws are queued
+        lightClusters.Begin(view, projection, SCREEN_WIDTH, SCREEN_HEIGHT);
+        AddLights(lightClusters, lights);
+        lightClusters.Cluster();
+        FrameView frameView = MakeFrameView(camera, view, projection, SCREEN_HEIGHT);                                       // For culling and picking levels of detail
 
         // bind pre-computed IBL data
         glActiveTexture(GL_TEXTURE6);
@@ -368,57 +419,48 @@ int main(int argc, char *argv[])
         glActiveTexture(GL_TEXTURE8);
         glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
 
-        DrawAllLights(PBR_Shader, lights);
-
-        // For loop to draw all light meshes
-        // For loop to set all objects
-
-        for (int i = 0; i < objects.size(); i++)
+        // Queue the meshes of every light and object in view, then draw them sorted by the state they need
+        Shader &sceneShader = deferred ? gBufferShader : PBR_Shader;
+        renderQueue.Begin(frameView);
+        sceneTree.Cull(frameView.frustum, visibleModels);
+        for (int i = 0; i < visibleModels.size(); i++)
         {
-            glm::mat4 model; // Prepare to apply all transformations to all models
-            model = glm::translate(model, lights[i].location); // Apply translations
-            model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f)); // Apply dilation
-            glUniformMatrix4fv (glGetUniformLocation (PBR_Shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model)); // Apply all transformations
-            // still need to draw the model
-            lights[i].model.Draw(PBR_Shader);
+            unsigned int index = visibleModels[i];
+            ModelHandle &model = index < objects.size() ? objects[index].model : lights[index - objects.size()].model;
+            model.Queue(renderQueue, sceneShader, sceneTransforms[index]);
         }
 
-
-        // For loop to set all objects
-        for (int j = 0; j < 1; j++)
+        // Send the camera and clusters for the whole frame: a handful of buffer updates, however many objects and lights there are
+        FrameUniforms frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.viewPos = camera.GetPosition();
+        lightClusters.Finish(frame);
+        frameBlock.Update(&frame);
+        if (deferred)
         {
-
-        for (int i = 0; i < objects.size(); i++)
-        {
-            glm::mat4 model; // Prepare to apply all transformations to all models
-
-            model = glm::translate(model, objects[i].location); // Apply translations
-            model = glm::scale(model, objects[i].scale); // Apply dilation
-            model = glm::rotate(model, objects[i].rotation.z, glm::vec3(0.0f,0.0f,1.0f)); // Rotate on z axis
-            model = glm::rotate(model, objects[i].rotation.y, glm::vec3(0.0f,1.0f,0.0f)); // Rotate on y axis
-            model = glm::rotate(model, objects[i].rotation.x, glm::vec3(1.0f,0.0f,0.0f)); // Rotate on x axis
-
-            glUniformMatrix4fv (glGetUniformLocation (PBR_Shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model)); // Apply all transformations
-
-            // still need to draw the model
-            objects[i].model.Draw(PBR_Shader);
+            gBuffer.BeginGeometry(SCREEN_WIDTH, SCREEN_HEIGHT);
+            renderQueue.Submit();
+            gBuffer.EndGeometry();
+            gBuffer.Light(lightingShader);
         }
-
+        else
+        {
+            renderQueue.Submit();
         }
 
-        viewLoc = glGetUniformLocation ( skyboxShader.Program, "view");
-        projLoc = glGetUniformLocation ( skyboxShader.Program, "projection");
-
         // render skybox (render as last to prevent overdraw)
         glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
         backgroundShader.Use();
-        glUniformMatrix4fv (glGetUniformLocation(backgroundShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
         renderCube();
         glDepthFunc(GL_LESS); // set depth function back to default
 
 
+        // Copy the next slice of any streaming textures, so a big texture never stalls a whole frame
+        AsyncTextures().Update(TEXTURE_UPLOAD_BUDGET);
+
         // Swap screen buffers
         SDL_GL_SwapWindow(window);
     }
@@ -430,6 +472,9 @@ int main(int argc, char *argv[])
     //**********************************************************************************************************************//
     // CLEAN UP                                                                                                             //
     //**********************************************************************************************************************//
+    objects.clear();                                                                                                        // Release the shared models while the context still exists
+    lights.clear();                                                                                                         //
+    handles.clear();                                                                                                        //
     SDL_DestroyWindow(window);																								// Destroy the window before exiting
     SDL_GL_DeleteContext(context);                                                                                          //
     SDL_Quit();																												// Quit SDL
@@ -1,8 +1,16 @@
 #version 330 core
 layout (location = 0) in vec3 position;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform Frame // See FrameUniforms in shader.h
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float clusterDepthScale;
+    vec2 clusterTileScale;
+    float clusterDepthBias;
+    ivec4 clusterCount;
+};
 
 out vec3 WorldPos;
 
@@ -3,8 +3,16 @@ layout (location = 0) in vec3 position;
 
 out vec3 WorldPos;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform Frame // See FrameUniforms in shader.h
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float clusterDepthScale;
+    vec2 clusterTileScale;
+    float clusterDepthBias;
+    ivec4 clusterCount;
+};
 
 void main()
 {
@@ -0,0 +1,200 @@
+#version 330 core
+// The lighting pass of deferred shading: lights every pixel of the G-buffer once, the same way pbr.frag lights a
+// fragment, whatever was drawn over what (see deferred.h)
+
+out vec4 colour;
+
+layout (std140) uniform Frame // See FrameUniforms in shader.h
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float clusterDepthScale;
+    vec2 clusterTileScale;
+    float clusterDepthBias;
+    ivec4 clusterCount;
+};
+
+// The G-buffer
+uniform sampler2D gAlbedo; // Albedo (gamma 2.2) and ambient occlusion
+uniform sampler2D gNormal; // Octahedral world space normal
+uniform sampler2D gMaterial; // Metallic, roughness and specular
+uniform sampler2D gDepth;
+
+uniform samplerCube irradianceMap;
+uniform samplerCube prefilterMap;
+uniform sampler2D brdfLUT;
+
+// The frame's lights, sorted into clusters (see lightClusters.h)
+uniform samplerBuffer lightData; // Two texels a light: position and radius, then colour and type
+uniform usamplerBuffer clusterGrid; // Per cluster: where its lights start in clusterLights, and how many there are
+uniform usamplerBuffer clusterLights;
+
+const float PI = 3.14159265359;
+
+vec3 DecodeNormal(vec2 encoded);
+vec3 GammaCorrect (vec3 colour); // Function to gamma correct the final result
+vec3 fresnelSchlick(float cosTheta, vec3 F0); // Fresnel equation: caculates the ratio between specular and diffuse reflection
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
+float DistributionGGX(vec3 N, vec3 H, float roughness); // Normal distribution function
+float GeometrySchlickGGX(float NdotV, float roughness); // Geometry function
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness);
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depthSample = texelFetch(gDepth, pixel, 0).r;
+    if (depthSample >= 1.0) discard; // Nothing was drawn here, so the background shows through
+    gl_FragDepth = depthSample; // So whatever's drawn after depth tests against the scene
+
+    // Rebuild the position from the depth: undo the projection into view space, then the view into world space
+    vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(gDepth, 0))) * 2.0 - 1.0;
+    float depth = projection[3][2] / (depthSample * 2.0 - 1.0 + projection[2][2]);
+    vec3 viewPosition = vec3(ndc.x * depth / projection[0][0], ndc.y * depth / projection[1][1], -depth);
+    vec3 WorldPos = transpose(mat3(view)) * (viewPosition - view[3].xyz);
+
+    vec4 albedoAO = texelFetch(gAlbedo, pixel, 0);
+    vec4 surface  = texelFetch(gMaterial, pixel, 0);
+    vec3 albedo     = pow(albedoAO.rgb, vec3(2.2));
+    float ao        = albedoAO.a;
+    float metallic  = surface.r;
+    float roughness = surface.g;
+    float specularAm = surface.b;
+    vec3 N = DecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+
+    vec3 V = normalize( viewPos - WorldPos );
+    vec3 R = reflect(-V, N);
+
+    vec3 F0 = vec3(0.2)*specularAm;
+    F0 = mix(F0, albedo, metallic);
+
+
+    // Find this pixel's cluster
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterTileScale), int(floor(log(depth) * clusterDepthScale + clusterDepthBias)));
+    cell = clamp(cell, ivec3(0), clusterCount.xyz - 1);
+    uvec2 lightRange = texelFetch(clusterGrid, cell.x + clusterCount.x * (cell.y + clusterCount.y * cell.z)).xy;
+
+    // reflectance equation, over the lights that reach this cluster
+    vec3 Lo = vec3(0.0);
+    //for(int i = 0; i < NUMBER_OF_LIGHTS; i++)
+    for(uint i = 0u; i < lightRange.y; i++)
+    {
+        int index = int(texelFetch(clusterLights, int(lightRange.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, index * 2);
+        vec3 lightColour = texelFetch(lightData, index * 2 + 1).rgb;
+
+        // calculate per-light radiance
+        vec3 L = normalize(positionRadius.xyz - WorldPos);
+        vec3 H = normalize(V + L);
+        float distance    = length(positionRadius.xyz - WorldPos);
+        // Inverse square, faded to nothing at the light's radius so there's no edge where the clusters stop
+        float fade        = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = fade * fade / (distance * distance);
+        vec3 radiance     = lightColour * attenuation;
+
+        // cook-torrance brdf
+        float NDF = DistributionGGX(N, H, roughness);
+        float G   = GeometrySmith(N, V, L, roughness);
+        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+        vec3 numerator    = NDF * G * F;
+        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.001;
+        vec3 specular     = numerator / denominator;
+
+        vec3 kS = F;
+        vec3 kD = vec3(1.0) - kS;
+        kD *= 1.0 - metallic;
+        // add to outgoing radiance Lo
+        float NdotL = max(dot(N, L), 0.0);
+        Lo += (kD * albedo / PI + specular) * radiance * NdotL;
+    }
+
+    // ambient lighting (we now use IBL as the ambient term)
+    vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
+
+    // Calculate ambient from environment map
+    vec3 kS = F;
+    vec3 kD = 1.0 - kS;
+    kD *= 1.0 - metallic;
+    vec3 irradiance = texture(irradianceMap, N).rgb;
+    vec3 diffuse    = irradiance * albedo;
+
+    // sample both the pre-filter map and the BRDF lut and combine them together as per the Split-Sum approximation to get the IBL specular part.
+    const float MAX_REFLECTION_LOD = 4.0;
+    vec3 prefilteredColor = textureLod(prefilterMap, R,  roughness * MAX_REFLECTION_LOD).rgb;
+   //vec3 prefilteredColor = textureLod(irradianceMap, R,  roughness * MAX_REFLECTION_LOD).rgb;
+    vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
+    vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
+
+    vec3 ambient    = (kD * diffuse + specular) * ao;
+   // vec3 ambient    = (kD * diffuse + specular) * 0.0f;
+
+    vec3 result = ambient + Lo;
+    result = result / (result + vec3(1.0));
+    result = GammaCorrect (result);// Gamma correct
+
+    colour = vec4 (result, 1.0);
+
+}
+
+
+vec3 fresnelSchlick(float cosTheta, vec3 F0)
+{
+    return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+float DistributionGGX(vec3 N, vec3 H, float roughness)
+{
+    float a      = roughness*roughness;
+    float a2     = a*a;
+    float NdotH  = max(dot(N, H), 0.0);
+    float NdotH2 = NdotH*NdotH;
+
+    float num   = a2;
+    float denom = (NdotH2 * (a2 - 1.0) + 1.0);
+    denom = PI * denom * denom;
+
+    return num / denom;
+}
+
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    float r = (roughness + 1.0);
+    float k = (r*r) / 8.0;
+
+    float num   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return num / denom;
+}
+
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2  = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1  = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+
+vec3 GammaCorrect (vec3 colour)
+{
+    float gamma = 2.2;
+    return pow(colour.rgb, vec3(1.0/gamma));
+}
+
+// Undo the octahedral encoding gbuffer.frag stores normals with
+vec3 DecodeNormal(vec2 encoded)
+{
+    encoded = encoded * 2.0 - 1.0;
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float fold = clamp(-n.z, 0.0, 1.0);
+    n.xy += vec2(n.x >= 0.0 ? -fold : fold, n.y >= 0.0 ? -fold : fold);
+    return normalize(n);
+}
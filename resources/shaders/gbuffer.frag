@@ -0,0 +1,99 @@
+#version 330 core
+// The geometry pass of deferred shading: works out the surface the same way pbr.frag does, but writes it to the
+// G-buffer instead of lighting it (see deferred.h)
+
+layout (location = 0) out vec4 gAlbedo; // Albedo as the texture stores it (gamma 2.2), and ambient occlusion
+layout (location = 1) out vec2 gNormal; // World space normal, octahedral encoded
+layout (location = 2) out vec4 gMaterial; // Metallic, roughness and specular
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec4 Tangent;
+in vec3 WorldPos;
+
+struct Material
+{
+    sampler2D texture_albedo;
+    sampler2D texture_normal;
+    sampler2D texture_ORM; // R occlusion, G roughness, B metallic, A specular
+
+    // The same maps for materials in the material arrays, which index says the row of materialTable for (-1 if not)
+    sampler2DArray albedoArray;
+    sampler2DArray normalArray;
+    sampler2DArray ORMArray;
+    int index;
+};
+
+// The material's values, one block per material bound by range (see MaterialUniforms in shader.h)
+layout (std140) uniform MaterialBlock
+{
+    vec3 albedoHolder;
+    float specularHolder;
+    vec3 normalHolder;
+    float metallicHolder;
+    float roughnessHolder;
+    float AOHolder;
+    int has; // Bit 0 albedo, bit 1 normal, bits 2 to 5 occlusion, roughness, metallic and specular
+};
+
+uniform Material material;
+uniform isamplerBuffer materialTable; // Per row: the albedo, normal and ORM layers, then the has mask
+
+vec3 getNormalFromMap(vec2 tangentXY);
+vec2 EncodeNormal(vec3 n);
+
+void main()
+{
+    vec4 albedoMap, normalMap, orm;
+    int maps;
+    if (material.index >= 0)
+    {
+        ivec4 row = texelFetch(materialTable, material.index);
+        albedoMap = texture(material.albedoArray, vec3(TexCoords, row.x));
+        normalMap = texture(material.normalArray, vec3(TexCoords, row.y));
+        orm       = texture(material.ORMArray, vec3(TexCoords, row.z));
+        maps      = row.w;
+    }
+    else
+    {
+        albedoMap = texture(material.texture_albedo, TexCoords);
+        normalMap = texture(material.texture_normal, TexCoords);
+        orm       = texture(material.texture_ORM, TexCoords);
+        maps      = has;
+    }
+
+    // The holders are linear, so they go back to gamma 2.2 to be stored like the textures
+    vec3 albedo     = (maps & 1) != 0 ? albedoMap.rgb : pow(albedoHolder, vec3(1.0 / 2.2));
+    float specularAm = (maps & 32) != 0 ? orm.a : specularHolder;
+    float metallic  = (maps & 16) != 0 ? orm.b : metallicHolder;
+    float roughness = (maps & 8) != 0 ? orm.g : roughnessHolder;
+    float ao        = (maps & 4) != 0 ? orm.r : AOHolder;
+    vec3 N          = (maps & 2) != 0 ? getNormalFromMap(normalMap.xy) : normalize(Normal);
+
+    gAlbedo = vec4(albedo, ao);
+    gNormal = EncodeNormal(N);
+    gMaterial = vec4(metallic, roughness, specularAm, 1.0);
+}
+
+vec3 getNormalFromMap(vec2 tangentXY)
+{
+    // Normal maps only store x and y (as RG8 or BC5), so z is rebuilt from them
+    tangentXY = tangentXY * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(tangentXY, sqrt(max(1.0 - dot(tangentXY, tangentXY), 0.0)));
+
+    // The bitangent is rebuilt from the vertex tangent and its sign. The UVs are flipped on import, hence the minus.
+    vec3 N   = normalize(Normal);
+    vec3 T  = normalize(Tangent.xyz - N * dot(N, Tangent.xyz));
+    vec3 B  = -cross(N, T) * sign(Tangent.w);
+    mat3 TBN = mat3(T, B, N);
+
+    return normalize(TBN * tangentNormal);
+}
+
+// Fold the unit sphere onto an octahedron and flatten it into a square, so a normal fits in two channels
+vec2 EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return (n.z >= 0.0 ? n.xy : folded) * 0.5 + 0.5;
+}
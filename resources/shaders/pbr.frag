@@ -1,5 +1,4 @@
 #version 330 core
-#define MAX_NUMBER_OF_LIGHTS 20
 #define POINT 0
 #define DIRECTIONAL 1
 #define SPOT 2
@@ -8,32 +7,32 @@ out vec4 colour;
 
 in vec2 TexCoords;
 in vec3 Normal;
+in vec4 Tangent;
 in vec3 WorldPos;
 
 struct Material
 {
     sampler2D texture_albedo;
-    sampler2D texture_specular;
     sampler2D texture_normal;
-    sampler2D texture_metallic;
-    sampler2D texture_roughness;
-    sampler2D texture_AO;
+    sampler2D texture_ORM; // R occlusion, G roughness, B metallic, A specular
 
-    int hasAL;
-    int hasSP;
-    int hasNO;
-    int hasME;
-    int hasRO;
-    int hasAO;
-
-    float shininess;
+    // The same maps for materials in the material arrays, which index says the row of materialTable for (-1 if not)
+    sampler2DArray albedoArray;
+    sampler2DArray normalArray;
+    sampler2DArray ORMArray;
+    int index;
+};
 
+// The material's values, one block per material bound by range (see MaterialUniforms in shader.h)
+layout (std140) uniform MaterialBlock
+{
     vec3 albedoHolder;
     float specularHolder;
     vec3 normalHolder;
     float metallicHolder;
     float roughnessHolder;
     float AOHolder;
+    int has; // Bit 0 albedo, bit 1 normal, bits 2 to 5 occlusion, roughness, metallic and specular
 };
 
 
@@ -79,8 +78,11 @@ struct SpotLight
 struct Light
 {
     vec3 position;// Location
+    float cutOff;
     vec3 diffuse;// RGB of diffuse
+    float outerCutOff;
     vec3 ambient;// RGB of ambient
+    int type;// The type of light: 0 for point light, 1 for directional light, 2 for spot light
     vec3 specular;// RGE of specular
     vec3 direction;// Components of direction
     /*
@@ -88,9 +90,6 @@ struct Light
     float linear;// Amount of linear falloff
     float quadratic;// Amount of quadratic falloff
     */
-    float cutOff;
-    float outerCutOff;
-    int type;// The type of light: 0 for point light, 1 for directional light, 2 for spot light
 };
 
 uniform samplerCube irradianceMap;
@@ -98,16 +97,30 @@ uniform samplerCube prefilterMap;
 uniform sampler2D brdfLUT;
 
 uniform vec3 lightPos;
-uniform vec3 viewPos;
 //uniform sampler2D texture_diffuse;
 uniform Material material;
+uniform isamplerBuffer materialTable; // Per row: the albedo, normal and ORM layers, then the has mask
+
+layout (std140) uniform Frame // See FrameUniforms in shader.h
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float clusterDepthScale;
+    vec2 clusterTileScale;
+    float clusterDepthBias;
+    ivec4 clusterCount;
+};
 
-uniform int LIGHT_AMOUNT;
 uniform DirLight dirLight;
 uniform PointLight pointLight;
 uniform SpotLight spotLight;
 //uniform const int  NUMBER_OF_LIGHTS;
-uniform Light light[MAX_NUMBER_OF_LIGHTS];
+
+// The frame's lights, sorted into clusters (see lightClusters.h)
+uniform samplerBuffer lightData; // Two texels a light: position and radius, then colour and type
+uniform usamplerBuffer clusterGrid; // Per cluster: where its lights start in clusterLights, and how many there are
+uniform usamplerBuffer clusterLights;
 
 
 const float PI = 3.14159265359;
@@ -118,7 +131,7 @@ vec3 CalcPointLight (Light light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight (Light light, vec3 normal, vec3 fragPos, vec3 viewDir);
 // int *testPointer;
 
-vec3 getNormalFromMap();
+vec3 getNormalFromMap(vec2 tangentXY);
 vec3 GammaCorrect (vec3 colour); // Function to gamma correct the final result
 vec3 fresnelSchlick(float cosTheta, vec3 F0); // Fresnel equation: caculates the ratio between specular and diffuse reflection
 vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
@@ -130,20 +143,38 @@ void main ( )
 {
 
 // Set parameters
-    vec3 albedo     = pow(texture(material.texture_albedo, TexCoords).rgb, vec3(float (2.2)) );
-    float specularAm   = texture(material.texture_specular, TexCoords).r;
-    float metallic  = texture(material.texture_metallic, TexCoords).r;
-    float roughness = texture(material.texture_roughness, TexCoords).r;
-    float ao        = texture(material.texture_AO, TexCoords).r;
-    vec3 N = getNormalFromMap();
+    vec4 albedoMap, normalMap, orm;
+    int maps;
+    if (material.index >= 0)
+    {
+        ivec4 row = texelFetch(materialTable, material.index);
+        albedoMap = texture(material.albedoArray, vec3(TexCoords, row.x));
+        normalMap = texture(material.normalArray, vec3(TexCoords, row.y));
+        orm       = texture(material.ORMArray, vec3(TexCoords, row.z));
+        maps      = row.w;
+    }
+    else
+    {
+        albedoMap = texture(material.texture_albedo, TexCoords);
+        normalMap = texture(material.texture_normal, TexCoords);
+        orm       = texture(material.texture_ORM, TexCoords);
+        maps      = has;
+    }
+
+    vec3 albedo     = pow(albedoMap.rgb, vec3(float (2.2)) );
+    float specularAm   = orm.a;
+    float metallic  = orm.b;
+    float roughness = orm.g;
+    float ao        = orm.r;
+    vec3 N = getNormalFromMap(normalMap.xy);
 
     // Correct missing textures
-    if (material.hasAL == 0) albedo = material.albedoHolder;
-    if (material.hasSP == 0) specularAm = material.specularHolder;
-    if (material.hasME == 0) metallic = material.metallicHolder;
-    if (material.hasRO == 0) roughness = material.roughnessHolder;
-    if (material.hasAO == 0) ao = material.AOHolder;
-    if (material.hasNO == 0) N = normalize(Normal);
+    if ((maps & 1) == 0) albedo = albedoHolder;
+    if ((maps & 32) == 0) specularAm = specularHolder;
+    if ((maps & 16) == 0) metallic = metallicHolder;
+    if ((maps & 8) == 0) roughness = roughnessHolder;
+    if ((maps & 4) == 0) ao = AOHolder;
+    if ((maps & 2) == 0) N = normalize(Normal);
 
     vec3 V = normalize( viewPos - WorldPos );
     vec3 R = reflect(-V, N);
@@ -152,17 +183,29 @@ void main ( )
     F0 = mix(F0, albedo, metallic);
 
 
-    // reflectance equation
+    // Find this fragment's cluster
+    float depth = max(-(view * vec4(WorldPos, 1.0)).z, 1e-4);
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy * clusterTileScale), int(floor(log(depth) * clusterDepthScale + clusterDepthBias)));
+    cell = clamp(cell, ivec3(0), clusterCount.xyz - 1);
+    uvec2 lightRange = texelFetch(clusterGrid, cell.x + clusterCount.x * (cell.y + clusterCount.y * cell.z)).xy;
+
+    // reflectance equation, over the lights that reach this cluster
     vec3 Lo = vec3(0.0);
     //for(int i = 0; i < NUMBER_OF_LIGHTS; i++)
-    for(int i = 0; i < LIGHT_AMOUNT; i++)
+    for(uint i = 0u; i < lightRange.y; i++)
     {
+        int index = int(texelFetch(clusterLights, int(lightRange.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, index * 2);
+        vec3 lightColour = texelFetch(lightData, index * 2 + 1).rgb;
+
         // calculate per-light radiance
-        vec3 L = normalize(light[i].position - WorldPos);
+        vec3 L = normalize(positionRadius.xyz - WorldPos);
         vec3 H = normalize(V + L);
-        float distance    = length(light[i].position - WorldPos);
-        float attenuation = 1.0 / (distance * distance);
-        vec3 radiance     = light[i].diffuse * attenuation;
+        float distance    = length(positionRadius.xyz - WorldPos);
+        // Inverse square, faded to nothing at the light's radius so there's no edge where the clusters stop
+        float fade        = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = fade * fade / (distance * distance);
+        vec3 radiance     = lightColour * attenuation;
 
         // cook-torrance brdf
         float NDF = DistributionGGX(N, H, roughness);
@@ -261,18 +304,16 @@ vec3 GammaCorrect (vec3 colour)
     return pow(colour.rgb, vec3(1.0/gamma));
 }
 
-vec3 getNormalFromMap()
+vec3 getNormalFromMap(vec2 tangentXY)
 {
-    vec3 tangentNormal = texture(material.texture_normal, TexCoords).xyz * 2.0 - 1.0;
-
-    vec3 Q1  = dFdx(WorldPos);
-    vec3 Q2  = dFdy(WorldPos);
-    vec2 st1 = dFdx(TexCoords);
-    vec2 st2 = dFdy(TexCoords);
+    // Normal maps only store x and y (as RG8 or BC5), so z is rebuilt from them
+    tangentXY = tangentXY * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(tangentXY, sqrt(max(1.0 - dot(tangentXY, tangentXY), 0.0)));
 
+    // The bitangent is rebuilt from the vertex tangent and its sign. The UVs are flipped on import, hence the minus.
     vec3 N   = normalize(Normal);
-    vec3 T  = normalize(Q1*st2.t - Q2*st1.t);
-    vec3 B  = -normalize(cross(N, T));
+    vec3 T  = normalize(Tangent.xyz - N * dot(N, Tangent.xyz));
+    vec3 B  = -cross(N, T) * sign(Tangent.w);
     mat3 TBN = mat3(T, B, N);
 
     return normalize(TBN * tangentNormal);
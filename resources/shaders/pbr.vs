@@ -2,20 +2,33 @@
 layout ( location = 0 ) in vec3 position;
 layout ( location = 1 ) in vec3 normal;
 layout ( location = 2 ) in vec2 texCoords;
+layout ( location = 3 ) in vec4 tangent; // w is the sign of the bitangent
+layout ( location = 4 ) in mat4 model; // One per instance, see GeometryPool::BindInstances. Takes locations 4 to 7.
 
 out vec3 WorldPos;
 out vec2 TexCoords;
 out vec3 Normal;
+out vec4 Tangent;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform Frame // See FrameUniforms in shader.h
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    float clusterDepthScale;
+    vec2 clusterTileScale;
+    float clusterDepthBias;
+    ivec4 clusterCount;
+};
+uniform vec3 positionScale; // Undoes position quantization, see vertexFormat.h
+uniform vec3 positionOffset;
 
 void main( )
 {
     TexCoords = texCoords;
-    WorldPos = vec3(model * vec4(position, 1.0));
+    WorldPos = vec3(model * vec4(position * positionScale + positionOffset, 1.0));
     Normal = mat3(model) * normal;
+    Tangent = vec4(mat3(model) * tangent.xyz, tangent.w);
 
     gl_Position =  projection * view * vec4(WorldPos, 1.0);
 